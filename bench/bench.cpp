@@ -0,0 +1,402 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+
+// ccd-bench times the kernels on their own, without VapourSynth, source decoding or resizing in
+// the way, so a change in any of them shows up as a change in its own numbers. Every kernel
+// variant this CPU has is run on every size and thread count asked for, on a synthetic frame or
+// on one dumped from a real clip, and one line is printed for each:
+//   ms/frame  - the fastest of the runs
+//   ns/pixel  - the same per output pixel
+//   GB/s      - the frame read and written, 24 bytes a pixel, over that time
+//   scaling   - how much faster than the same variant on one thread
+// See ccdBenchUsage for the arguments.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core.h"
+#include "kernel.h"
+#include "threadpool.h"
+
+namespace {
+
+struct ccdBenchSize {
+    std::string name;
+    int width;
+    int height;
+};
+
+const ccdBenchSize ccd_bench_sizes[] = {
+    {"720p", 1280, 720},
+    {"1080p", 1920, 1080},
+    {"4k", 3840, 2160},
+    {"8k", 7680, 4320},
+};
+
+// The first 64 byte boundary in buffer, which has to have 64 bytes to spare.
+template <typename T>
+T *ccdBenchAligned(std::vector<uint8_t> &buffer) {
+    uintptr_t p = reinterpret_cast<uintptr_t>(buffer.data());
+    return reinterpret_cast<T *>((p + 63) & ~static_cast<uintptr_t>(63));
+}
+
+// Three float planes, every row starting on a 64 byte boundary like in VapourSynth's frames.
+struct ccdBenchFrame {
+    std::vector<uint8_t> storage;
+    float *planes[3];
+    ptrdiff_t stride;
+
+    ccdBenchFrame(int width, int height) : stride((width + 15) & ~static_cast<ptrdiff_t>(15)) {
+        storage.resize(stride * height * 3 * sizeof(float) + 64);
+        float *base = ccdBenchAligned<float>(storage);
+        for (int plane = 0; plane < 3; plane++)
+            planes[plane] = base + stride * height * plane;
+    }
+};
+
+// Gradients with hard edges and chroma noise on top, about what the filter is for. Always the
+// same frame for the same size, so runs can be compared.
+void ccdBenchSynthetic(ccdBenchFrame &frame, int width, int height) {
+    uint32_t state = 12345;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float base = (x / 64 + y / 48) % 2 ? 0.65f : 0.35f;
+            for (int plane = 0; plane < 3; plane++) {
+                state = state * 1664525 + 1013904223;
+                float noise = (static_cast<float>(state >> 8) / (1 << 24) - 0.5f) * 0.04f;
+                float v = base + 0.1f * plane * x / width + noise;
+                frame.planes[plane][y * frame.stride + x] = std::min(std::max(v, 0.0f), 1.0f);
+            }
+        }
+    }
+}
+
+// A frame of an RGBS clip as vspipe writes it, the three planes one after the other without any
+// padding.
+bool ccdBenchLoad(ccdBenchFrame &frame, const char *path, int width, int height) {
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    bool ok = true;
+    for (int plane = 0; plane < 3 && ok; plane++)
+        for (int y = 0; y < height && ok; y++)
+            ok = fread(frame.planes[plane] + y * frame.stride, sizeof(float), width, file) ==
+                 static_cast<size_t>(width);
+    fclose(file);
+    return ok;
+}
+
+enum ccdBenchLayout {
+    ccdBenchUntiled, // the kernel called once over the whole frame, no block map
+    ccdBenchTiled,   // what the filter does, through ccdCore
+    ccdBenchPacked,
+    ccdBenchFast,
+    ccdBenchMulti,   // ccd_bench_multi thresholds at once, through ccdCore::processMulti
+};
+
+// The thresholds of the multi variants, as multiples of --threshold, to compare with running the
+// tiled variant that many times.
+const double ccd_bench_multi[] = {1, 1.5, 2, 2.5};
+
+struct ccdBenchVariant {
+    std::string name;
+    int opt;
+    ccdKernelFunc kernel;
+    ccdBenchLayout layout;
+};
+
+// Every variant this CPU can run. opt=6 falls back to NEON for the packed, fast and multi flavours,
+// so those only show up once.
+std::vector<ccdBenchVariant> ccdBenchVariants(bool fast_window) {
+    static const char *names[] = {nullptr, "c", "sse2", "avx2", "avx512", "neon", "sve"};
+    std::vector<ccdBenchVariant> variants;
+    std::vector<ccdKernelFunc> seen;
+    std::vector<ccdMultiKernelFunc> seen_multi;
+
+    for (int opt = ccdOptC; opt <= ccdOptMax; opt++) {
+        ccdKernelFunc kernel = ccdSelectKernel(opt);
+        if (!kernel)
+            continue;
+        std::string name = names[opt];
+
+        variants.push_back({name, opt, kernel, ccdBenchUntiled});
+        variants.push_back({name + "-tiled", opt, kernel, ccdBenchTiled});
+
+        ccdKernelFunc packed = ccdSelectPackedKernel(opt);
+        if (packed && std::find(seen.begin(), seen.end(), packed) == seen.end()) {
+            variants.push_back({name + "-packed", opt, packed, ccdBenchPacked});
+            seen.push_back(packed);
+        }
+
+        ccdMultiKernelFunc multi = ccdSelectMultiKernel(opt);
+        if (std::find(seen_multi.begin(), seen_multi.end(), multi) == seen_multi.end()) {
+            variants.push_back({name + "-multi4", opt, kernel, ccdBenchMulti});
+            seen_multi.push_back(multi);
+        }
+
+        ccdKernelFunc fast = fast_window ? ccdSelectFastKernel(opt) : nullptr;
+        if (fast && std::find(seen.begin(), seen.end(), fast) == seen.end()) {
+            variants.push_back({name + "-fast", opt, fast, ccdBenchFast});
+            seen.push_back(fast);
+        }
+    }
+
+    return variants;
+}
+
+// Sets core up to run the variant with threads, the way the filter would for the same
+// arguments. The untiled variant doesn't use it.
+bool ccdBenchSetUp(const ccdBenchVariant &variant, const ccdKernelParams &params, double threshold, int threads,
+                   ccdCore &core, std::string *error) {
+    if (variant.layout == ccdBenchUntiled)
+        return true;
+
+    ccdCoreOptions options;
+    options.threshold = threshold;
+    options.radius = params.window->radius;
+    options.step = params.window->step;
+    options.opt = variant.opt;
+    options.packed = variant.layout == ccdBenchPacked ? ccdLayoutPacked : ccdLayoutPlanar;
+    options.fast = variant.layout == ccdBenchFast;
+    options.threads = threads;
+    if (variant.layout == ccdBenchMulti)
+        for (double multiple : ccd_bench_multi)
+            options.thresholds.push_back(threshold * multiple);
+    return core.init(options, params.width, params.height, true, 32, error);
+}
+
+// One frame of the variant, including the block map, packing and halving that go with it.
+void ccdBenchRun(const ccdBenchVariant &variant, const ccdKernelParams &params, const ccdCore &core) {
+    if (variant.layout == ccdBenchUntiled) {
+        variant.kernel(params, 0, 0, params.width, params.height);
+        return;
+    }
+
+    ccdCoreFrame src = {{params.src[0], params.src[1], params.src[2]},
+                        params.src_stride * static_cast<ptrdiff_t>(sizeof(float))};
+    ccdCoreOutput dst = {{params.dst[0], params.dst[1], params.dst[2]},
+                         params.dst_stride * static_cast<ptrdiff_t>(sizeof(float))};
+    if (variant.layout != ccdBenchMulti) {
+        core.process(src, nullptr, 0, nullptr, dst);
+        return;
+    }
+
+    // every output goes into dst, only the time counts
+    ccdCoreOutput outputs[CCD_MAX_THRESHOLDS];
+    std::fill(outputs, outputs + core.outputs(), dst);
+    core.processMulti(src, nullptr, 0, nullptr, outputs);
+}
+
+// Parses a comma separated list of numbers.
+bool ccdBenchInts(const char *list, std::vector<int> &out) {
+    out.clear();
+    for (const char *p = list; *p;) {
+        char *end;
+        long value = strtol(p, &end, 10);
+        if (end == p || value < 1)
+            return false;
+        out.push_back(static_cast<int>(value));
+        p = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',')
+            return false;
+    }
+    return !out.empty();
+}
+
+void ccdBenchUsage() {
+    fprintf(stderr,
+            "usage: ccd-bench [options]\n"
+            "  --sizes LIST        of 720p, 1080p, 4k and 8k, all of them by default\n"
+            "  --input FILE WxH    a frame of an RGBS clip instead, e.g. from vspipe -e 0 script.vpy FILE\n"
+            "  --threads LIST      thread counts, 1 and then doubling up to the number of cores by default\n"
+            "  --runs N            frames timed per line, the fastest counts, 5 by default\n"
+            "  --variants LIST     only the variants whose names start with one of these\n"
+            "  --radius N, --step N, --threshold X   the window and threshold, 12, 8 and 4 by default\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::vector<ccdBenchSize> sizes(std::begin(ccd_bench_sizes), std::end(ccd_bench_sizes));
+    std::vector<int> thread_counts;
+    std::vector<std::string> filters;
+    const char *input = nullptr;
+    int runs = 5, radius = 12, step = 8;
+    double threshold = 4;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--help") {
+            ccdBenchUsage();
+            return 0;
+        } else if (arg == "--sizes" && has_value) {
+            std::vector<ccdBenchSize> picked;
+            std::string list = argv[++i];
+            for (const ccdBenchSize &size : ccd_bench_sizes)
+                if (("," + list + ",").find("," + size.name + ",") != std::string::npos)
+                    picked.push_back(size);
+            if (picked.empty()) {
+                ccdBenchUsage();
+                return 1;
+            }
+            sizes = picked;
+        } else if (arg == "--input" && i + 2 < argc) {
+            input = argv[++i];
+            int width, height;
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width < 12 || height < 12) {
+                ccdBenchUsage();
+                return 1;
+            }
+            sizes = {{"input", width, height}};
+        } else if (arg == "--threads" && has_value) {
+            if (!ccdBenchInts(argv[++i], thread_counts)) {
+                ccdBenchUsage();
+                return 1;
+            }
+        } else if (arg == "--runs" && has_value) {
+            runs = atoi(argv[++i]);
+        } else if (arg == "--variants" && has_value) {
+            std::string list = argv[++i];
+            for (size_t start = 0, end; start <= list.size(); start = end + 1) {
+                end = list.find(',', start);
+                end = end == std::string::npos ? list.size() : end;
+                filters.push_back(list.substr(start, end - start));
+            }
+        } else if (arg == "--radius" && has_value) {
+            radius = atoi(argv[++i]);
+        } else if (arg == "--step" && has_value) {
+            step = atoi(argv[++i]);
+        } else if (arg == "--threshold" && has_value) {
+            threshold = atof(argv[++i]);
+        } else {
+            ccdBenchUsage();
+            return 1;
+        }
+    }
+
+    const char *error;
+    if (!ccdCheckWindow(radius, step, &error)) {
+        fprintf(stderr, "ccd-bench: %s\n", error);
+        return 1;
+    }
+    if (runs < 1 || threshold < 0) {
+        ccdBenchUsage();
+        return 1;
+    }
+
+    int cores = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    if (thread_counts.empty()) {
+        for (int threads = 1; threads < cores; threads *= 2)
+            thread_counts.push_back(threads);
+        thread_counts.push_back(cores);
+    }
+
+    const char *fast_error;
+    std::vector<ccdBenchVariant> variants;
+    for (const ccdBenchVariant &variant : ccdBenchVariants(ccdCheckFastWindow(radius, step, &fast_error))) {
+        bool wanted = filters.empty();
+        for (const std::string &filter : filters)
+            wanted = wanted || variant.name.compare(0, filter.size(), filter) == 0;
+        if (wanted)
+            variants.push_back(variant);
+    }
+
+    ccdWindow window(radius, step);
+    // held for the whole run, so the workers aren't started again for every core
+    int max_threads = *std::max_element(thread_counts.begin(), thread_counts.end());
+    ccdThreadPool *pool = max_threads > 1 ? ccdThreadPool::acquire(max_threads - 1, max_threads) : nullptr;
+
+    printf("# radius %d, step %d, threshold %g, %d cores, best of %d\n", radius, step, threshold, cores, runs);
+    printf("%-6s %-14s %7s %9s %9s %8s %8s\n", "size", "variant", "threads", "ms/frame", "ns/pixel", "GB/s",
+           "scaling");
+
+    for (const ccdBenchSize &size : sizes) {
+        ccdBenchFrame src(size.width, size.height), dst(size.width, size.height);
+        if (input) {
+            if (!ccdBenchLoad(src, input, size.width, size.height)) {
+                fprintf(stderr, "ccd-bench: can't read a %dx%d RGBS frame from %s\n", size.width, size.height, input);
+                return 1;
+            }
+        } else {
+            ccdBenchSynthetic(src, size.width, size.height);
+        }
+
+        ccdKernelParams params;
+        for (int plane = 0; plane < 3; plane++) {
+            params.src[plane] = src.planes[plane];
+            params.dst[plane] = dst.planes[plane];
+        }
+        params.src_stride = src.stride;
+        params.dst_stride = dst.stride;
+        params.refs = nullptr;
+        params.ref_count = 0;
+        params.width = size.width;
+        params.height = size.height;
+        params.threshold = static_cast<float>(threshold * threshold / 195075.0);
+        params.window = &window;
+        params.packed = nullptr;
+        params.packed_stride = 0;
+        params.half = nullptr;
+        params.half_stride = 0;
+        params.blocks = nullptr;
+
+        double pixels = static_cast<double>(size.width) * size.height;
+
+        for (const ccdBenchVariant &variant : variants) {
+            double single = 0;
+
+            for (int threads : thread_counts) {
+                // without tiles there's nothing to share between threads
+                if (variant.layout == ccdBenchUntiled && threads > 1)
+                    continue;
+
+                ccdCore core;
+                std::string setup_error;
+                if (!ccdBenchSetUp(variant, params, threshold, threads, core, &setup_error)) {
+                    fprintf(stderr, "ccd-bench: %s: %s\n", variant.name.c_str(), setup_error.c_str());
+                    return 1;
+                }
+
+                double best = 0;
+                for (int run = 0; run <= runs; run++) {
+                    auto start = std::chrono::steady_clock::now();
+                    ccdBenchRun(variant, params, core);
+                    double seconds =
+                        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    // the first run only warms up the caches and the pool
+                    if (run == 1 || (run > 1 && seconds < best))
+                        best = seconds;
+                }
+                if (threads == 1)
+                    single = best;
+
+                printf("%-6s %-14s %7d %9.2f %9.2f %8.2f", size.name.c_str(), variant.name.c_str(), threads,
+                       best * 1e3, best * 1e9 / pixels, pixels * 24 / best / 1e9);
+                if (single > 0)
+                    printf(" %8.2f\n", single / best);
+                else
+                    printf(" %8s\n", "-");
+            }
+        }
+    }
+
+    if (pool)
+        ccdThreadPool::release();
+    return 0;
+}
@@ -1,67 +1,95 @@
-from typing import Optional
+from typing import List, Optional, Sequence, Union
 import vapoursynth as vs
 
 core = vs.core
 
+# CCDYUV takes the _Matrix numbers
+_matrices = {
+    "709": 1,
+    "470bg": 5,
+    "170m": 6,
+    "240m": 7,
+    "2020ncl": 9,
+    "2020cl": 10,
+}
 
-def ccd(clip: vs.VideoNode, threshold: float = 4, matrix: Optional[str] = None) -> vs.VideoNode:
+
+def ccd(clip: vs.VideoNode, threshold: Union[float, Sequence[float]] = 4, matrix: Optional[str] = None,
+        chroma_res: bool = False, radius: int = 12, step: int = 8, dense: bool = False,
+        temporal_radius: int = 0, iterations: int = 1, cache: int = 0,
+        mask: Optional[vs.VideoNode] = None, left: int = 0, top: int = 0, width: Optional[int] = None,
+        height: Optional[int] = None, mode: str = "exact") -> Union[vs.VideoNode, List[vs.VideoNode]]:
     if clip.format is None:
         raise ValueError("Variable format is not supported.")
 
     if None in [clip.width, clip.height]:
         raise ValueError("Variable resolutions are not supported.")
 
-    format = clip.format.replace(subsampling_w=0, subsampling_h=0)
-
-    if matrix is None and format.color_family == vs.YUV:
-        props = clip.get_frame(0).props
-        if "_Matrix" in props.keys():
-            matrix_prop = props["_Matrix"]
-            if not isinstance(matrix_prop, int):
-                raise ValueError("Bad matrix tag")
-            matrix = {
-                1: "709",
-                2: "unspec",
-                5: "470bg",
-                6: "170m",
-                7: "240m",
-                9: "2020ncl",
-                10: "2020cl",
-            }.get(matrix_prop)
-            if matrix is None:
-                raise ValueError("Unrecognised _Matrix frame prop, please specify matrix manually.")
-    elif format.color_family is vs.GRAY:
+    if clip.format.color_family == vs.GRAY:
         raise ValueError("Only RGB and YUV input is supported.")
 
+    if matrix is not None and matrix != "unspec" and matrix not in _matrices:
+        raise ValueError("Unsupported matrix, use one of " + ", ".join(_matrices) + ".")
+
+    # the rectangle to denoise, all of the clip by default
+    roi = {"left": left, "top": top}
+    if width is not None:
+        roi["width"] = width
+    if height is not None:
+        roi["height"] = height
+
+    # a list of thresholds gives a list of clips, one for each
+    thresholds = None if isinstance(threshold, (int, float)) else list(threshold)
+
+    if clip.format.color_family == vs.YUV:
+        if thresholds is not None:
+            # CCDYUV takes a single threshold, so each one is a filter of its own
+            return [ccd(clip, t, matrix, chroma_res, radius, step, dense, temporal_radius, iterations, cache,
+                        mask, left, top, width, height, mode) for t in thresholds]
+
+        # the plugin reads _Matrix from every frame when the matrix isn't given, so nothing has to
+        # be rendered while the script is built
+        kwargs = {"radius": radius, "step": 1 if dense else step, "temporal_radius": temporal_radius,
+                  "iterations": iterations, "cache": cache, "mode": mode, **roi}
+        if mask is not None:
+            kwargs["mask"] = mask
+        if matrix is not None and matrix != "unspec":
+            kwargs["matrix"] = _matrices[matrix]
+
+        subsampled = clip.format.subsampling_w or clip.format.subsampling_h
+        if chroma_res or not subsampled:
+            return core.ccd.CCDYUV(clip, threshold, **kwargs)
+
+        format = clip.format.replace(subsampling_w=0, subsampling_h=0)
+        denoised = core.ccd.CCDYUV(core.resize.Bicubic(clip, format=format), threshold, **kwargs)
+        denoised = core.resize.Bicubic(denoised, format=clip.format)
+        return core.std.ShufflePlanes([clip, denoised], [0, 1, 2], vs.YUV)
+
     if matrix is None or matrix == "unspec":
         if clip.width >= 1280 or clip.height >= 720:
             matrix = "709"
         else:
             matrix = "170m"
 
-    if format.color_family != vs.RGB:
-        if clip.format.subsampling_h or clip.format.subsampling_w:
-            luma = core.std.ShufflePlanes(clip, 0, vs.GRAY)
-            # luma = core.resize.Bicubic(luma, cwidth, cheight)
-            rgb_in = core.std.ShufflePlanes([luma, clip], [0, 1, 2], format.color_family)
-        else:
-            rgb_in = clip
-        rgb = core.resize.Bicubic(rgb_in, format=vs.RGBS, matrix_in_s=matrix)
-    elif format.sample_type != vs.FLOAT and format.bits_per_sample != 32:
-        rgb = core.resize.Point(clip, format=vs.RGBS)
-    else:
-        rgb = clip
-
-    denoised = core.ccd.CCD(rgb, threshold)
-
-    if format.color_family != vs.RGB:
-        denoised = core.resize.Bicubic(denoised, format=format, matrix_s=matrix)
-        out = core.std.ShufflePlanes([clip, denoised], [0, 1, 2], format.color_family)
-        out = core.resize.Bicubic(out, format=clip.format)
-    else:
+    format = clip.format
+
+    # several thresholds are denoised in a single scan, which only the RGBS kernels do
+    source = clip
+    if thresholds is not None and format.id != vs.RGBS:
+        source = core.resize.Point(clip, format=vs.RGBS)
+
+    denoised = core.ccd.CCD(source, threshold if thresholds is None else thresholds, radius=radius,
+                            step=1 if dense else step, temporal_radius=temporal_radius, iterations=iterations,
+                            cache=cache, mask=mask, mode=mode, **roi)
+
+    yuv = core.resize.Point(clip, format=format.replace(color_family=vs.GRAY), matrix_s=matrix)
+
+    def merge(denoised: vs.VideoNode) -> vs.VideoNode:
         denoised = core.resize.Point(denoised, format=format.replace(color_family=vs.YUV), matrix_s=matrix)
-        yuv = core.resize.Point(clip, format=format.replace(color_family=vs.GRAY), matrix_s=matrix)
         shuffled = core.std.ShufflePlanes([yuv, denoised], [0, 1, 2], vs.YUV)
-        out = core.resize.Point(shuffled, format=format, matrix_in_s=matrix)
+        return core.resize.Point(shuffled, format=format, matrix_in_s=matrix)
 
-    return out
+    if thresholds is None:
+        return merge(denoised)
+    # a single threshold in a list still gives a list
+    return [merge(d) for d in (denoised if isinstance(denoised, list) else [denoised])]
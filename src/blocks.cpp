@@ -0,0 +1,506 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#include <algorithm>
+#include <limits>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "kernel.h"
+
+namespace {
+
+// How the ranges of each sample type are kept. Key is ordered the same way as the values the
+// distance is computed on, and difference() is the distance of two samples on one channel,
+// computed the same way as the kernels do, so a block whose range is below the threshold really
+// does accept every sample.
+
+// Floats are ordered by their bits with the magnitude of the negative ones flipped, which puts
+// inf and nan at either end, so their blocks are never within the threshold. key() is its own
+// inverse.
+struct ccdFloatSamples {
+    typedef float T;
+    typedef int32_t Key;
+    typedef float Dist;
+
+    static Key key(T v) {
+        int32_t s;
+        memcpy(&s, &v, sizeof(s));
+        return s ^ ((s >> 31) & 0x7fffffff);
+    }
+    static float value(Key k) {
+        int32_t s = k ^ ((k >> 31) & 0x7fffffff);
+        float v;
+        memcpy(&v, &s, sizeof(v));
+        return v;
+    }
+    static Dist difference(Key lo, Key hi, int) { return value(hi) - value(lo); }
+};
+
+// Half floats are kept the same way.
+struct ccdHalfSamples {
+    typedef uint16_t T;
+    typedef int16_t Key;
+    typedef float Dist;
+
+    static Key key(T v) {
+        int16_t s = static_cast<int16_t>(v);
+        return static_cast<int16_t>(s ^ ((s >> 15) & 0x7fff));
+    }
+    static float value(Key k) { return ccdHalfToFloat(static_cast<uint16_t>(key(static_cast<uint16_t>(k)))); }
+    static Dist difference(Key lo, Key hi, int) { return value(hi) - value(lo); }
+};
+
+template <typename S>
+struct ccdIntSamples {
+    typedef S T;
+    typedef S Key;
+    typedef int Dist;
+
+    static Key key(T v) { return v; }
+    static float value(Key k) { return k; }
+    static Dist difference(Key lo, Key hi, int shift) { return (hi - lo) >> shift; }
+};
+
+template <typename S>
+struct ccdBlockRange {
+    typename S::Key lo[3];
+    typename S::Key hi[3];
+    // already too wide for the threshold, so lo and hi weren't filled in
+    bool test;
+};
+
+template <typename S>
+static typename S::Dist ccdRangeDistance(const ccdBlockRange<S> &range, int shift) {
+    typename S::Dist diff_r = S::difference(range.lo[0], range.hi[0], shift);
+    typename S::Dist diff_g = S::difference(range.lo[1], range.hi[1], shift);
+    typename S::Dist diff_b = S::difference(range.lo[2], range.hi[2], shift);
+    return diff_r * diff_r + diff_g * diff_g + diff_b * diff_b;
+}
+
+static size_t ccdAlign64(size_t size) {
+    return (size + 63) & ~static_cast<size_t>(63);
+}
+
+static int ccdBlockCount(int size) {
+    return (size + CCD_BLOCK_SIZE - 1) / CCD_BLOCK_SIZE;
+}
+
+template <typename Key>
+static void ccdReduceRange(const Key *lo, const Key *hi, int n, Key *range_lo, Key *range_hi) {
+    Key l = lo[0], h = hi[0];
+    for (int x = 1; x < n; x++) {
+        l = std::min(l, lo[x]);
+        h = std::max(h, hi[x]);
+    }
+    *range_lo = l;
+    *range_hi = h;
+}
+
+// The range of one channel of the block with its top left pixel at offset, over every frame.
+// Count is CCD_BLOCK_SIZE, the width of every block but the ones at the right edge of the frame,
+// or 0 to take it from count. The columns are kept apart until the end so the loops vectorise,
+// for a fixed width and into local arrays even at -O2. Returns false as soon as the first row
+// spans the threshold on this channel alone, which makes the block and every one around it full
+// test ones whatever the rest of it holds, so noisy blocks are hardly read.
+template <typename S, int Count>
+static bool ccdChannelRange(const typename S::T *const *planes, int frames, ptrdiff_t offset, ptrdiff_t stride,
+                            int rows, int count, typename S::Dist threshold, int shift, typename S::Key *range_lo,
+                            typename S::Key *range_hi) {
+    typedef typename S::Key Key;
+    const int n = Count ? Count : count;
+    // n is never 0, the zeroes only keep GCC's -Wmaybe-uninitialized quiet at -O3
+    Key lo[CCD_BLOCK_SIZE] = {}, hi[CCD_BLOCK_SIZE] = {};
+
+    const typename S::T *first = planes[0] + offset;
+    for (int x = 0; x < n; x++)
+        lo[x] = hi[x] = S::key(first[x]);
+
+    ccdReduceRange(lo, hi, n, range_lo, range_hi);
+    typename S::Dist diff = S::difference(*range_lo, *range_hi, shift);
+    if (!(threshold > diff * diff))
+        return false;
+
+    for (int f = 0; f < frames; f++) {
+        for (int y = f ? 0 : 1; y < rows; y++) {
+            const typename S::T *row = planes[3 * f] + offset + y * stride;
+            for (int x = 0; x < n; x++) {
+                Key k = S::key(row[x]);
+                lo[x] = k < lo[x] ? k : lo[x];
+                hi[x] = k > hi[x] ? k : hi[x];
+            }
+        }
+    }
+
+    ccdReduceRange(lo, hi, n, range_lo, range_hi);
+    return true;
+}
+
+// The output of a pixel whose every sample is c, as ccdVectorRGB computes it: the same additions
+// in the same order, the division in single precision, and the clamp turning -0 into 0 like the
+// max instructions do.
+static float ccdFlatOutput(float c, int samples) {
+    float total = c;
+    for (int i = 0; i < samples; i++)
+        total += c;
+
+    float out = total / static_cast<float>(samples + 1);
+    out = out > 0 ? out : 0.0f;
+    return out < 1 ? out : 1.0f;
+}
+
+// Only reads the block rows from top to bottom, the ones outside become ccdBlockSkip.
+template <typename S>
+static void ccdClassifyImpl(const typename S::T *const *planes, int frames, ptrdiff_t stride, int width,
+                            int height, typename S::Dist threshold, int shift, const ccdWindow &window, int top,
+                            int bottom, void *buffer, ccdBlockMap *map, ccdThreadPool *pool, int threads) {
+    int columns = ccdBlockCount(width), rows = ccdBlockCount(height);
+    size_t blocks = static_cast<size_t>(columns) * rows;
+
+    uint8_t *kinds = static_cast<uint8_t *>(buffer);
+    float *flat = reinterpret_cast<float *>(kinds + ccdAlign64(blocks));
+    ccdBlockRange<S> *ranges = reinterpret_cast<ccdBlockRange<S> *>(
+        reinterpret_cast<uint8_t *>(flat) + ccdAlign64(3 * blocks * sizeof(float)));
+
+    memset(kinds, ccdBlockSkip, static_cast<size_t>(columns) * top);
+    memset(kinds + static_cast<size_t>(columns) * bottom, ccdBlockSkip, static_cast<size_t>(columns) * (rows - bottom));
+
+    // the range of every block over every frame on its own first
+    ccdProcessBands(bottom - top, pool, threads, [&](int b0, int b1) {
+        for (int by = top + b0; by < top + b1; by++) {
+            int y0 = by * CCD_BLOCK_SIZE, block_rows = std::min(CCD_BLOCK_SIZE, height - y0);
+
+            for (int bx = 0; bx < columns; bx++) {
+                int x0 = bx * CCD_BLOCK_SIZE, count = std::min(CCD_BLOCK_SIZE, width - x0);
+                ccdBlockRange<S> &range = ranges[by * columns + bx];
+                ptrdiff_t offset = y0 * stride + x0;
+
+                range.test = false;
+                for (int c = 0; c < 3 && !range.test; c++) {
+                    if (count == CCD_BLOCK_SIZE)
+                        range.test = !ccdChannelRange<S, CCD_BLOCK_SIZE>(planes + c, frames, offset, stride,
+                                                                          block_rows, count, threshold, shift,
+                                                                          &range.lo[c], &range.hi[c]);
+                    else
+                        range.test = !ccdChannelRange<S, 0>(planes + c, frames, offset, stride, block_rows, count,
+                                                             threshold, shift, &range.lo[c], &range.hi[c]);
+                }
+            }
+        }
+    });
+
+    // then every block gets the range of all the blocks its samples can come from, the reflected
+    // ones at the frame edges are always within the same distance
+    int reach = (window.radius + CCD_BLOCK_SIZE - 1) / CCD_BLOCK_SIZE;
+    int samples = window.taps * window.taps * frames;
+
+    ccdProcessBands(bottom - top, pool, threads, [&](int b0, int b1) {
+        for (int by = top + b0; by < top + b1; by++) {
+            int ny0 = std::max(by - reach, top), ny1 = std::min(by + reach, bottom - 1);
+
+            for (int bx = 0; bx < columns; bx++) {
+                int nx0 = std::max(bx - reach, 0), nx1 = std::min(bx + reach, columns - 1);
+                ccdBlockRange<S> range = ranges[by * columns + bx];
+
+                for (int ny = ny0; ny <= ny1 && !range.test; ny++) {
+                    for (int nx = nx0; nx <= nx1 && !range.test; nx++) {
+                        const ccdBlockRange<S> &other = ranges[ny * columns + nx];
+                        range.test = other.test;
+                        for (int c = 0; c < 3; c++) {
+                            range.lo[c] = std::min(range.lo[c], other.lo[c]);
+                            range.hi[c] = std::max(range.hi[c], other.hi[c]);
+                        }
+                    }
+                }
+
+                size_t block = by * columns + bx;
+                if (range.test || !(threshold > ccdRangeDistance(range, shift))) {
+                    kinds[block] = ccdBlockTest;
+                } else if (range.lo[0] == range.hi[0] && range.lo[1] == range.hi[1] && range.lo[2] == range.hi[2]) {
+                    kinds[block] = ccdBlockFlat;
+                    for (int c = 0; c < 3; c++)
+                        flat[3 * block + c] = ccdFlatOutput(S::value(range.lo[c]), samples);
+                } else {
+                    kinds[block] = ccdBlockAverage;
+                }
+            }
+        }
+    });
+
+    map->kinds = kinds;
+    map->flat = flat;
+    map->columns = columns;
+}
+
+// Whether a mask sample leaves the pixel out, for every type of mask.
+template <typename M>
+struct ccdIntMask {
+    typedef M T;
+    static bool out(T v) { return !v; }
+};
+
+struct ccdHalfMask {
+    typedef uint16_t T;
+    static bool out(T v) { return !(ccdHalfToFloat(v) > 0); }
+};
+
+struct ccdFloatMask {
+    typedef float T;
+    static bool out(T v) { return !(v > 0); }
+};
+
+template <typename M>
+static const typename M::T *ccdMaskRow(const ccdMask &mask, int y) {
+    return reinterpret_cast<const typename M::T *>(mask.data + y * mask.stride);
+}
+
+// How many of the count samples from row on the mask leaves out. Count is CCD_BLOCK_SIZE or 0 to
+// take it from count, as in ccdChannelRange, so the full blocks are vectorised.
+template <typename M, int Count>
+static int ccdMaskedOut(const typename M::T *row, int count) {
+    const int n = Count ? Count : count;
+    int out = 0;
+    for (int x = 0; x < n; x++)
+        out += M::out(row[x]);
+    return out;
+}
+
+template <typename M>
+static int ccdMaskedOut(const typename M::T *row, int count) {
+    return count == CCD_BLOCK_SIZE ? ccdMaskedOut<M, CCD_BLOCK_SIZE>(row, count) : ccdMaskedOut<M, 0>(row, count);
+}
+
+template <typename M>
+static void ccdMaskBlocksImpl(const ccdMask &mask, int width, int height, uint8_t *kinds, int columns,
+                              ccdThreadPool *pool, int threads) {
+    ccdProcessBands(ccdBlockCount(height), pool, threads, [&](int b0, int b1) {
+        for (int by = b0; by < b1; by++) {
+            int y0 = by * CCD_BLOCK_SIZE, y1 = std::min(y0 + CCD_BLOCK_SIZE, height);
+
+            for (int bx = 0; bx < columns; bx++) {
+                int x0 = bx * CCD_BLOCK_SIZE, count = std::min(CCD_BLOCK_SIZE, width - x0);
+
+                bool skip = true;
+                for (int y = y0; y < y1 && skip; y++)
+                    skip = ccdMaskedOut<M>(ccdMaskRow<M>(mask, y) + x0, count) == count;
+
+                if (skip)
+                    kinds[by * columns + bx] = ccdBlockSkip;
+            }
+        }
+    });
+}
+
+// T is only the size of the samples, they're just copied. Runs of the mask that are all in or all
+// out, which is most of any mask, are left alone or copied as a whole.
+template <typename M, typename T>
+static void ccdApplyMaskImpl(const ccdMask &mask, int planes, const uint8_t *const *src, ptrdiff_t src_stride,
+                             uint8_t *const *dst, ptrdiff_t dst_stride, int width, int height,
+                             ccdThreadPool *pool, int threads) {
+    ccdProcessBands(height, pool, threads, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const typename M::T *row = ccdMaskRow<M>(mask, y);
+
+            for (int x0 = 0; x0 < width; x0 += CCD_BLOCK_SIZE) {
+                int count = std::min(CCD_BLOCK_SIZE, width - x0);
+                int out = ccdMaskedOut<M>(row + x0, count);
+                if (!out)
+                    continue;
+
+                for (int plane = 0; plane < planes; plane++) {
+                    const T *s = reinterpret_cast<const T *>(src[plane] + y * src_stride) + x0;
+                    T *d = reinterpret_cast<T *>(dst[plane] + y * dst_stride) + x0;
+                    if (out == count) {
+                        memcpy(d, s, count * sizeof(T));
+                        continue;
+                    }
+                    for (int x = 0; x < count; x++)
+                        if (M::out(row[x0 + x]))
+                            d[x] = s[x];
+                }
+            }
+        }
+    });
+}
+
+template <typename M>
+static void ccdApplyMaskSized(const ccdMask &mask, int planes, const uint8_t *const *src, ptrdiff_t src_stride,
+                              uint8_t *const *dst, ptrdiff_t dst_stride, int width, int height, int sample_size,
+                              ccdThreadPool *pool, int threads) {
+    if (sample_size == 1)
+        ccdApplyMaskImpl<M, uint8_t>(mask, planes, src, src_stride, dst, dst_stride, width, height, pool, threads);
+    else if (sample_size == 2)
+        ccdApplyMaskImpl<M, uint16_t>(mask, planes, src, src_stride, dst, dst_stride, width, height, pool, threads);
+    else
+        ccdApplyMaskImpl<M, uint32_t>(mask, planes, src, src_stride, dst, dst_stride, width, height, pool, threads);
+}
+
+} // namespace
+
+size_t ccdBlockMapSize(int width, int height) {
+    size_t blocks = static_cast<size_t>(ccdBlockCount(width)) * ccdBlockCount(height);
+    return ccdAlign64(blocks) + ccdAlign64(3 * blocks * sizeof(float)) + blocks * sizeof(ccdBlockRange<ccdFloatSamples>);
+}
+
+void ccdFillBlocks(int width, int height, int kind, void *buffer, ccdBlockMap *map) {
+    int columns = ccdBlockCount(width);
+    size_t blocks = static_cast<size_t>(columns) * ccdBlockCount(height);
+
+    uint8_t *kinds = static_cast<uint8_t *>(buffer);
+    memset(kinds, kind, blocks);
+
+    map->kinds = kinds;
+    map->flat = reinterpret_cast<float *>(kinds + ccdAlign64(blocks));
+    map->columns = columns;
+}
+
+// The samples are compared as they're stored, the keys of ccdFloatSamples and ccdHalfSamples
+// order them like their values, with -0 below 0 and NaN outside either end.
+template <typename S>
+static bool ccdUnitRangeImpl(const typename S::T *const *planes, int count, ptrdiff_t stride, const ccdRect &rect,
+                             typename S::Key lo, typename S::Key hi) {
+    for (int plane = 0; plane < count; plane++) {
+        for (int y = rect.top; y < rect.bottom; y++) {
+            const typename S::T *row = planes[plane] + y * stride;
+            bool inside = true;
+            for (int x = rect.left; x < rect.right; x++) {
+                typename S::Key k = S::key(row[x]);
+                inside &= k >= lo && k <= hi;
+            }
+            if (!inside)
+                return false;
+        }
+    }
+    return true;
+}
+
+bool ccdUnitRange(const float *const *planes, int count, ptrdiff_t stride, const ccdRect &rect) {
+    return ccdUnitRangeImpl<ccdFloatSamples>(planes, count, stride, rect, ccdFloatSamples::key(0.0f),
+                                             ccdFloatSamples::key(1.0f));
+}
+
+bool ccdUnitRange(const uint16_t *const *planes, int count, ptrdiff_t stride, const ccdRect &rect) {
+    return ccdUnitRangeImpl<ccdHalfSamples>(planes, count, stride, rect, ccdHalfSamples::key(0),
+                                            ccdHalfSamples::key(0x3c00));
+}
+
+bool ccdClassifyBlocks(const ccdKernelParams &params, void *buffer, ccdBlockMap *map,
+                       ccdThreadPool *pool, int threads) {
+    return ccdClassifyBlocks(params, 0, params.height, buffer, map, pool, threads);
+}
+
+bool ccdClassifyBlocks(const ccdKernelParams &params, int top, int bottom, void *buffer, ccdBlockMap *map,
+                       ccdThreadPool *pool, int threads) {
+    if (!(params.threshold > 0))
+        return false;
+
+    const float *planes[3 * (CCD_MAX_REFS + 1)];
+    for (int plane = 0; plane < 3 * (params.ref_count + 1); plane++)
+        planes[plane] = plane < 3 ? params.src[plane] : params.refs[plane - 3];
+
+    ccdClassifyImpl<ccdFloatSamples>(planes, params.ref_count + 1, params.src_stride, params.width, params.height,
+                                     params.threshold, 0, *params.window, top / CCD_BLOCK_SIZE,
+                                     ccdBlockCount(bottom), buffer, map, pool, threads);
+    return true;
+}
+
+bool ccdClassifyBlocks(const ccdHalfKernelParams &params, void *buffer, ccdBlockMap *map,
+                       ccdThreadPool *pool, int threads) {
+    if (!(params.threshold > 0))
+        return false;
+
+    const uint16_t *planes[3 * (CCD_MAX_REFS + 1)];
+    for (int plane = 0; plane < 3 * (params.ref_count + 1); plane++)
+        planes[plane] = plane < 3 ? params.src[plane] : params.refs[plane - 3];
+
+    ccdClassifyImpl<ccdHalfSamples>(planes, params.ref_count + 1, params.src_stride, params.width, params.height,
+                                    params.threshold, 0, *params.window, 0, ccdBlockCount(params.height), buffer,
+                                    map, pool, threads);
+    return true;
+}
+
+template <typename T>
+static void ccdClassifyInt(const ccdIntKernelParams &params, void *buffer, ccdBlockMap *map,
+                           ccdThreadPool *pool, int threads) {
+    const T *planes[3 * (CCD_MAX_REFS + 1)];
+    for (int plane = 0; plane < 3 * (params.ref_count + 1); plane++)
+        planes[plane] = static_cast<const T *>(plane < 3 ? params.src[plane] : params.refs[plane - 3]);
+
+    ccdClassifyImpl<ccdIntSamples<T>>(planes, params.ref_count + 1, params.src_stride, params.width,
+                                      params.height, params.threshold, params.shift, *params.window, 0,
+                                      ccdBlockCount(params.height), buffer, map, pool, threads);
+}
+
+bool ccdClassifyBlocks(const ccdIntKernelParams &params, int sample_size, void *buffer, ccdBlockMap *map,
+                       ccdThreadPool *pool, int threads) {
+    if (params.threshold <= 0)
+        return false;
+
+    if (sample_size == 1)
+        ccdClassifyInt<uint8_t>(params, buffer, map, pool, threads);
+    else
+        ccdClassifyInt<uint16_t>(params, buffer, map, pool, threads);
+    return true;
+}
+
+void ccdMaskBlocks(const ccdMask &mask, int width, int height, bool classified, void *buffer, ccdBlockMap *map,
+                   ccdThreadPool *pool, int threads) {
+    int columns = ccdBlockCount(width);
+    size_t blocks = static_cast<size_t>(columns) * ccdBlockCount(height);
+
+    uint8_t *kinds = static_cast<uint8_t *>(buffer);
+    if (!classified) {
+        memset(kinds, ccdBlockTest, blocks);
+        map->kinds = kinds;
+        map->flat = reinterpret_cast<const float *>(kinds + ccdAlign64(blocks));
+        map->columns = columns;
+    }
+
+    if (mask.is_float && mask.sample_size == 2)
+        ccdMaskBlocksImpl<ccdHalfMask>(mask, width, height, kinds, columns, pool, threads);
+    else if (mask.is_float)
+        ccdMaskBlocksImpl<ccdFloatMask>(mask, width, height, kinds, columns, pool, threads);
+    else if (mask.sample_size == 1)
+        ccdMaskBlocksImpl<ccdIntMask<uint8_t>>(mask, width, height, kinds, columns, pool, threads);
+    else
+        ccdMaskBlocksImpl<ccdIntMask<uint16_t>>(mask, width, height, kinds, columns, pool, threads);
+}
+
+const ccdBlockMap *ccdMaskPasses(const ccdMask *mask, int width, int height, int passes,
+                                 const ccdBlockMap **first, void *buffer, ccdBlockMap *map, void *last_buffer,
+                                 ccdBlockMap *last_map, ccdThreadPool *pool, int threads) {
+    if (!mask)
+        return passes == 1 ? *first : nullptr;
+
+    if (passes == 1) {
+        ccdMaskBlocks(*mask, width, height, *first != nullptr, buffer, map, pool, threads);
+        *first = map;
+        return map;
+    }
+
+    ccdMaskBlocks(*mask, width, height, false, last_buffer, last_map, pool, threads);
+    return last_map;
+}
+
+void ccdApplyMask(const ccdMask &mask, int planes, const uint8_t *const *src, ptrdiff_t src_stride,
+                  uint8_t *const *dst, ptrdiff_t dst_stride, int width, int height, int sample_size,
+                  ccdThreadPool *pool, int threads) {
+    if (mask.is_float && mask.sample_size == 2)
+        ccdApplyMaskSized<ccdHalfMask>(mask, planes, src, src_stride, dst, dst_stride, width, height, sample_size,
+                                       pool, threads);
+    else if (mask.is_float)
+        ccdApplyMaskSized<ccdFloatMask>(mask, planes, src, src_stride, dst, dst_stride, width, height,
+                                        sample_size, pool, threads);
+    else if (mask.sample_size == 1)
+        ccdApplyMaskSized<ccdIntMask<uint8_t>>(mask, planes, src, src_stride, dst, dst_stride, width, height,
+                                               sample_size, pool, threads);
+    else
+        ccdApplyMaskSized<ccdIntMask<uint16_t>>(mask, planes, src, src_stride, dst, dst_stride, width, height,
+                                                sample_size, pool, threads);
+}
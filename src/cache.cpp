@@ -0,0 +1,166 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#include <string.h>
+
+#include <VSHelper4.h>
+
+#include "cache.h"
+
+static inline uint64_t ccdMix(uint64_t h, uint64_t v) {
+    h ^= v * 0x9E3779B97F4A7C15ull;
+    h = (h << 31) | (h >> 33);
+    return h * 0xBF58476D1CE4E5B9ull;
+}
+
+// Every frame that matches is compared in full anyway, so only every few rows are hashed, which
+// is still enough to tell apart any two frames that aren't almost identical.
+static const int CCD_HASH_ROW_STEP = 8;
+
+// Four independent lanes over every row, so the multiplies don't wait on each other. The padding
+// at the end of the rows isn't hashed, it isn't part of the picture.
+static uint64_t ccdHashPlane(const uint8_t *p, ptrdiff_t stride, size_t row_size, int height, uint64_t h) {
+    for (int y = 0; y < height; y += CCD_HASH_ROW_STEP) {
+        const uint8_t *row = p + y * stride;
+        uint64_t lanes[4] = {h, h + 1, h + 2, h + 3};
+        size_t x = 0;
+        for (; x + 32 <= row_size; x += 32) {
+            for (int l = 0; l < 4; l++) {
+                uint64_t v;
+                memcpy(&v, row + x + 8 * l, 8);
+                lanes[l] = ccdMix(lanes[l], v);
+            }
+        }
+        for (; x < row_size; x++)
+            lanes[0] = ccdMix(lanes[0], row[x]);
+        h = ccdMix(ccdMix(ccdMix(ccdMix(h, lanes[0]), lanes[1]), lanes[2]), lanes[3]);
+    }
+    return h;
+}
+
+static bool ccdFramesEqual(const VSFrame *a, const VSFrame *b, const VSAPI *vsapi) {
+    if (a == b)
+        return true;
+
+    const VSVideoFormat *format = vsapi->getVideoFrameFormat(a);
+    if (!vsh::isSameVideoFormat(format, vsapi->getVideoFrameFormat(b)))
+        return false;
+
+    for (int plane = 0; plane < format->numPlanes; plane++) {
+        int width = vsapi->getFrameWidth(a, plane);
+        int height = vsapi->getFrameHeight(a, plane);
+        if (width != vsapi->getFrameWidth(b, plane) || height != vsapi->getFrameHeight(b, plane))
+            return false;
+
+        const uint8_t *pa = vsapi->getReadPtr(a, plane);
+        const uint8_t *pb = vsapi->getReadPtr(b, plane);
+        if (pa == pb)
+            continue;
+
+        size_t row_size = static_cast<size_t>(width) * format->bytesPerSample;
+        for (int y = 0; y < height; y++)
+            if (memcmp(pa + y * vsapi->getStride(a, plane), pb + y * vsapi->getStride(b, plane), row_size))
+                return false;
+    }
+
+    return true;
+}
+
+uint64_t ccdFrameCache::key(const VSFrame *const *sources, int count, uint64_t extra, const VSAPI *vsapi) {
+    uint64_t h = ccdMix(static_cast<uint64_t>(count), extra);
+    const VSVideoFormat *format = vsapi->getVideoFrameFormat(sources[0]);
+
+    for (int plane = 0; plane < format->numPlanes; plane++) {
+        size_t row_size = static_cast<size_t>(vsapi->getFrameWidth(sources[0], plane)) * format->bytesPerSample;
+        h = ccdHashPlane(vsapi->getReadPtr(sources[0], plane), vsapi->getStride(sources[0], plane), row_size,
+                         vsapi->getFrameHeight(sources[0], plane), h);
+    }
+
+    return h;
+}
+
+const VSFrame *ccdFrameCache::find(uint64_t key, const VSFrame *const *sources, int count, uint64_t extra,
+                                   const VSAPI *vsapi) {
+    // comparing the frames takes a while, so it's done on references taken under the lock
+    std::vector<Entry> candidates;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Entry &entry : entries) {
+            if (entry.key != key || entry.extra != extra || entry.sources.size() != static_cast<size_t>(count))
+                continue;
+            Entry candidate = entry;
+            for (const VSFrame *&source : candidate.sources)
+                source = vsapi->addFrameRef(source);
+            candidate.output = vsapi->addFrameRef(candidate.output);
+            candidates.push_back(candidate);
+        }
+    }
+
+    const VSFrame *output = nullptr;
+    for (Entry &candidate : candidates) {
+        bool equal = !output;
+        for (int f = 0; f < count && equal; f++)
+            equal = ccdFramesEqual(candidate.sources[f], sources[f], vsapi);
+        if (equal)
+            output = vsapi->addFrameRef(candidate.output);
+        freeEntry(candidate, vsapi);
+    }
+
+    if (!output) {
+        miss_count++;
+        return nullptr;
+    }
+
+    // the most recently used entry goes to the front, if it hasn't been dropped in the meantime
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (entries[i].output == output) {
+                Entry found = entries[i];
+                entries.erase(entries.begin() + i);
+                entries.insert(entries.begin(), found);
+                break;
+            }
+        }
+    }
+
+    hit_count++;
+    return output;
+}
+
+void ccdFrameCache::insert(uint64_t key, const VSFrame *const *sources, int count, uint64_t extra,
+                           const VSFrame *output, const VSAPI *vsapi) {
+    Entry entry;
+    entry.key = key;
+    entry.extra = extra;
+    for (int f = 0; f < count; f++)
+        entry.sources.push_back(vsapi->addFrameRef(sources[f]));
+    entry.output = vsapi->addFrameRef(output);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    entries.insert(entries.begin(), entry);
+    while (entries.size() > static_cast<size_t>(capacity)) {
+        freeEntry(entries.back(), vsapi);
+        entries.pop_back();
+    }
+}
+
+void ccdFrameCache::clear(const VSAPI *vsapi) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto &entry : entries)
+        freeEntry(entry, vsapi);
+    entries.clear();
+}
+
+void ccdFrameCache::freeEntry(Entry &entry, const VSAPI *vsapi) {
+    for (const VSFrame *source : entry.sources)
+        vsapi->freeFrame(source);
+    vsapi->freeFrame(entry.output);
+}
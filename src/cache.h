@@ -0,0 +1,66 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#ifndef CCD_CACHE_H
+#define CCD_CACHE_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <stdint.h>
+
+#include <VapourSynth4.h>
+
+// The outputs of the last few distinct inputs, so runs of identical frames (the duplicates of
+// telecined sources, slideshows) only go through the kernel once. An output is found by a hash of
+// the frame it was computed from, and that frame and its temporal neighbours are compared in full
+// before it's used, so a hit is always the exact same output. An entry holds references to its
+// source frames for that. Planes shared by the frames, when the source hands out the same frame
+// again, compare equal without reading them.
+class ccdFrameCache {
+public:
+    explicit ccdFrameCache(int max_entries) : capacity(max_entries), hit_count(0), miss_count(0) {}
+
+    // The hash of sources[0], the frame itself, the rest of the sources are its temporal
+    // neighbours. extra is whatever else the output depends on.
+    static uint64_t key(const VSFrame *const *sources, int count, uint64_t extra, const VSAPI *vsapi);
+
+    // A new reference to the output computed from the same sources and extra, nullptr if there's
+    // none. Counts a hit or a miss.
+    const VSFrame *find(uint64_t key, const VSFrame *const *sources, int count, uint64_t extra,
+                        const VSAPI *vsapi);
+
+    // Remembers output for the sources, dropping the least recently used entry when full.
+    void insert(uint64_t key, const VSFrame *const *sources, int count, uint64_t extra,
+                const VSFrame *output, const VSAPI *vsapi);
+
+    // Frees the frames of every entry, has to be called before the cache goes away.
+    void clear(const VSAPI *vsapi);
+
+    int64_t hits() const { return hit_count; }
+    int64_t misses() const { return miss_count; }
+
+private:
+    struct Entry {
+        uint64_t key;
+        uint64_t extra;
+        std::vector<const VSFrame *> sources;
+        const VSFrame *output;
+    };
+
+    static void freeEntry(Entry &entry, const VSAPI *vsapi);
+
+    int capacity;
+    std::mutex mutex;
+    std::vector<Entry> entries; // most recently used first
+    std::atomic<int64_t> hit_count;
+    std::atomic<int64_t> miss_count;
+};
+
+#endif // CCD_CACHE_H
@@ -8,105 +8,220 @@
  *
  *  This project is licensed under the GPL v3 License.
  **/
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <VapourSynth4.h>
 #include <VSHelper4.h>
+#include <VSConstants4.h>
 
-static const double *init_multipliers() {
-    const int n = 20; // number of multipliers
-    static double mutlipliers[n];
-    for (int i=0; i<n; i++)
-        mutlipliers[i] = 1. / (i+1);
-    return mutlipliers;
-}
-
-static const double *MULTIPLIERS = init_multipliers();
+#include "cache.h"
+#include "core.h"
+#include "cpu.h"
+#include "kernel.h"
+#include "scratch.h"
+#include "stats.h"
+#include "threadpool.h"
+#include "yuv.h"
 
 typedef struct ccdData {
     VSNode *node;
-    float threshold;
+    VSNode *mask; // nullptr without a mask clip
+    // the kernels and everything they need, for CCDYUV at chroma resolution
+    ccdCore core;
+    // CCDYUV only
+    ccdSampleKind yuv_kind;
+    int yuv_bits;
+    int matrix; // -1 to go by _Matrix
+    bool cosited;
+    bool stats; // stats=True, see ccdSetStats
+    std::unique_ptr<ccdFrameCache> cache; // nullptr unless the cache argument is set
 } ccdData;
 
-static void ccdRun(const VSFrame *src, VSFrame *dest, float threshold, const VSAPI *vsapi) {
-    int width = vsapi->getFrameWidth(src, 0);
-    int height = vsapi->getFrameHeight(src, 0);
-
-    auto *src_r_plane = reinterpret_cast<const float *>(vsapi->getReadPtr(src, 0));
-    auto *src_g_plane = reinterpret_cast<const float *>(vsapi->getReadPtr(src, 1));
-    auto *src_b_plane = reinterpret_cast<const float *>(vsapi->getReadPtr(src, 2));
-
-    auto *dst_r_plane = reinterpret_cast<float *>(vsapi->getWritePtr(dest, 0));
-    auto *dst_g_plane = reinterpret_cast<float *>(vsapi->getWritePtr(dest, 1));
-    auto *dst_b_plane = reinterpret_cast<float *>(vsapi->getWritePtr(dest, 2));
-
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int i = y * width + x;
-
-            float r = src_r_plane[i], g = src_g_plane[i], b = src_b_plane[i];
-            float total_r = r, total_g = g, total_b = b;
-            int n = 0;
-
-            for (int dy = y - 12; dy <= y + 12; dy += 8) {
-                int comp_y = dy;
-                if (comp_y < 0)
-                    comp_y = -comp_y;
-                else if (comp_y >= height)
-                    comp_y = 2 * (height - 1) - comp_y;
-
-                int y_offset = comp_y * width;
-                for (int dx = x - 12; dx <= x + 12; dx += 8) {
-
-                    int comp_x = dx;
-                    if (comp_x < 0)
-                        comp_x = -comp_x;
-                    else if (comp_x >= width)
-                        comp_x = 2 * (width - 1) - comp_x;
-
-                    float comp_r = src_r_plane[y_offset + comp_x];
-                    float comp_g = src_g_plane[y_offset + comp_x];
-                    float comp_b = src_b_plane[y_offset + comp_x];
-
-                    float diff_r = comp_r - r;
-                    float diff_g = comp_g - g;
-                    float diff_b = comp_b - b;
-
-#define SQUARE(x) ((x) * (x))
-                    if (threshold > (SQUARE(diff_r) + SQUARE(diff_g) + SQUARE(diff_b))) {
-                        total_r += comp_r;
-                        total_b += comp_b;
-                        total_g += comp_g;
-                        n++;
-                    }
-#undef SQUARE
-                }
+// The frames of the temporal window around n that the kernels sample besides n itself, n - 1, n - 2
+// and so on first, then n + 1, n + 2 and so on. Either side stops early at the edges of the clip and
+// at scene changes, so a cut never blends two shots. Also stops at frames of a different size or
+// stride, which can't share the sample offsets. Returns how many went into refs, which the caller
+// has to free.
+static int ccdGetRefs(int n, const VSFrame *src, const ccdData *d, VSFrameContext *frameCtx,
+                      const VSAPI *vsapi, const VSFrame **refs) {
+    int num_frames = vsapi->getVideoInfo(d->node)->numFrames;
+    int count = 0;
+
+    for (int dir = -1; dir <= 1; dir += 2) {
+        const char *cut = dir < 0 ? "_SceneChangePrev" : "_SceneChangeNext";
+        const VSFrame *current = src;
+
+        for (int k = 1; k <= d->core.temporal_radius; k++) {
+            int i = n + dir * k;
+            int err;
+            if (i < 0 || i >= num_frames ||
+                vsapi->mapGetInt(vsapi->getFramePropertiesRO(current), cut, 0, &err))
+                break;
+
+            const VSFrame *ref = vsapi->getFrameFilter(i, d->node, frameCtx);
+            bool usable = true;
+            for (int plane = 0; plane < 3; plane++)
+                usable = usable && vsapi->getFrameWidth(ref, plane) == vsapi->getFrameWidth(src, plane) &&
+                         vsapi->getFrameHeight(ref, plane) == vsapi->getFrameHeight(src, plane) &&
+                         vsapi->getStride(ref, plane) == vsapi->getStride(src, plane);
+            if (!usable) {
+                vsapi->freeFrame(ref);
+                break;
             }
 
-            float calculated_r = total_r * MULTIPLIERS[n];
-            float calculated_g = total_g * MULTIPLIERS[n];
-            float calculated_b = total_b * MULTIPLIERS[n];
+            refs[count++] = ref;
+            current = ref;
+        }
+    }
 
-            if (calculated_r < 0)
-                calculated_r = 0;
-            else if (calculated_r > 1)
-                calculated_r = 1;
+    return count;
+}
 
-            if (calculated_g < 0)
-                calculated_g = 0;
-            else if (calculated_g > 1)
-                calculated_g = 1;
+// Requests n and the frames around it that ccdGetRefs may need, and frame n of the mask.
+static void ccdRequestFrames(int n, const ccdData *d, VSFrameContext *frameCtx, const VSAPI *vsapi) {
+    int num_frames = vsapi->getVideoInfo(d->node)->numFrames;
+    int first = n - d->core.temporal_radius < 0 ? 0 : n - d->core.temporal_radius;
+    int last = n + d->core.temporal_radius >= num_frames ? num_frames - 1 : n + d->core.temporal_radius;
 
-            if (calculated_b < 0)
-                calculated_b = 0;
-            else if (calculated_b > 1)
-                calculated_b = 1;
+    for (int i = first; i <= last; i++)
+        vsapi->requestFrameFilter(i, d->node, frameCtx);
+    if (d->mask)
+        vsapi->requestFrameFilter(n, d->mask, frameCtx);
+}
 
-            dst_r_plane[i] = calculated_r;
-            dst_g_plane[i] = calculated_g;
-            dst_b_plane[i] = calculated_b;
-        }
+// The first plane of a frame of the mask clip.
+static ccdMask ccdMaskOf(const VSFrame *frame, const VSAPI *vsapi) {
+    const VSVideoFormat *format = vsapi->getVideoFrameFormat(frame);
+
+    ccdMask mask;
+    mask.data = vsapi->getReadPtr(frame, 0);
+    mask.stride = vsapi->getStride(frame, 0);
+    mask.sample_size = format->bytesPerSample;
+    mask.is_float = format->sampleType == stFloat;
+    return mask;
+}
+
+// Copies the planes of src from first_plane on over dest outside of roi, which is all the kernels
+// write.
+static void ccdCopyOutsideROI(const VSFrame *src, VSFrame *dest, int first_plane, const ccdData *d,
+                              const VSAPI *vsapi) {
+    const ccdRect &roi = d->core.roi;
+    int bytes = vsapi->getVideoFrameFormat(src)->bytesPerSample;
+
+    for (int plane = first_plane; plane < 3; plane++) {
+        int width = vsapi->getFrameWidth(src, plane), height = vsapi->getFrameHeight(src, plane);
+        ptrdiff_t src_stride = vsapi->getStride(src, plane), dst_stride = vsapi->getStride(dest, plane);
+        const uint8_t *srcp = vsapi->getReadPtr(src, plane);
+        uint8_t *dstp = vsapi->getWritePtr(dest, plane);
+
+        // whole rows above and below it, then either side of the rows in between
+        vsh::bitblt(dstp, dst_stride, srcp, src_stride, width * bytes, roi.top);
+        vsh::bitblt(dstp + roi.bottom * dst_stride, dst_stride, srcp + roi.bottom * src_stride, src_stride,
+                    width * bytes, height - roi.bottom);
+        vsh::bitblt(dstp + roi.top * dst_stride, dst_stride, srcp + roi.top * src_stride, src_stride,
+                    roi.left * bytes, roi.bottom - roi.top);
+        vsh::bitblt(dstp + roi.top * dst_stride + roi.right * bytes, dst_stride,
+                    srcp + roi.top * src_stride + roi.right * bytes, src_stride, (width - roi.right) * bytes,
+                    roi.bottom - roi.top);
+    }
+}
+
+// The threshold of a frame, from _CCDThreshold when it has one and -1 for the filter's own, see
+// ccdCore::process. It's rounded to a float so ccdThresholdKey tells apart exactly the thresholds
+// that give different outputs. Sets a filter error and returns false when it isn't >= 0.
+static bool ccdFrameThreshold(const VSFrame *frame, const char *name, float *threshold, VSFrameContext *frameCtx,
+                              const VSAPI *vsapi) {
+    const VSMap *props = vsapi->getFramePropertiesRO(frame);
+    int err;
+
+    double value = vsapi->mapGetFloat(props, "_CCDThreshold", 0, &err);
+    // whole numbers are just as good
+    if (err == peType)
+        value = static_cast<double>(vsapi->mapGetInt(props, "_CCDThreshold", 0, &err));
+    if (err) {
+        *threshold = -1;
+        return true;
+    }
+
+    if (!(value >= 0)) {
+        vsapi->setFilterError((std::string(name) + ": _CCDThreshold must be >= 0").c_str(), frameCtx);
+        return false;
+    }
+
+    *threshold = static_cast<float>(value);
+    return true;
+}
+
+// The threshold of ccdFrameThreshold in the top half of the extra of the cache, what the output
+// depends on besides the sources.
+static uint64_t ccdThresholdKey(float threshold) {
+    uint32_t bits;
+    memcpy(&bits, &threshold, sizeof(bits));
+    return static_cast<uint64_t>(bits) << 32;
+}
+
+// The source frame, sources[0], as the output of a threshold no sample passes, see
+// ccdCore::passesThrough. The other sources are freed. Nothing is computed, so there's nothing to
+// cache.
+static const VSFrame *ccdPassThrough(const VSFrame *const *sources, int count, const VSAPI *vsapi) {
+    for (int f = 1; f < count; f++)
+        vsapi->freeFrame(sources[f]);
+    return sources[0];
+}
+
+// A new frame with the planes of the output the cache has for the sources and the properties of
+// sources[0], the same as computing it again would give, nullptr if the cache doesn't have it.
+static VSFrame *ccdFindCached(ccdData *d, const VSFrame *const *sources, int count, uint64_t key, uint64_t extra,
+                              VSCore *core, const VSAPI *vsapi) {
+    const VSFrame *cached = d->cache->find(key, sources, count, extra, vsapi);
+    if (!cached)
+        return nullptr;
+
+    const VSFrame *plane_src[3] = {cached, cached, cached};
+    const int planes[3] = {0, 1, 2};
+    VSFrame *dest = vsapi->newVideoFrame2(vsapi->getVideoFrameFormat(cached), vsapi->getFrameWidth(cached, 0),
+                                          vsapi->getFrameHeight(cached, 0), plane_src, planes, sources[0], core);
+    vsapi->freeFrame(cached);
+
+    vsapi->mapSetInt(vsapi->getFramePropertiesRW(dest), "CCDCacheHit", 1, maReplace);
+    return dest;
+}
+
+static void ccdInsertCached(ccdData *d, const VSFrame *const *sources, int count, uint64_t key, uint64_t extra,
+                            VSFrame *dest, const VSAPI *vsapi) {
+    vsapi->mapSetInt(vsapi->getFramePropertiesRW(dest), "CCDCacheHit", 0, maReplace);
+    d->cache->insert(key, sources, count, extra, dest, vsapi);
+}
+
+// The properties stats=True adds to every frame the kernels compute, cached ones don't get them:
+//   CCDKernelTime - microseconds from start on, less the time the ccdCount functions took
+//   CCDKernel     - the kernel variant, see ccdKernelName
+//   CCDStatsStep  - CCD_STATS_STEP, the two below are estimated from one pixel in step x step
+//   CCDMeanN      - the mean number of samples averaged into a pixel besides itself
+//   CCDHistogram  - how many of the counted pixels averaged each number of samples, from 0 up
+static void ccdSetStats(VSFrame *dest, std::chrono::steady_clock::time_point start, const ccdStats &stats,
+                        const ccdData *d, const VSAPI *vsapi) {
+    auto elapsed = std::chrono::steady_clock::now() - start - stats.counting;
+    VSMap *props = vsapi->getFramePropertiesRW(dest);
+
+    vsapi->mapSetInt(props, "CCDKernelTime",
+                     std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count(), maReplace);
+    vsapi->mapSetData(props, "CCDKernel", d->core.kernelName(), -1, dtUtf8, maReplace);
+    vsapi->mapSetInt(props, "CCDStatsStep", CCD_STATS_STEP, maReplace);
+
+    std::vector<int64_t> counts(stats.histogram.begin(), stats.histogram.end());
+    int64_t pixels = 0, total = 0;
+    for (size_t n = 0; n < counts.size(); n++) {
+        pixels += counts[n];
+        total += counts[n] * static_cast<int64_t>(n);
     }
+    vsapi->mapSetFloat(props, "CCDMeanN", pixels ? static_cast<double>(total) / pixels : 0.0, maReplace);
+    vsapi->mapSetIntArray(props, "CCDHistogram", counts.data(), static_cast<int>(counts.size()));
 }
 
 static const VSFrame *VS_CC ccdGetframe(int n, int activationReason,
@@ -117,7 +232,7 @@ static const VSFrame *VS_CC ccdGetframe(int n, int activationReason,
     auto *d = reinterpret_cast<ccdData *>(instanceData);
 
     if (activationReason == arInitial) {
-        vsapi->requestFrameFilter(n, d->node, frameCtx);
+        ccdRequestFrames(n, d, frameCtx, vsapi);
     } else if (activationReason == arAllFramesReady) {
         const VSFrame *src = vsapi->getFrameFilter(n, d->node, frameCtx);
         const VSVideoFormat *format = vsapi->getVideoFrameFormat(src);
@@ -125,14 +240,92 @@ static const VSFrame *VS_CC ccdGetframe(int n, int activationReason,
         int width = vsapi->getFrameWidth(src, 0);
         int height = vsapi->getFrameHeight(src, 0);
 
-        const VSFrame *plane_src[3] = {src, src, src};
-        int planes[3] = {0, 1, 2};
+        // src and its temporal neighbours, then the mask frame, which is also what the cache
+        // looks for
+        const VSFrame *sources[CCD_MAX_REFS + 2] = {src};
+        const VSFrame **refs = sources + 1;
+        int ref_count = ccdGetRefs(n, src, d, frameCtx, vsapi, refs);
+        int source_count = ref_count + 1;
+        if (d->mask)
+            sources[source_count++] = vsapi->getFrameFilter(n, d->mask, frameCtx);
+
+        // several thresholds are fixed when the filter is created, a frame can't pick its own then
+        int outputs = d->core.outputs();
+        float threshold = -1;
+        bool threshold_ok = ccdFrameThreshold(src, "CCD", &threshold, frameCtx, vsapi);
+        if (threshold_ok && outputs > 1 && threshold >= 0) {
+            vsapi->setFilterError("CCD: _CCDThreshold can't be used with several thresholds", frameCtx);
+            threshold_ok = false;
+        }
+        if (!threshold_ok) {
+            for (int f = 0; f < source_count; f++)
+                vsapi->freeFrame(sources[f]);
+            return nullptr;
+        }
 
-        VSFrame *dest = vsapi->newVideoFrame2(format, width, height, plane_src, planes, src, core);
+        // all planes of a frame share the same stride
+        ccdCoreFrame frames[CCD_MAX_REFS + 1];
+        for (int f = 0; f <= ref_count; f++) {
+            for (int plane = 0; plane < 3; plane++)
+                frames[f].planes[plane] = vsapi->getReadPtr(sources[f], plane);
+            frames[f].stride = vsapi->getStride(sources[f], 0);
+        }
+
+        // the stats still need a frame of their own, which process() then copies
+        if (!d->stats && d->core.passesThrough(frames[0], threshold))
+            return ccdPassThrough(sources, source_count, vsapi);
+
+        uint64_t extra = ccdThresholdKey(threshold);
+        uint64_t key = d->cache ? ccdFrameCache::key(sources, source_count, extra, vsapi) : 0;
+        VSFrame *dest = d->cache ? ccdFindCached(d, sources, source_count, key, extra, core, vsapi) : nullptr;
+
+        if (!dest) {
+            // every pixel gets overwritten, so there's no point in sharing (and then copying on
+            // write) the source planes. With several thresholds their outputs are stacked on
+            // top of each other.
+            dest = vsapi->newVideoFrame(format, width, height * outputs, src, core);
+
+            ccdCoreOutput output[CCD_MAX_THRESHOLDS];
+            for (int t = 0; t < outputs; t++) {
+                output[t].stride = vsapi->getStride(dest, 0);
+                for (int plane = 0; plane < 3; plane++)
+                    output[t].planes[plane] = vsapi->getWritePtr(dest, plane) + t * height * output[t].stride;
+            }
+
+            ccdMask mask;
+            if (d->mask)
+                mask = ccdMaskOf(sources[ref_count + 1], vsapi);
+            const ccdMask *frame_mask = d->mask ? &mask : nullptr;
+
+            // for as long as this thread is busy with the frame, the pool's workers can't have it
+            ccdThreadPool::Frame busy;
+
+            // nothing is counted or timed without stats
+            ccdStats stats(d->stats ? d->core.window.reciprocals.size() : 0);
+            auto start = d->stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+
+            bool done = outputs > 1
+                            ? d->core.processMulti(frames[0], frames + 1, ref_count, frame_mask, output,
+                                                   d->stats ? &stats : nullptr)
+                            : d->core.process(frames[0], frames + 1, ref_count, frame_mask, output[0],
+                                              d->stats ? &stats : nullptr, threshold);
+            if (!done) {
+                vsapi->setFilterError("CCD: out of memory for the frame's scratch buffers", frameCtx);
+                for (int f = 0; f < source_count; f++)
+                    vsapi->freeFrame(sources[f]);
+                vsapi->freeFrame(dest);
+                return nullptr;
+            }
 
-        ccdRun(src, dest, d->threshold, vsapi);
+            if (d->stats)
+                ccdSetStats(dest, start, stats, d, vsapi);
 
-        vsapi->freeFrame(src);
+            if (d->cache)
+                ccdInsertCached(d, sources, source_count, key, extra, dest, vsapi);
+        }
+
+        for (int f = 0; f < source_count; f++)
+            vsapi->freeFrame(sources[f]);
 
         return dest;
     }
@@ -142,51 +335,546 @@ static const VSFrame *VS_CC ccdGetframe(int n, int activationReason,
 
 static void VS_CC ccdFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
     auto *d = reinterpret_cast<ccdData *>(instanceData);
+
+    // for sizing the RAM of a machine running many scripts at once, the frames themselves come on top
+    size_t peak = d->core.scratch.highWater();
+    if (peak) {
+        char message[128];
+        snprintf(message, sizeof(message), "CCD: scratch memory high-water mark %.1f MiB",
+                 static_cast<double>(peak) / (1024 * 1024));
+        vsapi->logMessage(mtInformation, message, core);
+    }
+
+    if (d->cache) {
+        char message[128];
+        snprintf(message, sizeof(message), "CCD: cache hits %lld, misses %lld",
+                 static_cast<long long>(d->cache->hits()), static_cast<long long>(d->cache->misses()));
+        vsapi->logMessage(mtInformation, message, core);
+        d->cache->clear(vsapi);
+    }
+
     vsapi->freeNode(d->node);
+    vsapi->freeNode(d->mask);
     delete d;
 }
 
+// The threshold, opt, radius, step, dense, temporal_radius, iterations and mode arguments,
+// shared by CCD and CCDYUV. ccdCore::init checks them, only what can't be told apart once they're
+// in options is checked here. dense is just step=1.
+static bool ccdParseOptions(const VSMap *in, VSMap *out, const char *name, ccdCoreOptions *options,
+                            const VSAPI *vsapi) {
+    int err;
+
+    options->threshold = vsapi->mapGetFloat(in, "threshold", 0, &err);
+    if (err) options->threshold = 4;
+
+    // only CCD takes more than one, see ccdCreateMulti
+    int threshold_count = vsapi->mapNumElements(in, "threshold");
+    if (threshold_count > 1) {
+        const double *thresholds = vsapi->mapGetFloatArray(in, "threshold", nullptr);
+        options->thresholds.assign(thresholds, thresholds + threshold_count);
+    }
+
+    options->opt = vsapi->mapGetIntSaturated(in, "opt", 0, &err);
+    if (err) options->opt = ccdOptAuto;
+
+    bool dense = !!vsapi->mapGetInt(in, "dense", 0, &err);
+    if (err) dense = false;
+
+    options->radius = vsapi->mapGetIntSaturated(in, "radius", 0, &err);
+    if (err) options->radius = 12;
+    options->step = vsapi->mapGetIntSaturated(in, "step", 0, &err);
+    if (err) {
+        options->step = dense ? 1 : 8;
+    } else if (dense && options->step != 1) {
+        vsapi->mapSetError(out, (std::string(name) + ": dense samples every pixel, it can't be combined with step").c_str());
+        return false;
+    }
+
+    options->temporal_radius = vsapi->mapGetIntSaturated(in, "temporal_radius", 0, &err);
+    if (err) options->temporal_radius = 0;
+
+    options->iterations = vsapi->mapGetIntSaturated(in, "iterations", 0, &err);
+    if (err) options->iterations = 1;
+
+    const char *mode = vsapi->mapGetData(in, "mode", 0, &err);
+    if (err) mode = "exact";
+
+    if (std::string(mode) != "exact" && std::string(mode) != "fast") {
+        vsapi->mapSetError(out, (std::string(name) + ": mode must be \"exact\" or \"fast\"").c_str());
+        return false;
+    }
+    options->fast = std::string(mode) == "fast";
+
+    return true;
+}
+
+// The cache argument, the number of outputs kept for repeated frames.
+static bool ccdParseCache(const VSMap *in, VSMap *out, const char *name, ccdData *d, const VSAPI *vsapi) {
+    int err;
+
+    int entries = vsapi->mapGetIntSaturated(in, "cache", 0, &err);
+    if (err) entries = 0;
+
+    if (entries < 0) {
+        vsapi->mapSetError(out, (std::string(name) + ": cache must be >= 0").c_str());
+        return false;
+    }
+
+    if (entries)
+        d->cache.reset(new ccdFrameCache(entries));
+    return true;
+}
+
+// The mask argument, which has to be the size of the planes that are denoised and as long as the
+// clip. Only its first plane is used, so the format is up to the caller.
+static bool ccdParseMask(const VSMap *in, VSMap *out, const char *name, int width, int height, int frames,
+                         ccdData *d, const VSAPI *vsapi) {
+    int err;
+
+    d->mask = vsapi->mapGetNode(in, "mask", 0, &err);
+    if (!d->mask)
+        return true;
+
+    const VSVideoInfo *vi = vsapi->getVideoInfo(d->mask);
+    const VSVideoFormat &fi = vi->format;
+
+    if (!vsh::isConstantVideoFormat(vi) || vi->width != width || vi->height != height || vi->numFrames != frames) {
+        vsapi->mapSetError(out, (std::string(name) + ": mask must have a constant format, be " +
+                                 std::to_string(width) + "x" + std::to_string(height) +
+                                 " and have as many frames as the clip").c_str());
+        return false;
+    }
+
+    if (!((fi.sampleType == stInteger && fi.bitsPerSample <= 16) ||
+          (fi.sampleType == stFloat && (fi.bitsPerSample == 16 || fi.bitsPerSample == 32)))) {
+        vsapi->mapSetError(out, (std::string(name) + ": mask must be 8-16 bit integer, half or single precision").c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// The left, top, width and height arguments, the rectangle of the clip that's denoised, all of it
+// by default. For CCDYUV it's in luma pixels and has to line up with the chroma samples, ssw and
+// ssh are the subsampling, options gets it at chroma resolution.
+static bool ccdParseROI(const VSMap *in, VSMap *out, const char *name, int width, int height, int ssw, int ssh,
+                        ccdCoreOptions *options, const VSAPI *vsapi) {
+    int err;
+
+    int left = vsapi->mapGetIntSaturated(in, "left", 0, &err);
+    if (err) left = 0;
+    int top = vsapi->mapGetIntSaturated(in, "top", 0, &err);
+    if (err) top = 0;
+
+    if (left < 0 || top < 0 || left >= width || top >= height) {
+        vsapi->mapSetError(out, (std::string(name) + ": left and top must be inside the clip").c_str());
+        return false;
+    }
+
+    int roi_width = vsapi->mapGetIntSaturated(in, "width", 0, &err);
+    if (err) roi_width = width - left;
+    int roi_height = vsapi->mapGetIntSaturated(in, "height", 0, &err);
+    if (err) roi_height = height - top;
+
+    if (roi_width < 1 || roi_height < 1 || roi_width > width - left || roi_height > height - top) {
+        vsapi->mapSetError(out, (std::string(name) + ": width and height must be >= 1 and keep the rectangle inside the clip").c_str());
+        return false;
+    }
+
+    int right = left + roi_width, bottom = top + roi_height;
+    int xmask = (1 << ssw) - 1, ymask = (1 << ssh) - 1;
+    if ((left & xmask) || (right & xmask) || (top & ymask) || (bottom & ymask)) {
+        vsapi->mapSetError(out, (std::string(name) + ": the rectangle must line up with the chroma subsampling").c_str());
+        return false;
+    }
+
+    options->roi = {left >> ssw, top >> ssh, right >> ssw, bottom >> ssh};
+    return true;
+}
+
+static bool ccdParseThreads(const VSMap *in, VSMap *out, const char *name, ccdCoreOptions *options,
+                            VSCore *core, const VSAPI *vsapi) {
+    int err;
+
+    options->threads = vsapi->mapGetIntSaturated(in, "threads", 0, &err);
+    if (err) options->threads = 1;
+
+    if (options->threads < 0) {
+        vsapi->mapSetError(out, (std::string(name) + ": threads must be >= 0").c_str());
+        return false;
+    }
+
+    // the core already runs this many frames at once, any more threads would just fight over
+    // the same cores. That still doesn't cap the pool's workers, which come on top of the core's
+    // threads, so they only get the ones no frame is using, see ccdThreadPool::Frame.
+    VSCoreInfo info;
+    vsapi->getCoreInfo(core, &info);
+    if (options->threads == 0 || options->threads > info.numThreads)
+        options->threads = info.numThreads;
+    options->host_threads = info.numThreads;
+
+    return true;
+}
+
+// Sets up d->core for width x height frames, with the filter's name in front of its error.
+static bool ccdInitCore(VSMap *out, const char *name, const ccdCoreOptions &options, int width, int height,
+                        bool is_float, int bits, ccdData *d, const VSAPI *vsapi) {
+    std::string error;
+    if (d->core.init(options, width, height, is_float, bits, &error))
+        return true;
+
+    vsapi->mapSetError(out, (std::string(name) + ": " + error).c_str());
+    return false;
+}
+
 static void VS_CC ccdCreate(const VSMap *in, VSMap *out, void *userData,
                             VSCore *core, const VSAPI *vsapi)  {
     std::unique_ptr<ccdData> d(new ccdData());
     int err;
 
     d->node = vsapi->mapGetNode(in, "clip", 0, nullptr);
-    d->threshold = static_cast<float>(vsapi->mapGetFloat(in, "threshold", 0, &err));
-    if (err) d->threshold = 4;
-    d->threshold = d->threshold * d->threshold / 195075.0f; // the magic number - thanks DomBito
 
     const VSVideoInfo *vi = vsapi->getVideoInfo(d->node);
+    const VSVideoFormat &fi = vi->format;
 
-    if (vi->format.sampleType != stFloat || vi->format.bitsPerSample != 32 ||
-        vi->format.colorFamily != cfRGB || vi->format.subSamplingH != 0 ||
-        vi->format.subSamplingW != 0) {
-        vsapi->mapSetError(out, "CCD: Input clip must be RGBS");
+    bool is_rgbs = fi.sampleType == stFloat && fi.bitsPerSample == 32;
+    bool is_rgbh = fi.sampleType == stFloat && fi.bitsPerSample == 16;
+    bool is_int = fi.sampleType == stInteger && fi.bitsPerSample >= 8 && fi.bitsPerSample <= 16;
+
+    if ((!is_rgbs && !is_rgbh && !is_int) || fi.colorFamily != cfRGB || fi.subSamplingH != 0 ||
+        fi.subSamplingW != 0) {
+        vsapi->mapSetError(out, "CCD: input clip must be RGBS, RGBH or 8-16 bit integer RGB");
         return;
     }
 
-    if (vi->width < 12 || vi->height < 12) {
-        vsapi->mapSetError(out, "CCD: Input clip dimensions must be at least 12x12");
+    d->stats = !!vsapi->mapGetInt(in, "stats", 0, &err);
+    if (err) d->stats = false;
+
+    ccdCoreOptions options;
+    options.packed = vsapi->mapGetIntSaturated(in, "packed", 0, &err);
+    if (err) options.packed = ccdLayoutPlanar;
+
+    if (!ccdParseOptions(in, out, "CCD", &options, vsapi) ||
+        !ccdParseCache(in, out, "CCD", d.get(), vsapi) ||
+        !ccdParseMask(in, out, "CCD", vi->width, vi->height, vi->numFrames, d.get(), vsapi) ||
+        !ccdParseROI(in, out, "CCD", vi->width, vi->height, 0, 0, &options, vsapi) ||
+        !ccdParseThreads(in, out, "CCD", &options, core, vsapi) ||
+        !ccdInitCore(out, "CCD", options, vi->width, vi->height, fi.sampleType == stFloat, fi.bitsPerSample,
+                     d.get(), vsapi))
+        return;
+
+    VSFilterDependency deps[] = {{d->node, rpGeneral}, {d->mask, rpStrictSpatial}};
+    if (options.thresholds.empty()) {
+        vsapi->createVideoFilter(out, "ccd", vi, ccdGetframe, ccdFree,
+                                 fmParallel, deps, d->mask ? 2 : 1, d.get(), core);
+        d.release();
         return;
     }
 
-    if (d->threshold < 0) {
-        vsapi->mapSetError(out, "CCD: Threshold must be >= 0");
+    // several thresholds are computed together into frames with their outputs stacked on top of
+    // each other, which std.Crop then cuts back into one clip per threshold, so every frame is
+    // only denoised once however many of the clips ask for it
+    VSVideoInfo stacked_vi = *vi;
+    stacked_vi.height *= d->core.outputs();
+    VSNode *stacked = vsapi->createVideoFilter2("ccd", &stacked_vi, ccdGetframe, ccdFree,
+                                                fmParallel, deps, d->mask ? 2 : 1, d.get(), core);
+    d.release();
+
+    VSPlugin *std_plugin = vsapi->getPluginByID(VSH_STD_PLUGIN_ID, core);
+    for (int t = 0; t < static_cast<int>(options.thresholds.size()); t++) {
+        VSMap *args = vsapi->createMap();
+        vsapi->mapSetNode(args, "clip", stacked, maAppend);
+        vsapi->mapSetInt(args, "top", static_cast<int64_t>(t) * vi->height, maAppend);
+        vsapi->mapSetInt(args, "bottom", stacked_vi.height - static_cast<int64_t>(t + 1) * vi->height, maAppend);
+        VSMap *cropped = vsapi->invoke(std_plugin, "Crop", args);
+        vsapi->freeMap(args);
+
+        if (vsapi->mapGetError(cropped)) {
+            // drops the clips of the thresholds before it too
+            vsapi->mapSetError(out, (std::string("CCD: ") + vsapi->mapGetError(cropped)).c_str());
+            vsapi->freeMap(cropped);
+            break;
+        }
+        vsapi->mapConsumeNode(out, "clip", vsapi->mapGetNode(cropped, "clip", 0, nullptr), maAppend);
+        vsapi->freeMap(cropped);
+    }
+    vsapi->freeNode(stacked);
+}
+
+static const VSFrame *VS_CC ccdYUVGetframe(int n, int activationReason,
+                                           void *instanceData,
+                                           void **frameData,
+                                           VSFrameContext *frameCtx,
+                                           VSCore *core, const VSAPI *vsapi)  {
+    auto *d = reinterpret_cast<ccdData *>(instanceData);
+
+    if (activationReason == arInitial) {
+        ccdRequestFrames(n, d, frameCtx, vsapi);
+    } else if (activationReason == arAllFramesReady) {
+        const VSFrame *src = vsapi->getFrameFilter(n, d->node, frameCtx);
+        const VSVideoFormat *format = vsapi->getVideoFrameFormat(src);
+
+        int width = vsapi->getFrameWidth(src, 0);
+        int height = vsapi->getFrameHeight(src, 0);
+
+        const VSFrame *sources[CCD_MAX_REFS + 2] = {src};
+        const VSFrame **refs = sources + 1;
+        int ref_count = ccdGetRefs(n, src, d, frameCtx, vsapi, refs);
+        int source_count = ref_count + 1;
+        if (d->mask)
+            sources[source_count++] = vsapi->getFrameFilter(n, d->mask, frameCtx);
+
+        // the luma plane is shared with the source, only the chroma is written
+        const VSFrame *plane_src[3] = {src, nullptr, nullptr};
+        const int planes[3] = {0, 0, 0};
+        VSFrame *dest = vsapi->newVideoFrame2(format, width, height, plane_src, planes, src, core);
+
+        ccdYUVParams params;
+        params.src_stride = vsapi->getStride(src, 1) / format->bytesPerSample;
+        params.luma_stride = vsapi->getStride(src, 0) / format->bytesPerSample;
+        params.dst_stride = vsapi->getStride(dest, 1) / format->bytesPerSample;
+        for (int plane = 0; plane < 3; plane++) {
+            params.src[plane] = vsapi->getReadPtr(src, plane);
+            params.dst[plane] = plane ? vsapi->getWritePtr(dest, plane) : nullptr;
+        }
+        // everything from here on is at chroma resolution
+        params.ssw = format->subSamplingW;
+        params.ssh = format->subSamplingH;
+        params.width = vsapi->getFrameWidth(src, 1);
+        params.height = vsapi->getFrameHeight(src, 1);
+        params.cosited = d->cosited;
+        params.kind = d->yuv_kind;
+        params.bits = d->yuv_bits;
+
+        // limited range unless the frame says otherwise
+        int err;
+        const VSMap *props = vsapi->getFramePropertiesRO(src);
+        params.full_range = vsapi->mapGetIntSaturated(props, "_ColorRange", 0, &err) == VSC_RANGE_FULL && !err;
+
+        // the matrix can change from frame to frame, and when it isn't known the same guess as
+        // the python wrapper's is made
+        int matrix = d->matrix;
+        if (matrix < 0) {
+            matrix = vsapi->mapGetIntSaturated(props, "_Matrix", 0, &err);
+            if (err || matrix == VSC_MATRIX_UNSPECIFIED)
+                matrix = (width >= 1280 || height >= 720) ? VSC_MATRIX_BT709 : VSC_MATRIX_ST170_M;
+        }
+
+        float threshold;
+        bool matrix_ok = ccdMatrixCoefficients(matrix, &params.kr, &params.kb, &params.constant_luminance);
+        if (!matrix_ok)
+            vsapi->setFilterError(("CCDYUV: unsupported _Matrix " + std::to_string(matrix) +
+                                   ", pass matrix to override it").c_str(), frameCtx);
+        if (!matrix_ok || !ccdFrameThreshold(src, "CCDYUV", &threshold, frameCtx, vsapi)) {
+            for (int f = 0; f < source_count; f++)
+                vsapi->freeFrame(sources[f]);
+            vsapi->freeFrame(dest);
+            return nullptr;
+        }
+
+        // the output also depends on how the frame says it should be converted, and its threshold
+        uint64_t extra = ccdThresholdKey(threshold) | static_cast<uint64_t>(matrix) << 1 | params.full_range;
+        uint64_t key = d->cache ? ccdFrameCache::key(sources, source_count, extra, vsapi) : 0;
+        if (VSFrame *cached = d->cache ? ccdFindCached(d, sources, source_count, key, extra, core, vsapi) : nullptr) {
+            for (int f = 0; f < source_count; f++)
+                vsapi->freeFrame(sources[f]);
+            vsapi->freeFrame(dest);
+            return cached;
+        }
+
+        // the neighbours are converted with the range and matrix of frame n, a change of either
+        // is almost always at a scene change anyway
+        ccdYUVParams ref_params[CCD_MAX_REFS];
+        for (int f = 0; f < ref_count; f++) {
+            ref_params[f] = params;
+            for (int plane = 0; plane < 3; plane++)
+                ref_params[f].src[plane] = vsapi->getReadPtr(refs[f], plane);
+        }
+
+        // same alignment as VapourSynth's own frames, the three planes of every source frame
+        // and then the three of the output
+        int src_count = 3 * (ref_count + 1);
+        ptrdiff_t stride = (params.width + 15) & ~static_cast<ptrdiff_t>(15);
+        size_t plane_size = stride * params.height;
+        ccdScratch buffer(d->core.scratch, plane_size * (src_count + 3) * sizeof(float));
+
+        ccdMask mask;
+        if (d->mask)
+            mask = ccdMaskOf(sources[ref_count + 1], vsapi);
+        const ccdMask *frame_mask = d->mask ? &mask : nullptr;
+
+        ccdScratch blocks(d->core.scratch, ccdBlockMapSize(params.width, params.height));
+        ccdScratch last_blocks(d->core.scratch, d->core.lastMapSize(frame_mask));
+        ccdScratch half(d->core.scratch, d->core.fast ? ccdHalfBufferSize(params.width, params.height, ref_count) : 0);
+        if (buffer.failed() || blocks.failed() || last_blocks.failed() || half.failed()) {
+            vsapi->setFilterError("CCDYUV: out of memory for the frame's scratch buffers", frameCtx);
+            for (int f = 0; f < source_count; f++)
+                vsapi->freeFrame(sources[f]);
+            vsapi->freeFrame(dest);
+            return nullptr;
+        }
+
+        float *rgb_in[3 * (CCD_MAX_REFS + 1)], *rgb_out[3];
+        for (int plane = 0; plane < src_count; plane++)
+            rgb_in[plane] = buffer.get<float>() + plane_size * plane;
+        for (int plane = 0; plane < 3; plane++)
+            rgb_out[plane] = buffer.get<float>() + plane_size * (src_count + plane);
+        float *half_planes[3 * (CCD_MAX_REFS + 1)];
+        if (d->core.fast)
+            ccdHalfPlanes(half.get<float>(), params.width, params.height, ref_count, half_planes);
+
+        // as in ccdGetframe, the pool's workers only get threads no frame is using
+        ccdThreadPool::Frame busy;
+        ccdStats stats(d->stats ? d->core.window.reciprocals.size() : 0);
+        auto start = d->stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        const ccdCore &c = d->core;
+        float scaled = threshold < 0 ? c.threshold : static_cast<float>(ccdScaleThreshold(threshold));
+        ccdProcessYUVFrame(c.kernel, params, ref_params, ref_count, scaled, c.window, c.iterations, c.roi, rgb_in,
+                           rgb_out, stride, blocks.get<void>(), frame_mask, last_blocks.get<void>(),
+                           c.fast ? half_planes : nullptr, d->stats ? &stats : nullptr, c.pool, c.threads);
+        if (d->stats)
+            ccdSetStats(dest, start, stats, d, vsapi);
+
+        if (!d->core.full_frame)
+            ccdCopyOutsideROI(src, dest, 1, d, vsapi);
+
+        // the chroma goes back to the source's exactly, the round trip through RGB wouldn't
+        if (frame_mask) {
+            const uint8_t *src_planes[2] = {vsapi->getReadPtr(src, 1), vsapi->getReadPtr(src, 2)};
+            uint8_t *dst_planes[2] = {vsapi->getWritePtr(dest, 1), vsapi->getWritePtr(dest, 2)};
+            ccdApplyMask(mask, 2, src_planes, vsapi->getStride(src, 1), dst_planes, vsapi->getStride(dest, 1),
+                         params.width, params.height, format->bytesPerSample, d->core.pool, d->core.threads);
+        }
+
+        if (d->cache)
+            ccdInsertCached(d, sources, source_count, key, extra, dest, vsapi);
+
+        for (int f = 0; f < source_count; f++)
+            vsapi->freeFrame(sources[f]);
+
+        return dest;
+    }
+
+    return nullptr;
+}
+
+static void VS_CC ccdYUVCreate(const VSMap *in, VSMap *out, void *userData,
+                               VSCore *core, const VSAPI *vsapi)  {
+    std::unique_ptr<ccdData> d(new ccdData());
+    int err;
+
+    d->node = vsapi->mapGetNode(in, "clip", 0, nullptr);
+
+    ccdCoreOptions options;
+    if (!ccdParseOptions(in, out, "CCDYUV", &options, vsapi))
+        return;
+
+    if (options.threshold < 0) {
+        vsapi->mapSetError(out, "CCDYUV: threshold must be >= 0");
+        return;
+    }
+
+    const VSVideoInfo *vi = vsapi->getVideoInfo(d->node);
+    const VSVideoFormat &fi = vi->format;
+
+    if (fi.colorFamily != cfYUV ||
+        !((fi.sampleType == stInteger && fi.bitsPerSample >= 8 && fi.bitsPerSample <= 16) ||
+          (fi.sampleType == stFloat && (fi.bitsPerSample == 16 || fi.bitsPerSample == 32)))) {
+        vsapi->mapSetError(out, "CCDYUV: input clip must be YUV, 8-16 bit integer, half or single precision");
         return;
     }
 
-    VSFilterDependency deps[] = {{d->node, rpGeneral}};
-    vsapi->createVideoFilter(out, "ccd", vi, ccdGetframe, ccdFree,
-                             fmParallel, deps, 1, d.get(), core);
+    // subsampled clips are processed at chroma resolution
+    int width = vi->width >> fi.subSamplingW, height = vi->height >> fi.subSamplingH;
+    if (width < 12 || height < 12) {
+        vsapi->mapSetError(out, "CCDYUV: input clip chroma planes must be at least 12x12");
+        return;
+    }
+
+    d->cosited = !!vsapi->mapGetInt(in, "cosited", 0, &err);
+    if (err) d->cosited = false;
+
+    d->stats = !!vsapi->mapGetInt(in, "stats", 0, &err);
+    if (err) d->stats = false;
+
+    if (fi.sampleType == stFloat)
+        d->yuv_kind = fi.bitsPerSample == 16 ? ccdSampleHalf : ccdSampleFloat;
+    else
+        d->yuv_kind = fi.bytesPerSample == 1 ? ccdSampleByte : ccdSampleWord;
+    d->yuv_bits = fi.bitsPerSample;
+
+    // left out, it's read from every frame's _Matrix instead
+    float kr, kb;
+    bool constant_luminance;
+    d->matrix = vsapi->mapGetIntSaturated(in, "matrix", 0, &err);
+    if (err) {
+        d->matrix = -1;
+    } else if (!ccdMatrixCoefficients(d->matrix, &kr, &kb, &constant_luminance)) {
+        vsapi->mapSetError(out, "CCDYUV: matrix must be 1 (709), 5 (470bg), 6 (170m), 7 (240m), 9 (2020ncl) or 10 (2020cl)");
+        return;
+    }
+
+    // the core only sees the single precision RGB the frames are converted to, which stays planar
+    options.packed = ccdLayoutPlanar;
+
+    if (!ccdParseCache(in, out, "CCDYUV", d.get(), vsapi) ||
+        !ccdParseMask(in, out, "CCDYUV", width, height, vi->numFrames, d.get(), vsapi) ||
+        !ccdParseROI(in, out, "CCDYUV", vi->width, vi->height, fi.subSamplingW, fi.subSamplingH, &options, vsapi) ||
+        !ccdParseThreads(in, out, "CCDYUV", &options, core, vsapi) ||
+        !ccdInitCore(out, "CCDYUV", options, width, height, true, 32, d.get(), vsapi))
+        return;
+
+    VSFilterDependency deps[] = {{d->node, rpGeneral}, {d->mask, rpStrictSpatial}};
+    vsapi->createVideoFilter(out, "ccdyuv", vi, ccdYUVGetframe, ccdFree,
+                             fmParallel, deps, d->mask ? 2 : 1, d.get(), core);
     d.release();
 }
 
 VS_EXTERNAL_API(void)
 VapourSynthPluginInit2(VSPlugin *plugin, const VSPLUGINAPI *vspapi) {
+    ccdGetCPUFeatures(); // pick up the CPU features once, at load time
     vspapi->configPlugin("com.eoe-scrad.ccd", "ccd", "chroma denoiser",
                          1, VAPOURSYNTH_API_VERSION, 0, plugin);
     vspapi->registerFunction("CCD",
                              "clip:vnode;"
-                             "threshold:float:opt;",
-                             "clip:vnode;", ccdCreate, 0, plugin);
+                             "threshold:float[]:opt;"
+                             "opt:int:opt;"
+                             "threads:int:opt;"
+                             "packed:int:opt;"
+                             "radius:int:opt;"
+                             "step:int:opt;"
+                             "dense:int:opt;"
+                             "temporal_radius:int:opt;"
+                             "iterations:int:opt;"
+                             "cache:int:opt;"
+                             "mask:vnode:opt;"
+                             "left:int:opt;"
+                             "top:int:opt;"
+                             "width:int:opt;"
+                             "height:int:opt;"
+                             "mode:data:opt;"
+                             "stats:int:opt;",
+                             "clip:vnode[];", ccdCreate, 0, plugin);
+    vspapi->registerFunction("CCDYUV",
+                             "clip:vnode;"
+                             "threshold:float:opt;"
+                             "matrix:int:opt;"
+                             "cosited:int:opt;"
+                             "opt:int:opt;"
+                             "threads:int:opt;"
+                             "radius:int:opt;"
+                             "step:int:opt;"
+                             "dense:int:opt;"
+                             "temporal_radius:int:opt;"
+                             "iterations:int:opt;"
+                             "cache:int:opt;"
+                             "mask:vnode:opt;"
+                             "left:int:opt;"
+                             "top:int:opt;"
+                             "width:int:opt;"
+                             "height:int:opt;"
+                             "mode:data:opt;"
+                             "stats:int:opt;",
+                             "clip:vnode;", ccdYUVCreate, 0, plugin);
 }
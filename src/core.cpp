@@ -0,0 +1,671 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2006-2020 Stolyarevskiy Sergey
+ *  Copyright (c) 2020 DomBito
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <vector>
+
+#include "core.h"
+#include "stats.h"
+#include "threadpool.h"
+
+ccdCore::ccdCore()
+    : threshold(0), temporal_radius(0), iterations(1), fast(false), roi{0, 0, 0, 0}, full_frame(true), width(0),
+      height(0), sample_size(0), bits(0), kernel(nullptr), packed_kernel(nullptr), half_kernel(nullptr), is_rgbh(false),
+      int_kernel(nullptr), multi_kernel(nullptr), int_threshold(0), int_shift(0), threads(1), pool(nullptr) {}
+
+ccdCore::~ccdCore() {
+    if (pool)
+        ccdThreadPool::release();
+}
+
+bool ccdCore::init(const ccdCoreOptions &options, int frame_width, int frame_height, bool is_float, int frame_bits,
+                   std::string *error) {
+    bits = frame_bits;
+    bool is_rgbs = is_float && bits == 32;
+    bool is_int = !is_float && bits >= 8 && bits <= 16;
+    is_rgbh = is_float && bits == 16;
+
+    if (!is_rgbs && !is_rgbh && !is_int) {
+        *error = "input clip must be RGBS, RGBH or 8-16 bit integer RGB";
+        return false;
+    }
+
+    if (frame_width < 12 || frame_height < 12) {
+        *error = "input clip dimensions must be at least 12x12";
+        return false;
+    }
+
+    if (options.threshold < 0) {
+        *error = "threshold must be >= 0";
+        return false;
+    }
+
+    const char *window_error;
+    if (!ccdCheckWindow(options.radius, options.step, &window_error)) {
+        *error = window_error;
+        return false;
+    }
+
+    if (options.temporal_radius < 0 || options.temporal_radius > CCD_MAX_TEMPORAL_RADIUS) {
+        *error = "temporal_radius must be between 0 and " + std::to_string(CCD_MAX_TEMPORAL_RADIUS);
+        return false;
+    }
+
+    if (options.iterations < 1) {
+        *error = "iterations must be >= 1";
+        return false;
+    }
+
+    const ccdRect &rect = options.roi;
+    bool whole = rect.left >= rect.right || rect.top >= rect.bottom;
+    if (!whole && (rect.left < 0 || rect.top < 0 || rect.right > frame_width || rect.bottom > frame_height)) {
+        *error = "the rectangle must be inside the frame";
+        return false;
+    }
+
+    if (options.opt < ccdOptAuto || options.opt > ccdOptMax) {
+        *error = "opt must be between 0 and 6";
+        return false;
+    }
+
+    kernel = ccdSelectKernel(options.opt);
+    if (!kernel) {
+        *error = "the instruction set requested by opt is not supported by this CPU";
+        return false;
+    }
+
+    width = frame_width;
+    height = frame_height;
+    roi = whole ? ccdFrameRect(width, height) : rect;
+    full_frame = roi.left == 0 && roi.top == 0 && roi.right == width && roi.bottom == height;
+    temporal_radius = options.temporal_radius;
+    iterations = options.iterations;
+    window = ccdWindow(options.radius, options.step, 2 * temporal_radius + 1);
+
+    double scaled = ccdScaleThreshold(options.threshold);
+    threshold = static_cast<float>(scaled);
+
+    // the multi kernels only come in the plain single pass RGBS flavour, the block map and the
+    // stats go by the lowest threshold
+    if (!options.thresholds.empty()) {
+        if (options.thresholds.size() > static_cast<size_t>(CCD_MAX_THRESHOLDS)) {
+            *error = "at most " + std::to_string(CCD_MAX_THRESHOLDS) + " thresholds can be given at once";
+            return false;
+        }
+        if (!is_rgbs) {
+            *error = "several thresholds need an RGBS clip";
+            return false;
+        }
+        if (options.fast || iterations > 1 || options.packed == ccdLayoutPacked) {
+            *error = "several thresholds can't be combined with mode=\"fast\", iterations or packed";
+            return false;
+        }
+
+        thresholds.clear();
+        for (double t : options.thresholds) {
+            if (t < 0) {
+                *error = "threshold must be >= 0";
+                return false;
+            }
+            thresholds.push_back(static_cast<float>(ccdScaleThreshold(t)));
+        }
+        threshold = *std::min_element(thresholds.begin(), thresholds.end());
+        multi_kernel = ccdSelectMultiKernel(options.opt);
+    }
+
+    // the fast kernels test the samples at half resolution, see ccdKernelFastC, and only run a
+    // single pass
+    fast = options.fast;
+    if (fast) {
+        if (!ccdCheckFastWindow(window.radius, window.step, &window_error)) {
+            *error = window_error;
+            return false;
+        }
+        if (iterations > 1) {
+            *error = "mode=\"fast\" can't be combined with iterations";
+            return false;
+        }
+        if (!is_rgbs) {
+            *error = "mode=\"fast\" needs an RGBS clip";
+            return false;
+        }
+        kernel = ccdSelectFastKernel(options.opt);
+    }
+
+    sample_size = is_float ? bits / 8 : (bits + 7) / 8;
+    if (is_int) {
+        // the sums of the accepted samples are int32
+        double samples = static_cast<double>(window.taps) * window.taps * window.frames + 1;
+        if (samples * ((1 << bits) - 1) > INT_MAX) {
+            *error = "the window samples too many pixels for this bit depth, lower radius or temporal_radius or raise step";
+            return false;
+        }
+
+        int_kernel = ccdSelectIntKernel(options.opt, sample_size);
+        int_threshold = ccdIntThreshold(scaled, bits);
+        int_shift = ccdIntShift(bits);
+    } else if (is_rgbh) {
+        half_kernel = ccdSelectHalfKernel(options.opt);
+    }
+
+    if (options.packed < ccdLayoutAuto || options.packed > ccdLayoutPacked) {
+        *error = "packed must be -1, 0 or 1";
+        return false;
+    }
+
+    // the packed copy only holds the current frame, as it comes in
+    bool single_pass = !temporal_radius && iterations == 1;
+    if (options.packed == ccdLayoutPacked && !single_pass) {
+        *error = "packed can't be combined with temporal_radius or iterations";
+        return false;
+    }
+
+    if (options.packed == ccdLayoutPacked && fast) {
+        *error = "packed can't be combined with mode=\"fast\"";
+        return false;
+    }
+
+    // the C and SVE kernels have no packed flavour, they just stay planar, and so do integer
+    // and half float clips
+    if (is_rgbs && single_pass && !fast && !multi_kernel && options.packed == ccdLayoutPacked)
+        packed_kernel = ccdSelectPackedKernel(options.opt);
+
+    if (options.threads < 1) {
+        *error = "threads must be >= 1";
+        return false;
+    }
+
+    threads = options.threads;
+    if (threads > 1)
+        pool = ccdThreadPool::acquire(threads - 1, std::max(options.host_threads, threads));
+
+    return true;
+}
+
+const char *ccdCore::kernelName() const {
+    if (multi_kernel)
+        return ccdKernelName(multi_kernel);
+    if (int_kernel)
+        return ccdKernelName(int_kernel);
+    if (is_rgbh && half_kernel)
+        return ccdKernelName(half_kernel);
+    return ccdKernelName(packed_kernel ? packed_kernel : kernel);
+}
+
+size_t ccdCore::lastMapSize(const ccdMask *mask) const {
+    return mask && iterations > 1 ? ccdBlockMapSize(width, height) : 0;
+}
+
+// The params of every pass for iterations, params being the first one. The passes in between go
+// through scratch frames with the stride of params.dst, buffer has to hold ccdScratchPlanes planes
+// of plane_size bytes, which are used in turn (see ccdProcessPasses). Only the first pass samples
+// the neighbouring frames, and only it is classified, the others' sources don't exist yet when
+// its map is made, unless between holds for every frame, see ccdThresholdAll. The last pass goes
+// by last instead, see ccdMaskPasses. S is the sample type.
+template <typename S, typename P>
+static std::vector<P> ccdPassParams(const P &params, int iterations, size_t plane_size, uint8_t *buffer,
+                                    const ccdBlockMap *last, const ccdBlockMap *between) {
+    int planes = iterations > 2 ? 6 : 3;
+    std::vector<P> passes(iterations, params);
+
+    for (int pass = 1; pass < iterations; pass++) {
+        for (int plane = 0; plane < 3; plane++) {
+            S *scratch = reinterpret_cast<S *>(buffer + plane_size * ((3 * (pass - 1) + plane) % planes));
+            passes[pass - 1].dst[plane] = scratch;
+            passes[pass].src[plane] = scratch;
+        }
+        passes[pass].src_stride = params.dst_stride;
+        passes[pass].refs = nullptr;
+        passes[pass].ref_count = 0;
+        passes[pass].blocks = between;
+    }
+    passes.back().blocks = last;
+
+    return passes;
+}
+
+// None for one pass, one frame for two and two for more.
+static int ccdScratchPlanes(int iterations) {
+    return iterations == 1 ? 0 : iterations == 2 ? 3 : 6;
+}
+
+// Whether the samples of src and its refs, all the frame and not just roi as the window reaches
+// past it, are within [0, 1], see ccdUnitRange.
+template <typename T>
+static bool ccdSourcesInRange(const T *const *src, const T *const *refs, int ref_count, ptrdiff_t stride,
+                              int width, int height) {
+    ccdRect frame = ccdFrameRect(width, height);
+    return ccdUnitRange(src, 3, stride, frame) && (!ref_count || ccdUnitRange(refs, 3 * ref_count, stride, frame));
+}
+
+// Runs all the iterations of the kernel over the frame in params, for the last one to cover roi.
+template <typename S, typename K, typename P>
+bool ccdCore::runPasses(K pass_kernel, const P &params, const ccdBlockMap *last, const ccdBlockMap *between) const {
+    size_t plane_size = params.dst_stride * params.height * sample_size;
+    ccdScratch buffer(scratch, plane_size * ccdScratchPlanes(iterations));
+    if (buffer.failed())
+        return false;
+    std::vector<P> passes =
+        ccdPassParams<S>(params, iterations, plane_size, buffer.get<uint8_t>(), last, between);
+
+    ccdProcessPasses(roi, params.width, params.height, params.window->radius, sample_size, params.ref_count + 1,
+                     iterations, pool, threads,
+                     [&](int pass, int x0, int y0, int x1, int y1) { pass_kernel(passes[pass], x0, y0, x1, y1); });
+    return true;
+}
+
+bool ccdCore::run(const ccdCoreFrame &src, const ccdCoreFrame *refs, int ref_count, const ccdMask *mask,
+                  const ccdCoreOutput &dst, ccdStats *stats, float frame_threshold) const {
+    ccdKernelParams params;
+
+    params.src_stride = src.stride / static_cast<ptrdiff_t>(sizeof(float));
+    params.dst_stride = dst.stride / static_cast<ptrdiff_t>(sizeof(float));
+
+    for (int plane = 0; plane < 3; plane++) {
+        params.src[plane] = static_cast<const float *>(src.planes[plane]);
+        params.dst[plane] = static_cast<float *>(dst.planes[plane]);
+    }
+
+    const float *ref_planes[3 * CCD_MAX_REFS];
+    for (int plane = 0; plane < 3 * ref_count; plane++)
+        ref_planes[plane] = static_cast<const float *>(refs[plane / 3].planes[plane % 3]);
+    params.refs = ref_planes;
+    params.ref_count = ref_count;
+
+    params.width = width;
+    params.height = height;
+    params.threshold = frame_threshold;
+    params.window = &window;
+    params.packed = nullptr;
+    params.packed_stride = 0;
+    params.half = nullptr;
+    params.half_stride = 0;
+    params.blocks = nullptr;
+
+    ccdBlockMap map, last_map;
+    ccdScratch blocks(scratch, ccdBlockMapSize(width, height));
+    ccdScratch last_blocks(scratch, lastMapSize(mask));
+    if (blocks.failed() || last_blocks.failed())
+        return false;
+
+    // as runInt, the passes after the first only ever see the clamped output of the kernels
+    bool all = frame_threshold > CCD_FLOAT_MAX_DISTANCE &&
+               ccdSourcesInRange(params.src, params.refs, ref_count, params.src_stride, width, height);
+    if (all) {
+        ccdFillBlocks(width, height, ccdBlockAverage, blocks.get<void>(), &map);
+        params.blocks = &map;
+    } else if (ccdClassifyBlocks(params, blocks.get<void>(), &map, pool, threads)) {
+        params.blocks = &map;
+    }
+    const ccdBlockMap *last = ccdMaskPasses(mask, width, height, iterations, &params.blocks, blocks.get<void>(),
+                                            &map, last_blocks.get<void>(), &last_map, pool, threads);
+    const ccdBlockMap *between = all ? &map : nullptr;
+    if (!last)
+        last = between;
+
+    // the fast kernels only ever run a single pass
+    ccdScratch half(scratch, fast ? ccdHalfBufferSize(width, height, ref_count) : 0);
+    if (half.failed())
+        return false;
+    float *half_planes[3 * (CCD_MAX_REFS + 1)];
+    if (fast) {
+        ccdHalfPlanes(half.get<float>(), width, height, ref_count, half_planes);
+        params.half = half_planes;
+        params.half_stride = ccdHalfStride(width);
+        ccdHalveFrame(params, half_planes, roi, pool, threads);
+    }
+
+    if (stats)
+        ccdCountAccepted(params, roi, stats);
+
+    if (!packed_kernel)
+        return runPasses<float>(kernel, params, last, between);
+
+    params.packed_stride = ccdPackedStride(width);
+    ccdScratch packed(scratch, params.packed_stride * height * sizeof(float));
+    if (packed.failed())
+        return false;
+    ccdPackFrame(params, packed.get<float>(), pool, threads);
+    params.packed = packed.get<float>();
+
+    ccdProcessFrame(packed_kernel, params, roi, pool, threads);
+    return true;
+}
+
+bool ccdCore::runHalf(const ccdCoreFrame &src, const ccdCoreFrame *refs, int ref_count, const ccdMask *mask,
+                      const ccdCoreOutput &dst, ccdStats *stats, float frame_threshold) const {
+    ccdHalfKernelParams params;
+
+    params.src_stride = src.stride / static_cast<ptrdiff_t>(sizeof(uint16_t));
+    params.dst_stride = dst.stride / static_cast<ptrdiff_t>(sizeof(uint16_t));
+
+    for (int plane = 0; plane < 3; plane++) {
+        params.src[plane] = static_cast<const uint16_t *>(src.planes[plane]);
+        params.dst[plane] = static_cast<uint16_t *>(dst.planes[plane]);
+    }
+
+    const uint16_t *ref_planes[3 * CCD_MAX_REFS];
+    for (int plane = 0; plane < 3 * ref_count; plane++)
+        ref_planes[plane] = static_cast<const uint16_t *>(refs[plane / 3].planes[plane % 3]);
+    params.refs = ref_planes;
+    params.ref_count = ref_count;
+
+    params.width = width;
+    params.height = height;
+    params.threshold = frame_threshold;
+    params.window = &window;
+    params.blocks = nullptr;
+
+    ccdBlockMap map, last_map;
+    ccdScratch blocks(scratch, ccdBlockMapSize(width, height));
+    ccdScratch last_blocks(scratch, lastMapSize(mask));
+    if (blocks.failed() || last_blocks.failed())
+        return false;
+
+    bool all = frame_threshold > CCD_FLOAT_MAX_DISTANCE &&
+               ccdSourcesInRange(params.src, params.refs, ref_count, params.src_stride, width, height);
+    if (all) {
+        ccdFillBlocks(width, height, ccdBlockAverage, blocks.get<void>(), &map);
+        params.blocks = &map;
+    } else if (ccdClassifyBlocks(params, blocks.get<void>(), &map, pool, threads)) {
+        params.blocks = &map;
+    }
+    const ccdBlockMap *last = ccdMaskPasses(mask, width, height, iterations, &params.blocks, blocks.get<void>(),
+                                            &map, last_blocks.get<void>(), &last_map, pool, threads);
+    const ccdBlockMap *between = all ? &map : nullptr;
+    if (!last)
+        last = between;
+
+    if (stats)
+        ccdCountAccepted(params, roi, stats);
+
+    if (half_kernel)
+        return runPasses<uint16_t>(half_kernel, params, last, between);
+
+    // without a half kernel every pass is converted to float and back, so the passes in between
+    // are rounded to half floats like when CCD is run several times
+    size_t half_plane_size = params.dst_stride * height * sizeof(uint16_t);
+    ccdScratch buffer(scratch, half_plane_size * ccdScratchPlanes(iterations));
+    if (buffer.failed())
+        return false;
+    std::vector<ccdHalfKernelParams> passes =
+        ccdPassParams<uint16_t>(params, iterations, half_plane_size, buffer.get<uint8_t>(), last, between);
+
+    // same alignment as VapourSynth's own frames
+    ptrdiff_t stride = (width + 15) & ~static_cast<ptrdiff_t>(15);
+    // the three planes of every source frame, then the three of dst
+    int src_count = 3 * (ref_count + 1);
+    size_t plane_size = stride * height * sizeof(float);
+    ccdScratch planes(scratch, plane_size * (src_count + 3));
+    if (planes.failed())
+        return false;
+    float *src_planes[3 * (CCD_MAX_REFS + 1)], *dst_planes[3];
+    for (int plane = 0; plane < src_count; plane++)
+        src_planes[plane] = planes.get<float>() + stride * height * plane;
+    for (int plane = 0; plane < 3; plane++)
+        dst_planes[plane] = planes.get<float>() + stride * height * (src_count + plane);
+
+    for (int pass = 0; pass < iterations; pass++)
+        ccdProcessHalfFrame(kernel, passes[pass], ccdPassRect(roi, pass, iterations, window.radius, width, height),
+                            src_planes, dst_planes, stride, pool, threads);
+    return true;
+}
+
+bool ccdCore::runInt(const ccdCoreFrame &src, const ccdCoreFrame *refs, int ref_count, const ccdMask *mask,
+                     const ccdCoreOutput &dst, ccdStats *stats, int frame_threshold) const {
+    ccdIntKernelParams params;
+
+    params.src_stride = src.stride / sample_size;
+    params.dst_stride = dst.stride / sample_size;
+
+    for (int plane = 0; plane < 3; plane++) {
+        params.src[plane] = src.planes[plane];
+        params.dst[plane] = dst.planes[plane];
+    }
+
+    const void *ref_planes[3 * CCD_MAX_REFS];
+    for (int plane = 0; plane < 3 * ref_count; plane++)
+        ref_planes[plane] = refs[plane / 3].planes[plane % 3];
+    params.refs = ref_planes;
+    params.ref_count = ref_count;
+
+    params.width = width;
+    params.height = height;
+    params.threshold = frame_threshold;
+    params.shift = int_shift;
+    params.window = &window;
+    params.blocks = nullptr;
+
+    ccdBlockMap map, last_map;
+    ccdScratch blocks(scratch, ccdBlockMapSize(width, height));
+    ccdScratch last_blocks(scratch, lastMapSize(mask));
+    if (blocks.failed() || last_blocks.failed())
+        return false;
+
+    // past the largest distance there's nothing to test in any pass, whatever the frame holds
+    bool all = frame_threshold > ccdIntMaxDistance(bits);
+    if (all) {
+        ccdFillBlocks(width, height, ccdBlockAverage, blocks.get<void>(), &map);
+        params.blocks = &map;
+    } else if (ccdClassifyBlocks(params, sample_size, blocks.get<void>(), &map, pool, threads)) {
+        params.blocks = &map;
+    }
+    const ccdBlockMap *last = ccdMaskPasses(mask, width, height, iterations, &params.blocks, blocks.get<void>(),
+                                            &map, last_blocks.get<void>(), &last_map, pool, threads);
+
+    // the mask only goes into the map of the last pass with more than one, so map stays as it is
+    const ccdBlockMap *between = all ? &map : nullptr;
+    if (!last)
+        last = between;
+
+    if (stats)
+        ccdCountAccepted(params, sample_size, roi, stats);
+
+    return runPasses<uint8_t>(int_kernel, params, last, between);
+}
+
+// Copies the planes of src over dst outside of rect, which is all the kernels write. Strides are
+// in bytes.
+static void ccdCopyOutside(const ccdCoreFrame &src, const ccdCoreOutput &dst, const ccdRect &rect, int width,
+                           int height, int sample_size) {
+    for (int plane = 0; plane < 3; plane++) {
+        const uint8_t *srcp = static_cast<const uint8_t *>(src.planes[plane]);
+        uint8_t *dstp = static_cast<uint8_t *>(dst.planes[plane]);
+
+        // whole rows above and below it, then either side of the rows in between
+        for (int y = 0; y < height; y++) {
+            const uint8_t *s = srcp + y * src.stride;
+            uint8_t *d = dstp + y * dst.stride;
+            if (y < rect.top || y >= rect.bottom) {
+                memcpy(d, s, static_cast<size_t>(width) * sample_size);
+            } else {
+                memcpy(d, s, static_cast<size_t>(rect.left) * sample_size);
+                memcpy(d + rect.right * sample_size, s + rect.right * sample_size,
+                       static_cast<size_t>(width - rect.right) * sample_size);
+            }
+        }
+    }
+}
+
+ccdThresholdKind ccdCore::thresholdKind(double frame_threshold) const {
+    if (!thresholds.empty())
+        return ccdThresholdTest;
+
+    bool own = frame_threshold < 0;
+    if (int_kernel) {
+        int t = own ? int_threshold : ccdIntThreshold(ccdScaleThreshold(frame_threshold), bits);
+        return t <= 0 ? ccdThresholdNone : t > ccdIntMaxDistance(bits) ? ccdThresholdAll : ccdThresholdTest;
+    }
+
+    float t = own ? threshold : static_cast<float>(ccdScaleThreshold(frame_threshold));
+    return !(t > 0) ? ccdThresholdNone : t > CCD_FLOAT_MAX_DISTANCE ? ccdThresholdAll : ccdThresholdTest;
+}
+
+bool ccdCore::passesThrough(const ccdCoreFrame &src, double frame_threshold) const {
+    if (thresholdKind(frame_threshold) != ccdThresholdNone)
+        return false;
+    if (int_kernel)
+        return true;
+
+    // only the pixels of roi are clamped, the others are src anyway
+    ptrdiff_t stride = src.stride / sample_size;
+    if (is_rgbh) {
+        const uint16_t *planes[3];
+        for (int plane = 0; plane < 3; plane++)
+            planes[plane] = static_cast<const uint16_t *>(src.planes[plane]);
+        return ccdUnitRange(planes, 3, stride, roi);
+    }
+
+    const float *planes[3];
+    for (int plane = 0; plane < 3; plane++)
+        planes[plane] = static_cast<const float *>(src.planes[plane]);
+    return ccdUnitRange(planes, 3, stride, roi);
+}
+
+// process() for ccdThresholdNone, the kernels' output without running them.
+bool ccdCore::none(const ccdCoreFrame &src, const ccdMask *mask, const ccdCoreOutput &dst,
+                   ccdStats *stats) const {
+    if (stats) {
+        // the same blocks as the kernels would have skipped
+        const ccdBlockMap *blocks = nullptr;
+        ccdBlockMap map;
+        ccdScratch buffer(scratch, mask ? ccdBlockMapSize(width, height) : 0);
+        if (buffer.failed())
+            return false;
+        ccdMaskPasses(mask, width, height, 1, &blocks, buffer.get<void>(), &map, nullptr, nullptr, pool, threads);
+        ccdCountNone(blocks, roi, stats);
+    }
+
+    if (int_kernel) {
+        // the whole frame is outside of an empty rectangle
+        ccdCopyOutside(src, dst, ccdRect{0, 0, 0, 0}, width, height, sample_size);
+        return true;
+    }
+
+    ptrdiff_t src_stride = src.stride / sample_size, dst_stride = dst.stride / sample_size;
+    if (is_rgbh) {
+        const uint16_t *src_planes[3];
+        uint16_t *dst_planes[3];
+        for (int plane = 0; plane < 3; plane++) {
+            src_planes[plane] = static_cast<const uint16_t *>(src.planes[plane]);
+            dst_planes[plane] = static_cast<uint16_t *>(dst.planes[plane]);
+        }
+        ccdClampPlanes(src_planes, src_stride, dst_planes, dst_stride, roi);
+    } else {
+        const float *src_planes[3];
+        float *dst_planes[3];
+        for (int plane = 0; plane < 3; plane++) {
+            src_planes[plane] = static_cast<const float *>(src.planes[plane]);
+            dst_planes[plane] = static_cast<float *>(dst.planes[plane]);
+        }
+        ccdClampPlanes(src_planes, src_stride, dst_planes, dst_stride, roi);
+    }
+    finish(src, mask, dst);
+    return true;
+}
+
+bool ccdCore::process(const ccdCoreFrame &src, const ccdCoreFrame *refs, int ref_count, const ccdMask *mask,
+                      const ccdCoreOutput &dst, ccdStats *stats, double frame_threshold) const {
+    if (thresholdKind(frame_threshold) == ccdThresholdNone)
+        return none(src, mask, dst, stats);
+
+    // scaled the same way as init's
+    bool own = frame_threshold < 0;
+    double scaled = own ? 0 : ccdScaleThreshold(frame_threshold);
+
+    bool done;
+    if (int_kernel)
+        done = runInt(src, refs, ref_count, mask, dst, stats, own ? int_threshold : ccdIntThreshold(scaled, bits));
+    else if (is_rgbh)
+        done = runHalf(src, refs, ref_count, mask, dst, stats, own ? threshold : static_cast<float>(scaled));
+    else
+        done = run(src, refs, ref_count, mask, dst, stats, own ? threshold : static_cast<float>(scaled));
+    if (!done)
+        return false;
+
+    finish(src, mask, dst);
+    return true;
+}
+
+bool ccdCore::processMulti(const ccdCoreFrame &src, const ccdCoreFrame *refs, int ref_count, const ccdMask *mask,
+                           const ccdCoreOutput *dst, ccdStats *stats) const {
+    ccdMultiKernelParams multi;
+    ccdKernelParams &params = multi.params;
+
+    params.src_stride = src.stride / static_cast<ptrdiff_t>(sizeof(float));
+    params.dst_stride = dst[0].stride / static_cast<ptrdiff_t>(sizeof(float));
+
+    multi.count = outputs();
+    for (int t = 0; t < multi.count; t++) {
+        multi.thresholds[t] = thresholds[t];
+        for (int plane = 0; plane < 3; plane++)
+            multi.dst[t][plane] = static_cast<float *>(dst[t].planes[plane]);
+    }
+
+    for (int plane = 0; plane < 3; plane++) {
+        params.src[plane] = static_cast<const float *>(src.planes[plane]);
+        params.dst[plane] = nullptr;
+    }
+
+    const float *ref_planes[3 * CCD_MAX_REFS];
+    for (int plane = 0; plane < 3 * ref_count; plane++)
+        ref_planes[plane] = static_cast<const float *>(refs[plane / 3].planes[plane % 3]);
+    params.refs = ref_planes;
+    params.ref_count = ref_count;
+
+    params.width = width;
+    params.height = height;
+    params.threshold = threshold;
+    params.window = &window;
+    params.packed = nullptr;
+    params.packed_stride = 0;
+    params.half = nullptr;
+    params.half_stride = 0;
+    params.blocks = nullptr;
+
+    // a block that passes the lowest threshold passes all of them
+    ccdBlockMap map;
+    ccdScratch blocks(scratch, ccdBlockMapSize(width, height));
+    if (blocks.failed())
+        return false;
+    if (ccdClassifyBlocks(params, blocks.get<void>(), &map, pool, threads))
+        params.blocks = &map;
+    ccdMaskPasses(mask, width, height, 1, &params.blocks, blocks.get<void>(), &map, nullptr, nullptr, pool, threads);
+
+    if (stats)
+        ccdCountAccepted(params, roi, stats);
+
+    ccdProcessTiles(roi, window.radius, sample_size, ref_count + 1, pool, threads,
+                    [&](int x0, int y0, int x1, int y1) { multi_kernel(multi, x0, y0, x1, y1); });
+
+    for (int t = 0; t < multi.count; t++)
+        finish(src, mask, dst[t]);
+    return true;
+}
+
+void ccdCore::finish(const ccdCoreFrame &src, const ccdMask *mask, const ccdCoreOutput &dst) const {
+    if (!full_frame)
+        ccdCopyOutside(src, dst, roi, width, height, sample_size);
+
+    // the skipped blocks are left as they are, and the kernels compute every pixel of the others
+    if (mask) {
+        const uint8_t *src_planes[3];
+        uint8_t *dst_planes[3];
+        for (int plane = 0; plane < 3; plane++) {
+            src_planes[plane] = static_cast<const uint8_t *>(src.planes[plane]);
+            dst_planes[plane] = static_cast<uint8_t *>(dst.planes[plane]);
+        }
+        ccdApplyMask(*mask, 3, src_planes, src.stride, dst_planes, dst.stride, width, height, sample_size, pool,
+                     threads);
+    }
+}
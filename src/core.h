@@ -0,0 +1,164 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#ifndef CCD_CORE_H
+#define CCD_CORE_H
+
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kernel.h"
+#include "scratch.h"
+
+struct ccdStats; // see stats.h
+
+// Everything CCD does to an RGB frame between having its planes and having the planes of the
+// output, without VapourSynth. ccdGetframe hands it the frames the core gave it, other hosts
+// (libavfilter, AviSynth+) and ccd-bench hand it their own, and get the same output. It's built
+// into the ccdcore static library, which links with nothing but the C++ runtime and threads.
+
+// The threshold argument as the kernels compare against it, squared and scaled down to distances
+// of samples in [0, 1].
+inline double ccdScaleThreshold(double threshold) {
+    return threshold * threshold / 195075.0; // the magic number - thanks DomBito
+}
+
+// What a threshold leaves for the kernels to do, see ccdCore::thresholdKind.
+enum ccdThresholdKind {
+    ccdThresholdTest, // the samples are tested one by one
+    ccdThresholdNone, // 0, no sample passes, so every pixel keeps its own value, clamped for floats
+    ccdThresholdAll,  // above any distance the frames can hold, every sample passes
+};
+
+// The arguments of the CCD filter that decide how a clip is denoised, with the same defaults.
+struct ccdCoreOptions {
+    double threshold;    // as the threshold argument, the core squares and scales it
+    int radius;
+    int step;
+    int temporal_radius; // the most neighbours on each side process() will be given
+    int iterations;
+    bool fast;           // mode="fast"
+    int opt;             // ccdOpt
+    int packed;          // ccdLayout
+    int threads;         // besides the host's own, 1 to stay on the calling thread
+    int host_threads;    // the host's, which the pool's workers only use when idle, 0 for threads
+    ccdRect roi;         // the rectangle to denoise, all of the frame if it's empty
+    std::vector<double> thresholds; // several at once for processMulti(), threshold is ignored then
+
+    ccdCoreOptions()
+        : threshold(4), radius(12), step(8), temporal_radius(0), iterations(1), fast(false), opt(ccdOptAuto),
+          packed(ccdLayoutPlanar), threads(1), host_threads(0), roi{0, 0, 0, 0} {}
+};
+
+// The three planes of a frame, R, G and B, sharing one stride in bytes.
+struct ccdCoreFrame {
+    const void *planes[3];
+    ptrdiff_t stride;
+};
+
+struct ccdCoreOutput {
+    void *planes[3];
+    ptrdiff_t stride;
+};
+
+class ccdCore {
+public:
+    ccdCore();
+    ~ccdCore();
+
+    // Sets the core up for width x height frames, single (bits 32) or half (16) precision with
+    // is_float, 8 to 16 bit integers otherwise. Returns false and sets error, to be prefixed with
+    // the name of the filter, when the options can't work for those frames or this CPU.
+    bool init(const ccdCoreOptions &options, int width, int height, bool is_float, int bits, std::string *error);
+
+    // Denoises src into dst, which must not alias it. refs are up to temporal_radius neighbours
+    // of src, those before it first, all with the stride of src. mask, nullptr for none, is the
+    // size of the frame, see ccdMask. The pixels outside of the rectangle and the ones the mask
+    // leaves out are copied from src. stats, nullptr unless they are wanted, gets
+    // ccdCountAccepted of the first pass. frame_threshold, as the threshold argument, replaces
+    // the one of init for this frame when it's >= 0. Safe to call for several frames at once.
+    // Returns false, with dst unfinished, when the scratch memory can't be allocated.
+    bool process(const ccdCoreFrame &src, const ccdCoreFrame *refs, int ref_count, const ccdMask *mask,
+                 const ccdCoreOutput &dst, ccdStats *stats = nullptr, double frame_threshold = -1) const;
+
+    // process() for every one of thresholds in a single scan, dst[t] being the output for
+    // thresholds[t], all with the stride of dst[0]. The blocks are classified and the stats
+    // counted with the lowest of them.
+    // Only for cores set up with thresholds, which don't support frame_threshold.
+    bool processMulti(const ccdCoreFrame &src, const ccdCoreFrame *refs, int ref_count, const ccdMask *mask,
+                      const ccdCoreOutput *dst, ccdStats *stats = nullptr) const;
+
+    // What process() does with frame_threshold, or the threshold of init when it's < 0. With
+    // ccdThresholdNone it copies src, clamping float samples to [0, 1] like the kernels, and
+    // counts every pixel at n = 0. With ccdThresholdAll it averages every sample without
+    // classifying the blocks, for integer clips, whose samples can't be further apart than
+    // ccdIntMaxDistance, always, and for float ones when ccdUnitRange finds every sample of the
+    // frame and its refs in [0, 1], which it checks first. Always ccdThresholdTest with
+    // thresholds.
+    ccdThresholdKind thresholdKind(double frame_threshold = -1) const;
+
+    // Whether process() would leave src as it is for frame_threshold, ccdThresholdNone with no
+    // float sample of roi to clamp, so the filter can hand on the source frame itself.
+    bool passesThrough(const ccdCoreFrame &src, double frame_threshold = -1) const;
+
+    // How many outputs process() or processMulti() write, 1 without thresholds.
+    int outputs() const { return thresholds.empty() ? 1 : static_cast<int>(thresholds.size()); }
+
+    // The name of the kernel variant process() runs, see ccdKernelName.
+    const char *kernelName() const;
+
+    // The scratch memory of the maps of ccdMaskPasses.
+    size_t lastMapSize(const ccdMask *mask) const;
+
+    // What init settled on, CCDYUV drives its own frames through these.
+    float threshold; // the lowest of thresholds with them
+    std::vector<float> thresholds; // scaled like threshold, empty unless set up for processMulti()
+    ccdWindow window;
+    int temporal_radius;
+    int iterations;
+    bool fast; // kernel is then a fast kernel
+    ccdRect roi;
+    bool full_frame; // roi is the whole frame
+    int width;
+    int height;
+    int sample_size; // bytes
+    int bits;
+    ccdKernelFunc kernel;
+    ccdKernelFunc packed_kernel; // nullptr when the frames stay planar
+    ccdHalfKernelFunc half_kernel; // RGBH only, nullptr there means converting to float
+    bool is_rgbh;
+    ccdIntKernelFunc int_kernel; // nullptr for float frames
+    ccdMultiKernelFunc multi_kernel; // nullptr without thresholds
+    int int_threshold;
+    int int_shift;
+    int threads;
+    ccdThreadPool *pool;
+    mutable ccdScratchPool scratch; // every buffer a frame needs besides the frames themselves
+
+private:
+    ccdCore(const ccdCore &) = delete;
+    ccdCore &operator=(const ccdCore &) = delete;
+
+    // these return false when a scratch buffer can't be allocated, like process()
+    bool run(const ccdCoreFrame &src, const ccdCoreFrame *refs, int ref_count, const ccdMask *mask,
+             const ccdCoreOutput &dst, ccdStats *stats, float frame_threshold) const;
+    bool runHalf(const ccdCoreFrame &src, const ccdCoreFrame *refs, int ref_count, const ccdMask *mask,
+                 const ccdCoreOutput &dst, ccdStats *stats, float frame_threshold) const;
+    bool runInt(const ccdCoreFrame &src, const ccdCoreFrame *refs, int ref_count, const ccdMask *mask,
+                const ccdCoreOutput &dst, ccdStats *stats, int frame_threshold) const;
+    bool none(const ccdCoreFrame &src, const ccdMask *mask, const ccdCoreOutput &dst, ccdStats *stats) const;
+    void finish(const ccdCoreFrame &src, const ccdMask *mask, const ccdCoreOutput &dst) const;
+    template <typename S, typename K, typename P>
+    bool runPasses(K pass_kernel, const P &params, const ccdBlockMap *last,
+                   const ccdBlockMap *between = nullptr) const;
+};
+
+#endif // CCD_CORE_H
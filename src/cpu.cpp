@@ -0,0 +1,116 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#include "cpu.h"
+
+#if defined(CCD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#elif defined(CCD_X86)
+#include <cpuid.h>
+#endif
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <vector>
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
+
+#if defined(CCD_ARM64) && defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_SVE
+#define HWCAP_SVE (1 << 22)
+#endif
+#endif
+
+static int detectL2CacheSize() {
+    long size = 0;
+
+#if defined(_WIN32)
+    DWORD bytes = 0;
+    GetLogicalProcessorInformation(nullptr, &bytes);
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(bytes / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (!info.empty() && GetLogicalProcessorInformation(info.data(), &bytes)) {
+        for (size_t i = 0; i < info.size(); i++) {
+            if (info[i].Relationship == RelationCache && info[i].Cache.Level == 2) {
+                size = static_cast<long>(info[i].Cache.Size);
+                break;
+            }
+        }
+    }
+#elif defined(__APPLE__)
+    int64_t value = 0;
+    size_t len = sizeof(value);
+    if (sysctlbyname("hw.l2cachesize", &value, &len, nullptr, 0) == 0)
+        size = static_cast<long>(value);
+#elif defined(__linux__) && defined(_SC_LEVEL2_CACHE_SIZE)
+    size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+
+    // anything that's obviously wrong gets the conservative default
+    if (size < 64 * 1024 || size > 64 * 1024 * 1024)
+        size = 256 * 1024;
+    return static_cast<int>(size);
+}
+
+static ccdCPUFeatures detect() {
+    ccdCPUFeatures f = {};
+
+#if defined(CCD_X86) && defined(_MSC_VER)
+    int regs[4];
+
+    __cpuid(regs, 0);
+    int max_leaf = regs[0];
+
+    __cpuid(regs, 1);
+    f.sse2 = (regs[3] >> 26) & 1;
+    bool osxsave = (regs[2] >> 27) & 1;
+    bool avx = (regs[2] >> 28) & 1;
+    bool f16c = (regs[2] >> 29) & 1;
+
+    // the OS has to save the ymm (bits 1-2) and zmm/opmask (bits 5-7) state for us to use them
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    bool os_avx = (xcr0 & 0x6) == 0x6;
+    bool os_avx512 = (xcr0 & 0xe6) == 0xe6;
+
+    if (max_leaf >= 7) {
+        __cpuidex(regs, 7, 0);
+        f.avx2 = avx && os_avx && ((regs[1] >> 5) & 1);
+        f.avx512f = os_avx512 && ((regs[1] >> 16) & 1);
+    }
+    f.f16c = f.avx2 && f16c;
+#elif defined(CCD_X86)
+    // libgcc / compiler-rt check the OS xsave state for us
+    __builtin_cpu_init();
+    f.sse2 = __builtin_cpu_supports("sse2");
+    f.avx2 = __builtin_cpu_supports("avx2");
+    f.avx512f = __builtin_cpu_supports("avx512f");
+    // not every compiler knows "f16c" for __builtin_cpu_supports
+    unsigned int eax, ebx, ecx, edx;
+    f.f16c = f.avx2 && __get_cpuid(1, &eax, &ebx, &ecx, &edx) && ((ecx >> 29) & 1);
+#elif defined(CCD_ARM64)
+    // NEON is mandatory on AArch64, SVE has to be asked from the kernel
+    f.neon = true;
+#if defined(__linux__)
+    f.sve = (getauxval(AT_HWCAP) & HWCAP_SVE) != 0;
+#endif
+#endif
+
+    f.l2_cache_size = detectL2CacheSize();
+
+    return f;
+}
+
+const ccdCPUFeatures *ccdGetCPUFeatures() {
+    static const ccdCPUFeatures features = detect();
+    return &features;
+}
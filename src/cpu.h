@@ -0,0 +1,32 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#ifndef CCD_CPU_H
+#define CCD_CPU_H
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CCD_X86
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CCD_ARM64
+#endif
+
+struct ccdCPUFeatures {
+    bool sse2;
+    bool avx2;
+    bool f16c; // only set along with avx2, as the half float kernel needs both
+    bool avx512f;
+    bool neon;
+    bool sve;
+    // per core, falls back to 256 KiB when the OS won't tell
+    int l2_cache_size;
+};
+
+// Queried once with CPUID and cached, the result never changes while the plugin is loaded.
+const ccdCPUFeatures *ccdGetCPUFeatures();
+
+#endif // CCD_CPU_H
@@ -0,0 +1,531 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2006-2020 Stolyarevskiy Sergey
+ *  Copyright (c) 2020 DomBito
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <stdint.h>
+
+#include "cpu.h"
+#include "kernel.h"
+#include "threadpool.h"
+
+bool ccdCheckWindow(int radius, int step, const char **error) {
+    if (radius < 1 || radius > CCD_MAX_RADIUS) {
+        *error = "radius must be between 1 and 64";
+        return false;
+    }
+    if (step < 1 || (2 * radius) % step) {
+        *error = "step must be positive and divide 2 * radius";
+        return false;
+    }
+    return true;
+}
+
+template <typename W>
+static void ccdKernelCImpl(const ccdKernelParams &params, const W &w, int x0, int y0, int x1, int y1) {
+    ccdBorderColumns border(*params.window, params.width);
+
+    for (int y = y0; y < y1; y++) {
+        ptrdiff_t rows[CCD_MAX_TAPS];
+        ccdSampleRows(w, y, params.height, params.src_stride, rows);
+        ccdRowC(params, w, rows, border, y, x0, x1);
+    }
+}
+
+void ccdKernelC(CCD_KERNEL_ARGS) {
+    CCD_WITH_WINDOW(*params.window, w, ccdKernelCImpl(params, w, x0, y0, x1, y1));
+}
+
+template <typename W>
+static void ccdKernelFastCImpl(const ccdKernelParams &params, const W &w, int x0, int y0, int x1, int y1) {
+    ccdHalvedWindow<W> half(w);
+
+    for (int y = y0; y < y1; y++) {
+        ptrdiff_t rows[CCD_MAX_TAPS], half_rows[CCD_MAX_TAPS];
+        ccdSampleRows(w, y, params.height, params.src_stride, rows);
+        ccdSampleRows(half, y / 2, ccdHalfSize(params.height), params.half_stride, half_rows);
+        for (int x = x0; x < x1; x++)
+            ccdPixelFastBlockC(params, w, rows, half_rows, x, y);
+    }
+}
+
+void ccdKernelFastC(CCD_KERNEL_ARGS) {
+    CCD_WITH_WINDOW(*params.window, w, ccdKernelFastCImpl(params, w, x0, y0, x1, y1));
+}
+
+template <typename W>
+static void ccdKernelMultiCImpl(const ccdMultiKernelParams &multi, const W &w, int x0, int y0, int x1, int y1) {
+    const ccdKernelParams &params = multi.params;
+    ccdBorderColumns border(*params.window, params.width);
+
+    for (int y = y0; y < y1; y++) {
+        ptrdiff_t rows[CCD_MAX_TAPS];
+        ccdSampleRows(w, y, params.height, params.src_stride, rows);
+        ccdRowMultiC(multi, w, rows, border, y, x0, x1);
+    }
+}
+
+void ccdKernelMultiC(CCD_MULTI_KERNEL_ARGS) {
+    CCD_WITH_WINDOW(*multi.params.window, w, ccdKernelMultiCImpl(multi, w, x0, y0, x1, y1));
+}
+
+template <typename T, typename W>
+static void ccdKernelIntC(const ccdIntKernelParams &params, const W &w, int x0, int y0, int x1, int y1) {
+    ccdBorderColumns border(*params.window, params.width);
+
+    for (int y = y0; y < y1; y++) {
+        ptrdiff_t rows[CCD_MAX_TAPS];
+        ccdSampleRows(w, y, params.height, params.src_stride, rows);
+        ccdRowInt<T>(params, w, rows, border, y, x0, x1);
+    }
+}
+
+void ccdKernel8C(CCD_INT_KERNEL_ARGS) {
+    CCD_WITH_WINDOW(*params.window, w, ccdKernelIntC<uint8_t>(params, w, x0, y0, x1, y1));
+}
+
+void ccdKernel16C(CCD_INT_KERNEL_ARGS) {
+    CCD_WITH_WINDOW(*params.window, w, ccdKernelIntC<uint16_t>(params, w, x0, y0, x1, y1));
+}
+
+ccdKernelFunc ccdSelectKernel(int opt) {
+    const ccdCPUFeatures *cpu = ccdGetCPUFeatures();
+    (void)cpu;
+
+    switch (opt) {
+    case ccdOptAuto:
+#if defined(CCD_X86)
+        if (cpu->avx512f)
+            return ccdKernelAVX512;
+        if (cpu->avx2)
+            return ccdKernelAVX2;
+        if (cpu->sse2)
+            return ccdKernelSSE2;
+#elif defined(CCD_ARM64)
+#if defined(CCD_SVE)
+        if (cpu->sve)
+            return ccdKernelSVE;
+#endif
+        if (cpu->neon)
+            return ccdKernelNEON;
+#endif
+        return ccdKernelC;
+    case ccdOptC:
+        return ccdKernelC;
+#if defined(CCD_X86)
+    case ccdOptSSE2:
+        return cpu->sse2 ? ccdKernelSSE2 : nullptr;
+    case ccdOptAVX2:
+        return cpu->avx2 ? ccdKernelAVX2 : nullptr;
+    case ccdOptAVX512:
+        return cpu->avx512f ? ccdKernelAVX512 : nullptr;
+#elif defined(CCD_ARM64)
+    case ccdOptNEON:
+        return cpu->neon ? ccdKernelNEON : nullptr;
+#if defined(CCD_SVE)
+    case ccdOptSVE:
+        return cpu->sve ? ccdKernelSVE : nullptr;
+#endif
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+ccdKernelFunc ccdSelectPackedKernel(int opt) {
+    ccdKernelFunc kernel = ccdSelectKernel(opt);
+
+#if defined(CCD_X86)
+    if (kernel == ccdKernelSSE2)
+        return ccdKernelPackedSSE2;
+    if (kernel == ccdKernelAVX2)
+        return ccdKernelPackedAVX2;
+    if (kernel == ccdKernelAVX512)
+        return ccdKernelPackedAVX512;
+#elif defined(CCD_ARM64)
+    if (kernel == ccdKernelNEON)
+        return ccdKernelPackedNEON;
+#endif
+    return nullptr;
+}
+
+ccdKernelFunc ccdSelectFastKernel(int opt) {
+    ccdKernelFunc kernel = ccdSelectKernel(opt);
+
+#if defined(CCD_X86)
+    if (kernel == ccdKernelSSE2)
+        return ccdKernelFastSSE2;
+    if (kernel == ccdKernelAVX2)
+        return ccdKernelFastAVX2;
+    if (kernel == ccdKernelAVX512)
+        return ccdKernelFastAVX512;
+#elif defined(CCD_ARM64)
+    if (kernel == ccdKernelNEON)
+        return ccdKernelFastNEON;
+#if defined(CCD_SVE)
+    if (kernel == ccdKernelSVE)
+        return ccdKernelFastNEON;
+#endif
+#endif
+    return kernel ? ccdKernelFastC : nullptr;
+}
+
+ccdMultiKernelFunc ccdSelectMultiKernel(int opt) {
+    ccdKernelFunc kernel = ccdSelectKernel(opt);
+
+#if defined(CCD_X86)
+    if (kernel == ccdKernelSSE2)
+        return ccdKernelMultiSSE2;
+    if (kernel == ccdKernelAVX2)
+        return ccdKernelMultiAVX2;
+    if (kernel == ccdKernelAVX512)
+        return ccdKernelMultiAVX512;
+#elif defined(CCD_ARM64)
+    if (kernel == ccdKernelNEON)
+        return ccdKernelMultiNEON;
+#if defined(CCD_SVE)
+    if (kernel == ccdKernelSVE)
+        return ccdKernelMultiNEON;
+#endif
+#endif
+    return kernel ? ccdKernelMultiC : nullptr;
+}
+
+bool ccdCheckFastWindow(int radius, int step, const char **error) {
+    if (radius % 2 || step % 2) {
+        *error = "fast needs an even radius and step";
+        return false;
+    }
+    return true;
+}
+
+void ccdPackRGB(const ccdKernelParams &params, float *packed, int y0, int y1) {
+    ptrdiff_t stride = ccdPackedStride(params.width);
+
+    for (int y = y0; y < y1; y++) {
+        const float *r = params.src[0] + y * params.src_stride;
+        const float *g = params.src[1] + y * params.src_stride;
+        const float *b = params.src[2] + y * params.src_stride;
+        float *row = packed + y * stride;
+
+        for (int x = 0; x < params.width; x++) {
+            row[x * 4 + 0] = r[x];
+            row[x * 4 + 1] = g[x];
+            row[x * 4 + 2] = b[x];
+            row[x * 4 + 3] = 0;
+        }
+    }
+}
+
+void ccdHalveRGB(const ccdKernelParams &params, float *const *half, int y0, int y1) {
+    ptrdiff_t stride = ccdHalfStride(params.width);
+    int width = ccdHalfSize(params.width);
+
+    for (int plane = 0; plane < 3 * (params.ref_count + 1); plane++) {
+        const float *src = plane < 3 ? params.src[plane] : params.refs[plane - 3];
+
+        for (int y = y0; y < y1; y++) {
+            // the last row and column of odd sized frames are counted twice
+            const float *top = src + 2 * y * params.src_stride;
+            const float *bottom = 2 * y + 1 < params.height ? top + params.src_stride : top;
+            float *row = half[plane] + y * stride;
+
+            // kept apart from the last column so the compiler vectorises it
+            int pairs = params.width / 2;
+            for (int x = 0; x < pairs; x++)
+                row[x] = (top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1]) * 0.25f;
+            if (pairs < width)
+                row[pairs] = (top[2 * pairs] + bottom[2 * pairs]) * 0.5f;
+        }
+    }
+}
+
+ccdHalfKernelFunc ccdSelectHalfKernel(int opt) {
+    const ccdCPUFeatures *cpu = ccdGetCPUFeatures();
+    ccdKernelFunc kernel = ccdSelectKernel(opt);
+    (void)cpu;
+
+#if defined(CCD_X86)
+    if (kernel == ccdKernelAVX512)
+        return ccdKernelHalfAVX512;
+    if (kernel == ccdKernelAVX2 && cpu->f16c)
+        return ccdKernelHalfAVX2;
+#elif defined(CCD_ARM64)
+    if (kernel && kernel != ccdKernelC)
+        return ccdKernelHalfNEON;
+#endif
+    return nullptr;
+}
+
+void ccdHalfPlanesToFloat(const uint16_t *const *src, ptrdiff_t src_stride, float *const *dst,
+                          ptrdiff_t dst_stride, int width, int y0, int y1) {
+    for (int plane = 0; plane < 3; plane++)
+        for (int y = y0; y < y1; y++)
+            for (int x = 0; x < width; x++)
+                dst[plane][y * dst_stride + x] = ccdHalfToFloat(src[plane][y * src_stride + x]);
+}
+
+void ccdFloatPlanesToHalf(const float *const *src, ptrdiff_t src_stride, uint16_t *const *dst,
+                          ptrdiff_t dst_stride, int width, int y0, int y1) {
+    for (int plane = 0; plane < 3; plane++)
+        for (int y = y0; y < y1; y++)
+            for (int x = 0; x < width; x++)
+                dst[plane][y * dst_stride + x] = ccdFloatToHalf(src[plane][y * src_stride + x]);
+}
+
+template <typename T>
+static void ccdClampPlanesImpl(const T *const *src, ptrdiff_t src_stride, T *const *dst, ptrdiff_t dst_stride,
+                               const ccdRect &rect) {
+    for (int plane = 0; plane < 3; plane++) {
+        for (int y = rect.top; y < rect.bottom; y++) {
+            for (int x = rect.left; x < rect.right; x++) {
+                // as ccdPixelC, NaN stays
+                float v = ccdSampleToFloat(src[plane][y * src_stride + x]);
+                if (v < 0)
+                    v = 0;
+                else if (v > 1)
+                    v = 1;
+                ccdStoreSample(dst[plane] + y * dst_stride + x, v);
+            }
+        }
+    }
+}
+
+void ccdClampPlanes(const float *const *src, ptrdiff_t src_stride, float *const *dst, ptrdiff_t dst_stride,
+                    const ccdRect &rect) {
+    ccdClampPlanesImpl(src, src_stride, dst, dst_stride, rect);
+}
+
+void ccdClampPlanes(const uint16_t *const *src, ptrdiff_t src_stride, uint16_t *const *dst, ptrdiff_t dst_stride,
+                    const ccdRect &rect) {
+    ccdClampPlanesImpl(src, src_stride, dst, dst_stride, rect);
+}
+
+ccdIntKernelFunc ccdSelectIntKernel(int opt, int bytes_per_sample) {
+    ccdKernelFunc kernel = ccdSelectKernel(opt);
+    bool wide = bytes_per_sample == 2;
+
+    if (!kernel)
+        return nullptr;
+#if defined(CCD_X86)
+    if (kernel == ccdKernelSSE2)
+        return wide ? ccdKernel16SSE2 : ccdKernel8SSE2;
+    if (kernel == ccdKernelAVX2)
+        return wide ? ccdKernel16AVX2 : ccdKernel8AVX2;
+    if (kernel == ccdKernelAVX512)
+        return wide ? ccdKernel16AVX512 : ccdKernel8AVX512;
+#elif defined(CCD_ARM64)
+    if (kernel != ccdKernelC)
+        return wide ? ccdKernel16NEON : ccdKernel8NEON;
+#endif
+    return wide ? ccdKernel16C : ccdKernel8C;
+}
+
+int ccdIntShift(int bits) {
+    // the largest difference left after the shift is below 2^14, 3 * (2^14)^2 < 2^31
+    return bits > 14 ? bits - 14 : 0;
+}
+
+int ccdIntThreshold(double threshold, int bits) {
+    double peak = static_cast<double>((1 << bits) - 1);
+    int shift = ccdIntShift(bits);
+
+    // the distance is an integer, so dist < t is the same as dist < ceil(t)
+    double scaled = std::ceil(threshold * peak * peak / static_cast<double>(1 << (2 * shift)));
+    return scaled >= static_cast<double>(INT_MAX) ? INT_MAX : static_cast<int>(scaled);
+}
+
+int ccdIntMaxDistance(int bits) {
+    int diff = ((1 << bits) - 1) >> ccdIntShift(bits);
+    return 3 * diff * diff;
+}
+
+int ccdTileWidth(int width, int radius, int cache_size, int sample_size, int frames) {
+    // 2 * radius + 1 rows of 3 source planes per frame, plus the output row
+    const int bytes_per_column = ((2 * radius + 1) * 3 * frames + 3) * sample_size;
+    int tile = cache_size / bytes_per_column / 64 * 64;
+    if (tile < 64)
+        tile = 64;
+    if (tile >= width)
+        return width;
+    // don't leave a sliver of a tile at the right edge
+    int tiles = (width + tile - 1) / tile;
+    return ((width + tiles - 1) / tiles + 63) / 64 * 64;
+}
+
+ccdRect ccdPassRect(const ccdRect &rect, int pass, int passes, int radius, int width, int height) {
+    int grow = (passes - 1 - pass) * radius;
+    return {std::max(rect.left - grow, 0), std::max(rect.top - grow, 0), std::min(rect.right + grow, width),
+            std::min(rect.bottom + grow, height)};
+}
+
+void ccdProcessTiles(const ccdRect &rect, int radius, int sample_size, int frames, ccdThreadPool *pool,
+                     int threads, const std::function<void(int, int, int, int)> &run) {
+    int width = rect.right - rect.left, height = rect.bottom - rect.top;
+    int tile_width = ccdTileWidth(width, radius, ccdGetCPUFeatures()->l2_cache_size, sample_size, frames);
+    int band_height = CCD_BAND_HEIGHT;
+
+    if (!pool || threads < 2) {
+        for (int y = rect.top; y < rect.bottom; y += band_height) {
+            int y1 = std::min(y + band_height, rect.bottom);
+            for (int x = rect.left; x < rect.right; x += tile_width)
+                run(x, y, std::min(x + tile_width, rect.right), y1);
+        }
+        return;
+    }
+
+    // about four tiles per thread keeps them busy when some tiles are slower than others
+    int tiles_x = (width + tile_width - 1) / tile_width;
+    int bands = std::max((threads * 4 + tiles_x - 1) / tiles_x, (height + band_height - 1) / band_height);
+    band_height = std::max(((height + bands - 1) / bands + 7) / 8 * 8, 8);
+    bands = (height + band_height - 1) / band_height;
+
+    pool->run(bands * tiles_x, threads - 1, [&](int tile) {
+        int y = rect.top + tile / tiles_x * band_height;
+        int x = rect.left + tile % tiles_x * tile_width;
+        run(x, y, std::min(x + tile_width, rect.right), std::min(y + band_height, rect.bottom));
+    });
+}
+
+void ccdProcessPasses(const ccdRect &rect, int width, int height, int radius, int sample_size, int frames,
+                      int passes, ccdThreadPool *pool, int threads,
+                      const std::function<void(int, int, int, int, int)> &run) {
+    if (passes == 1 || (pool && threads >= 2)) {
+        for (int pass = 0; pass < passes; pass++)
+            ccdProcessTiles(ccdPassRect(rect, pass, passes, radius, width, height), radius, sample_size,
+                            pass ? 1 : frames, pool, threads,
+                            [&](int x0, int y0, int x1, int y1) { run(pass, x0, y0, x1, y1); });
+        return;
+    }
+
+    // the bands are those of the first pass, which covers the most, the others only do the part of
+    // each that's in their own rectangle
+    ccdRect first = ccdPassRect(rect, 0, passes, radius, width, height);
+    int tile_width = ccdTileWidth(first.right - first.left, radius, ccdGetCPUFeatures()->l2_cache_size,
+                                  sample_size, frames);
+    int band_height = CCD_PASS_BAND_HEIGHT;
+    int bands = (first.bottom - first.top + band_height - 1) / band_height;
+    // band b of a pass samples rows up to radius past its end, which are in the following bands
+    int lag = 1 + (radius + band_height - 1) / band_height;
+
+    for (int step = 0; step < bands + (passes - 1) * lag; step++) {
+        for (int pass = 0; pass < passes; pass++) {
+            int band = step - pass * lag;
+            if (band < 0 || band >= bands)
+                continue;
+
+            ccdRect own = ccdPassRect(rect, pass, passes, radius, width, height);
+            int y0 = std::max(first.top + band * band_height, own.top);
+            int y1 = std::min(first.top + (band + 1) * band_height, own.bottom);
+            if (y0 >= y1)
+                continue;
+            for (int x = own.left; x < own.right; x += tile_width)
+                run(pass, x, y0, std::min(x + tile_width, own.right), y1);
+        }
+    }
+}
+
+void ccdProcessFrame(ccdKernelFunc kernel, const ccdKernelParams &params, const ccdRect &rect,
+                     ccdThreadPool *pool, int threads) {
+    ccdProcessTiles(rect, params.window->radius, sizeof(float), params.ref_count + 1,
+                    pool, threads, [&](int x0, int y0, int x1, int y1) { kernel(params, x0, y0, x1, y1); });
+}
+
+void ccdProcessFrame(ccdHalfKernelFunc kernel, const ccdHalfKernelParams &params, const ccdRect &rect,
+                     ccdThreadPool *pool, int threads) {
+    ccdProcessTiles(rect, params.window->radius, sizeof(uint16_t), params.ref_count + 1,
+                    pool, threads, [&](int x0, int y0, int x1, int y1) { kernel(params, x0, y0, x1, y1); });
+}
+
+void ccdProcessFrame(ccdIntKernelFunc kernel, const ccdIntKernelParams &params, int sample_size,
+                     const ccdRect &rect, ccdThreadPool *pool, int threads) {
+    ccdProcessTiles(rect, params.window->radius, sample_size, params.ref_count + 1,
+                    pool, threads, [&](int x0, int y0, int x1, int y1) { kernel(params, x0, y0, x1, y1); });
+}
+
+void ccdProcessBands(int height, ccdThreadPool *pool, int threads,
+                     const std::function<void(int, int)> &run) {
+    if (!pool || threads < 2) {
+        run(0, height);
+        return;
+    }
+
+    int band_height = std::max((height + threads * 4 - 1) / (threads * 4), 8);
+    int bands = (height + band_height - 1) / band_height;
+
+    pool->run(bands, threads - 1, [&](int band) {
+        int y = band * band_height;
+        run(y, std::min(y + band_height, height));
+    });
+}
+
+void ccdPackFrame(const ccdKernelParams &params, float *packed,
+                  ccdThreadPool *pool, int threads) {
+    ccdProcessBands(params.height, pool, threads,
+                    [&](int y0, int y1) { ccdPackRGB(params, packed, y0, y1); });
+}
+
+void ccdHalveFrame(const ccdKernelParams &params, float *const *half, const ccdRect &rect,
+                   ccdThreadPool *pool, int threads) {
+    // the half rows sampled for the rows of rect, those past the edges are reflected back into these
+    int radius = params.window->radius / 2;
+    int first = std::max(rect.top / 2 - radius, 0);
+    int last = std::min((rect.bottom - 1) / 2 + radius + 1, ccdHalfSize(params.height));
+
+    ccdProcessBands(last - first, pool, threads,
+                    [&](int y0, int y1) { ccdHalveRGB(params, half, first + y0, first + y1); });
+}
+
+void ccdProcessHalfFrame(ccdKernelFunc kernel, const ccdHalfKernelParams &params, const ccdRect &rect,
+                         float *const *src, float *const *dst, ptrdiff_t stride,
+                         ccdThreadPool *pool, int threads) {
+    ccdKernelParams converted;
+
+    for (int plane = 0; plane < 3; plane++) {
+        converted.src[plane] = src[plane];
+        converted.dst[plane] = dst[plane];
+    }
+    converted.refs = src + 3;
+    converted.ref_count = params.ref_count;
+    converted.src_stride = stride;
+    converted.dst_stride = stride;
+    converted.width = params.width;
+    converted.height = params.height;
+    converted.threshold = params.threshold;
+    converted.window = params.window;
+    converted.packed = nullptr;
+    converted.packed_stride = 0;
+    converted.half = nullptr;
+    converted.half_stride = 0;
+    converted.blocks = params.blocks;
+
+    // the rows past the edges of the frame are reflected back into these
+    int radius = params.window->radius;
+    int first = std::max(rect.top - radius, 0), last = std::min(rect.bottom + radius, params.height);
+    ccdProcessBands(last - first, pool, threads, [&](int y0, int y1) {
+        ccdHalfPlanesToFloat(params.src, params.src_stride, src, stride, params.width, first + y0, first + y1);
+        for (int f = 0; f < params.ref_count; f++)
+            ccdHalfPlanesToFloat(params.refs + 3 * f, params.src_stride, src + 3 * (f + 1), stride,
+                                 params.width, first + y0, first + y1);
+    });
+    ccdProcessFrame(kernel, converted, rect, pool, threads);
+
+    const float *dst_planes[3];
+    uint16_t *half_planes[3];
+    for (int plane = 0; plane < 3; plane++) {
+        dst_planes[plane] = dst[plane] + rect.left;
+        half_planes[plane] = params.dst[plane] + rect.left;
+    }
+    ccdProcessBands(rect.bottom - rect.top, pool, threads, [&](int y0, int y1) {
+        ccdFloatPlanesToHalf(dst_planes, stride, half_planes, params.dst_stride, rect.right - rect.left,
+                             rect.top + y0, rect.top + y1);
+    });
+}
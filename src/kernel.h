@@ -0,0 +1,1089 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2006-2020 Stolyarevskiy Sergey
+ *  Copyright (c) 2020 DomBito
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#ifndef CCD_KERNEL_H
+#define CCD_KERNEL_H
+
+#include "cpu.h"
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// The sampled window, every step pixels from -radius to radius in both directions, so taps x taps
+// samples around the centre pixel. step has to divide 2 * radius. The default is the original
+// window, radius 12 and step 8, 4x4 samples, and step 1 is the dense window of every pixel.
+// frames is the most frames the window is sampled in, see temporal_radius.
+// reciprocals[n] is 1 / (n + 1) for every number n of accepted samples, the scalar kernel
+// averages with it like the old MULTIPLIERS table did.
+static const int CCD_MAX_RADIUS = 64;
+static const int CCD_MAX_TAPS = 2 * CCD_MAX_RADIUS + 1;
+static const int CCD_MAX_TEMPORAL_RADIUS = 7;
+static const int CCD_MAX_REFS = 2 * CCD_MAX_TEMPORAL_RADIUS;
+
+struct ccdWindow {
+    int radius;
+    int step;
+    int taps;
+    int frames;
+    std::vector<double> reciprocals;
+
+    ccdWindow(int window_radius = 12, int window_step = 8, int window_frames = 1)
+        : radius(window_radius), step(window_step), taps(2 * radius / step + 1), frames(window_frames),
+          reciprocals(taps * taps * frames + 1) {
+        for (size_t n = 0; n < reciprocals.size(); n++)
+            reciprocals[n] = 1. / (n + 1);
+    }
+};
+
+// Whether radius and step make a window the kernels can handle, error is set if not.
+bool ccdCheckWindow(int radius, int step, const char **error);
+
+// The frame is also split into blocks of CCD_BLOCK_SIZE x CCD_BLOCK_SIZE pixels, which
+// ccdClassifyBlocks sorts by the range of every channel over all the pixels the block samples, in
+// every frame of the window:
+//   ccdBlockTest    - the distance of every sample is tested as usual
+//   ccdBlockAverage - the range is within the threshold, so every sample is, and they're all
+//                     averaged without testing them
+//   ccdBlockFlat    - every sample is the same value too, and so is every output pixel
+//   ccdBlockSkip    - the mask leaves out every pixel, see ccdMaskBlocks, nothing is written
+// A vector covering more than one block goes by the lowest of their kinds.
+static const int CCD_BLOCK_SIZE = 16;
+
+enum ccdBlockKind {
+    ccdBlockTest = 0,
+    ccdBlockAverage = 1,
+    ccdBlockFlat = 2,
+    ccdBlockSkip = 3,
+};
+
+// The kind of every block, row by row, and for the flat ones the output pixel as the SIMD kernels
+// compute it, three floats per block. The scalar kernel rounds the average differently, so it
+// averages the flat blocks instead, and the integer kernels just copy them.
+struct ccdBlockMap {
+    const uint8_t *kinds;
+    const float *flat;
+    int columns;
+};
+
+// The kind of the width pixels from (x, y) on, ccdBlockTest without a map, the lowest of every
+// block they cover, which is up to three for the widest vectors, and only the ones in the frame
+// for the vectors of the edge strips. Flat blocks each have a value of their own, so a run of
+// them counts as flat only within a single block, while a run of skipped ones is skipped.
+static inline int ccdBlockKindAt(const ccdBlockMap *blocks, int x, int y, int width = 1) {
+    if (!blocks)
+        return ccdBlockTest;
+
+    const uint8_t *row = blocks->kinds + (y / CCD_BLOCK_SIZE) * blocks->columns;
+    int first = x / CCD_BLOCK_SIZE, last = (x + width - 1) / CCD_BLOCK_SIZE;
+    last = last < blocks->columns ? last : blocks->columns - 1;
+    int kind = row[first];
+    for (int i = first + 1; i <= last; i++)
+        kind = row[i] < kind ? row[i] : kind;
+    if (first == last || kind == ccdBlockSkip)
+        return kind;
+    return kind < ccdBlockAverage ? kind : ccdBlockAverage;
+}
+
+// The R, G and B output of the flat block (x, y) is in.
+static inline const float *ccdBlockFlatValue(const ccdBlockMap *blocks, int x, int y) {
+    return blocks->flat + 3 * ((y / CCD_BLOCK_SIZE) * blocks->columns + x / CCD_BLOCK_SIZE);
+}
+
+// Bytes of scratch memory ccdClassifyBlocks needs for a frame of the given size.
+size_t ccdBlockMapSize(int width, int height);
+
+// A single plane the size of the frame, the source is kept as it is where it's 0 (or below, for
+// float masks). The stride is in bytes, sample_size is 1 or 2 for integer masks and 2 (half) or
+// 4 for float ones.
+struct ccdMask {
+    const uint8_t *data;
+    ptrdiff_t stride;
+    int sample_size;
+    bool is_float;
+};
+
+// The three planes of an RGBS frame, the destination must not alias the source. Strides are in
+// floats, not bytes. threshold is the squared distance, already divided by 195075.
+// packed is the same frame interleaved by ccdPackRGB, only the packed kernels read it.
+// refs are the neighbouring frames of the temporal window, three planes each with the same stride
+// as src, sampled on the same grid. The centre pixel only comes from src.
+// blocks is the map ccdClassifyBlocks made of src and refs, or nullptr to test every sample.
+// half has the three planes of src and then of every ref at half resolution, made by
+// ccdHalveRGB, only the fast kernels read it.
+struct ccdKernelParams {
+    const float *src[3];
+    ptrdiff_t src_stride;
+    const float *const *refs;
+    int ref_count;
+    float *dst[3];
+    ptrdiff_t dst_stride;
+    int width;
+    int height;
+    float threshold;
+    const ccdWindow *window;
+    const float *packed;
+    ptrdiff_t packed_stride;
+    const float *const *half;
+    ptrdiff_t half_stride;
+    const ccdBlockMap *blocks;
+};
+
+// Every kernel computes the output pixels in the rectangle [x0, x1) x [y0, y1), sampling
+// from the whole source frame.
+typedef void (*ccdKernelFunc)(const ccdKernelParams &params, int x0, int y0, int x1, int y1);
+
+#define CCD_KERNEL_ARGS const ccdKernelParams &params, int x0, int y0, int x1, int y1
+
+// Values of the "opt" argument, same as in most other plugins.
+enum ccdOpt {
+    ccdOptAuto = 0,
+    ccdOptC = 1,
+    ccdOptSSE2 = 2,
+    ccdOptAVX2 = 3,
+    ccdOptAVX512 = 4,
+    ccdOptNEON = 5,
+    ccdOptSVE = 6,
+    ccdOptMax = ccdOptSVE,
+};
+
+// Scalar reference implementation, all the SIMD kernels are checked against this one.
+void ccdKernelC(CCD_KERNEL_ARGS);
+
+#if defined(CCD_X86)
+void ccdKernelSSE2(CCD_KERNEL_ARGS);
+void ccdKernelAVX2(CCD_KERNEL_ARGS);
+void ccdKernelAVX512(CCD_KERNEL_ARGS);
+void ccdKernelPackedSSE2(CCD_KERNEL_ARGS);
+void ccdKernelPackedAVX2(CCD_KERNEL_ARGS);
+void ccdKernelPackedAVX512(CCD_KERNEL_ARGS);
+#elif defined(CCD_ARM64)
+void ccdKernelNEON(CCD_KERNEL_ARGS);
+void ccdKernelPackedNEON(CCD_KERNEL_ARGS);
+// only built when the compiler knows about SVE, see meson.build
+#if defined(CCD_SVE)
+void ccdKernelSVE(CCD_KERNEL_ARGS);
+#endif
+#endif
+
+// Returns nullptr if the requested instruction set isn't available on this CPU.
+ccdKernelFunc ccdSelectKernel(int opt);
+
+// RGBH, the same as ccdKernelParams with the samples as the bits of half floats. Strides are in
+// samples. The kernels convert the samples as they load them and compute in single precision.
+struct ccdHalfKernelParams {
+    const uint16_t *src[3];
+    ptrdiff_t src_stride;
+    const uint16_t *const *refs;
+    int ref_count;
+    uint16_t *dst[3];
+    ptrdiff_t dst_stride;
+    int width;
+    int height;
+    float threshold;
+    const ccdWindow *window;
+    const ccdBlockMap *blocks;
+};
+
+typedef void (*ccdHalfKernelFunc)(const ccdHalfKernelParams &params, int x0, int y0, int x1, int y1);
+
+#define CCD_HALF_KERNEL_ARGS const ccdHalfKernelParams &params, int x0, int y0, int x1, int y1
+
+#if defined(CCD_X86)
+// these need F16C on top of AVX2, the AVX-512 one gets it from AVX-512F
+void ccdKernelHalfAVX2(CCD_HALF_KERNEL_ARGS);
+void ccdKernelHalfAVX512(CCD_HALF_KERNEL_ARGS);
+#elif defined(CCD_ARM64)
+void ccdKernelHalfNEON(CCD_HALF_KERNEL_ARGS);
+#endif
+
+// Same as ccdSelectKernel for RGBH, opt=6 gets the NEON kernel. C and SSE2 have no half float
+// conversions, and neither has the odd CPU with AVX2 but no F16C, so there this returns nullptr
+// and the frame goes through ccdProcessHalfFrame with the single precision kernel instead.
+// Converting every sample in software as it's loaded is about ten times slower than that.
+ccdHalfKernelFunc ccdSelectHalfKernel(int opt);
+
+// Converts the rows [y0, y1) of the planes between half and single precision.
+void ccdHalfPlanesToFloat(const uint16_t *const *src, ptrdiff_t src_stride, float *const *dst,
+                          ptrdiff_t dst_stride, int width, int y0, int y1);
+void ccdFloatPlanesToHalf(const float *const *src, ptrdiff_t src_stride, uint16_t *const *dst,
+                          ptrdiff_t dst_stride, int width, int y0, int y1);
+
+// Integer RGB, 8 bit samples in uint8_t and 9 to 16 bit ones in uint16_t. Strides are in samples.
+// The distance is computed on the absolute differences shifted right by shift, which is nonzero
+// above 14 bits so the sum of three squares still fits in an int32, and threshold is the same
+// value as the float one scaled to that, see ccdIntThreshold. The average is rounded to nearest.
+struct ccdIntKernelParams {
+    const void *src[3];
+    ptrdiff_t src_stride;
+    const void *const *refs;
+    int ref_count;
+    void *dst[3];
+    ptrdiff_t dst_stride;
+    int width;
+    int height;
+    int threshold;
+    int shift;
+    const ccdWindow *window;
+    const ccdBlockMap *blocks;
+};
+
+typedef void (*ccdIntKernelFunc)(const ccdIntKernelParams &params, int x0, int y0, int x1, int y1);
+
+#define CCD_INT_KERNEL_ARGS const ccdIntKernelParams &params, int x0, int y0, int x1, int y1
+
+void ccdKernel8C(CCD_INT_KERNEL_ARGS);
+void ccdKernel16C(CCD_INT_KERNEL_ARGS);
+
+#if defined(CCD_X86)
+void ccdKernel8SSE2(CCD_INT_KERNEL_ARGS);
+void ccdKernel16SSE2(CCD_INT_KERNEL_ARGS);
+void ccdKernel8AVX2(CCD_INT_KERNEL_ARGS);
+void ccdKernel16AVX2(CCD_INT_KERNEL_ARGS);
+void ccdKernel8AVX512(CCD_INT_KERNEL_ARGS);
+void ccdKernel16AVX512(CCD_INT_KERNEL_ARGS);
+#elif defined(CCD_ARM64)
+void ccdKernel8NEON(CCD_INT_KERNEL_ARGS);
+void ccdKernel16NEON(CCD_INT_KERNEL_ARGS);
+#endif
+
+// Same as ccdSelectKernel for bytes_per_sample sized integer samples. There is no SVE integer
+// kernel, opt=6 gets the NEON one.
+ccdIntKernelFunc ccdSelectIntKernel(int opt, int bytes_per_sample);
+
+// The shift for the given bit depth and the threshold to compare the shifted distance against.
+// threshold is the float one, the squared distance divided by 195075.
+int ccdIntShift(int bits);
+int ccdIntThreshold(double threshold, int bits);
+
+// The largest shifted distance two pixels of the bit depth can be apart, every sample passes a
+// threshold above it whatever the frame holds.
+int ccdIntMaxDistance(int bits);
+
+// The same for float samples in [0, 1], which is all it holds for, see ccdUnitRange.
+static const float CCD_FLOAT_MAX_DISTANCE = 3;
+
+// Values of the "packed" argument. The packed layout is opt-in: measured from 1080p to 8K, the
+// packed kernels are 1.8 to 2.9 times slower than the planar ones on every x86 kernel, which are
+// bound by arithmetic rather than by loads, and a packed vector only holds a quarter as many
+// pixels, plus the padding lane and the shuffles for the distance. So auto, still accepted, stays
+// planar at every resolution.
+enum ccdLayout {
+    ccdLayoutAuto = -1,
+    ccdLayoutPlanar = 0,
+    ccdLayoutPacked = 1,
+};
+
+// The packed flavour of the kernel ccdSelectKernel picks for opt, or nullptr if there is none,
+// which is the case for the C and SVE kernels.
+ccdKernelFunc ccdSelectPackedKernel(int opt);
+
+// The fast kernels test the samples of every 2x2 pixels just once, on a copy of the frame at half
+// resolution where each pixel is the average of the four, with the offsets of the window halved,
+// and then average the samples that pass at full resolution for each of the four. That leaves a
+// quarter of the distances to compute. They need an even radius and step.
+void ccdKernelFastC(CCD_KERNEL_ARGS);
+
+#if defined(CCD_X86)
+void ccdKernelFastSSE2(CCD_KERNEL_ARGS);
+void ccdKernelFastAVX2(CCD_KERNEL_ARGS);
+void ccdKernelFastAVX512(CCD_KERNEL_ARGS);
+#elif defined(CCD_ARM64)
+void ccdKernelFastNEON(CCD_KERNEL_ARGS);
+#endif
+
+// The fast flavour of the kernel ccdSelectKernel picks for opt. There is no SVE one, opt=6 gets
+// the NEON one.
+ccdKernelFunc ccdSelectFastKernel(int opt);
+
+// Whether the fast kernels can handle the window, error is set if not.
+bool ccdCheckFastWindow(int radius, int step, const char **error);
+
+// The multi kernels denoise the frame with several thresholds at once, for comparing them side by
+// side. Every sample is loaded and its distance computed once, and compared against each
+// threshold, which keeps sums of its own. params is as for ccdKernelC, except that params.dst is
+// unused and params.threshold has to be the lowest of thresholds, which is what
+// ccdClassifyBlocks goes by: every sample of a block that passes it passes the others too. dst[t]
+// are the planes of the output for thresholds[t], with the stride of params.dst.
+static const int CCD_MAX_THRESHOLDS = 8;
+
+struct ccdMultiKernelParams {
+    ccdKernelParams params;
+    int count;
+    float thresholds[CCD_MAX_THRESHOLDS];
+    float *dst[CCD_MAX_THRESHOLDS][3];
+};
+
+typedef void (*ccdMultiKernelFunc)(const ccdMultiKernelParams &multi, int x0, int y0, int x1, int y1);
+
+#define CCD_MULTI_KERNEL_ARGS const ccdMultiKernelParams &multi, int x0, int y0, int x1, int y1
+
+void ccdKernelMultiC(CCD_MULTI_KERNEL_ARGS);
+
+#if defined(CCD_X86)
+void ccdKernelMultiSSE2(CCD_MULTI_KERNEL_ARGS);
+void ccdKernelMultiAVX2(CCD_MULTI_KERNEL_ARGS);
+void ccdKernelMultiAVX512(CCD_MULTI_KERNEL_ARGS);
+#elif defined(CCD_ARM64)
+void ccdKernelMultiNEON(CCD_MULTI_KERNEL_ARGS);
+#endif
+
+// The multi flavour of the kernel ccdSelectKernel picks for opt. There is no SVE one, opt=6 gets
+// the NEON one.
+ccdMultiKernelFunc ccdSelectMultiKernel(int opt);
+
+// The half resolution copy has the size of the frame rounded up, the last column and row of odd
+// sized frames only average the two pixels there are. The stride is in floats, rows start on a 64
+// byte boundary like in the packed copy.
+static inline int ccdHalfSize(int size) {
+    return (size + 1) / 2;
+}
+
+static inline ptrdiff_t ccdHalfStride(int width) {
+    return (static_cast<ptrdiff_t>(ccdHalfSize(width)) + 15) & ~static_cast<ptrdiff_t>(15);
+}
+
+// Bytes of the half resolution copy of a frame and its ref_count refs.
+static inline size_t ccdHalfBufferSize(int width, int height, int ref_count) {
+    return 3 * (ref_count + 1) * ccdHalfStride(width) * ccdHalfSize(height) * sizeof(float);
+}
+
+// Splits buffer, which holds ccdHalfBufferSize bytes, into the planes of ccdKernelParams::half.
+static inline void ccdHalfPlanes(float *buffer, int width, int height, int ref_count, float **planes) {
+    for (int plane = 0; plane < 3 * (ref_count + 1); plane++)
+        planes[plane] = buffer + ccdHalfStride(width) * ccdHalfSize(height) * plane;
+}
+
+// The packed layout stores every pixel as R, G, B and a padding float, so one 16 byte load gets
+// the whole pixel and a vector of V::width floats holds V::width / 4 neighbouring pixels. Every
+// sample is a single aligned load instead of one unaligned load per plane. The stride is in
+// floats and a multiple of 16, so every row starts on a 64 byte boundary.
+static inline ptrdiff_t ccdPackedStride(int width) {
+    return (static_cast<ptrdiff_t>(width) * 4 + 15) & ~static_cast<ptrdiff_t>(15);
+}
+
+// Interleaves the rows [y0, y1) of the source planes into packed.
+void ccdPackRGB(const ccdKernelParams &params, float *packed, int y0, int y1);
+
+// Fills the rows [y0, y1) of the half resolution planes of src and refs, which are in half with
+// the stride ccdHalfStride(params.width).
+void ccdHalveRGB(const ccdKernelParams &params, float *const *half, int y0, int y1);
+
+// The frame is processed in bands of rows, and each band in column tiles. A tile is only as
+// wide as it takes for the 2 * radius + 1 source rows it needs around the current output row, in
+// each of the frames it samples, to stay in L2, and a multiple of 64 pixels so every vector width
+// stays aligned. Frames narrow enough for that are processed one full row at a time, as splitting
+// them only costs time.
+static const int CCD_BAND_HEIGHT = 128;
+
+// The bands ccdProcessPasses interleaves, small enough for a few of them to stay in cache.
+static const int CCD_PASS_BAND_HEIGHT = 32;
+
+int ccdTileWidth(int width, int radius, int cache_size, int sample_size = sizeof(float), int frames = 1);
+
+class ccdThreadPool;
+
+// A rectangle of the frame, the pixels [left, right) x [top, bottom).
+struct ccdRect {
+    int left;
+    int top;
+    int right;
+    int bottom;
+};
+
+static inline ccdRect ccdFrameRect(int width, int height) {
+    return {0, 0, width, height};
+}
+
+// The rectangle pass computes out of passes that each read the output of the one before, for the
+// last one to cover rect. Every pass before it needs radius more pixels on each side, up to the
+// edges of the frame, which are reflected within what the pass before computed anyway.
+ccdRect ccdPassRect(const ccdRect &rect, int pass, int passes, int radius, int width, int height);
+
+// Runs the kernel over rect, one band of rows at a time and one column tile at a time within
+// each band, sampling from the whole frame. With more than one thread, the tiles are shared
+// between the calling thread and up to threads - 1 workers of the pool, and the bands get shorter
+// so there's enough of them.
+void ccdProcessFrame(ccdKernelFunc kernel, const ccdKernelParams &params, const ccdRect &rect,
+                     ccdThreadPool *pool = nullptr, int threads = 1);
+void ccdProcessFrame(ccdHalfKernelFunc kernel, const ccdHalfKernelParams &params, const ccdRect &rect,
+                     ccdThreadPool *pool = nullptr, int threads = 1);
+void ccdProcessFrame(ccdIntKernelFunc kernel, const ccdIntKernelParams &params, int sample_size,
+                     const ccdRect &rect, ccdThreadPool *pool = nullptr, int threads = 1);
+
+// The tiling of ccdProcessFrame for passes that do more than run a kernel, run(x0, y0, x1, y1)
+// does one tile. sample_size is the size of the source samples in bytes, frames the number of
+// source frames.
+void ccdProcessTiles(const ccdRect &rect, int radius, int sample_size, int frames, ccdThreadPool *pool,
+                     int threads, const std::function<void(int, int, int, int)> &run);
+
+// Runs passes of a kernel that each read the output of the pass before, run(pass, x0, y0, x1, y1)
+// does one tile of one pass. On a single thread the passes are interleaved a band of rows at a
+// time, every pass trailing the one before by just enough bands for the rows it samples to be
+// done, so each pass reads rows the one before has just written while they're still in cache.
+// Every pass but the first can write to the buffer the pass two before read, the lag keeps it
+// clear of the rows that one still needs. With more threads, or a single pass, the passes run one
+// after the other, each spread over the pool like ccdProcessTiles. frames is for the first pass, the others
+// sample a single frame. The last pass covers rect of the width x height frame, the others what
+// ccdPassRect says.
+void ccdProcessPasses(const ccdRect &rect, int width, int height, int radius, int sample_size, int frames,
+                      int passes, ccdThreadPool *pool, int threads,
+                      const std::function<void(int, int, int, int, int)> &run);
+
+// Splits the rows of the frame into about four bands per thread for the passes that only touch
+// each row once, run(y0, y1) does the rows [y0, y1).
+void ccdProcessBands(int height, ccdThreadPool *pool, int threads,
+                     const std::function<void(int, int)> &run);
+
+// Fills the packed copy of the frame for the packed kernels, in bands shared the same way.
+void ccdPackFrame(const ccdKernelParams &params, float *packed,
+                  ccdThreadPool *pool = nullptr, int threads = 1);
+
+// Fills the half resolution copy of the frame and its refs for the fast kernels the same way,
+// only the rows the fast kernels sample for rect.
+void ccdHalveFrame(const ccdKernelParams &params, float *const *half, const ccdRect &rect,
+                   ccdThreadPool *pool = nullptr, int threads = 1);
+
+// Runs the single precision kernel over rect of a half float frame, converting it to and from
+// float copies of the planes, which have to be allocated with the given stride. src has the
+// planes of params.refs after the three of params.src. Only the rows rect samples are converted
+// to float, and only rect itself back.
+void ccdProcessHalfFrame(ccdKernelFunc kernel, const ccdHalfKernelParams &params, const ccdRect &rect,
+                         float *const *src, float *const *dst, ptrdiff_t stride,
+                         ccdThreadPool *pool = nullptr, int threads = 1);
+
+// Classifies the blocks of the frame in params and its refs into map, see ccdBlockKind, in
+// buffer, which has to hold ccdBlockMapSize bytes and be 64 byte aligned. This reads every sample
+// once, which is cheap next to the kernel. Returns false, leaving map alone, when the threshold
+// is too low for any block to be averaged without the test.
+bool ccdClassifyBlocks(const ccdKernelParams &params, void *buffer, ccdBlockMap *map,
+                       ccdThreadPool *pool = nullptr, int threads = 1);
+bool ccdClassifyBlocks(const ccdHalfKernelParams &params, void *buffer, ccdBlockMap *map,
+                       ccdThreadPool *pool = nullptr, int threads = 1);
+bool ccdClassifyBlocks(const ccdIntKernelParams &params, int sample_size, void *buffer, ccdBlockMap *map,
+                       ccdThreadPool *pool = nullptr, int threads = 1);
+
+// The same for the rows from top to bottom alone, for frames with nothing else in them yet. top
+// has to be on a block boundary and bottom too or at the height. The blocks outside are
+// ccdBlockSkip, and the ones at the edges of the rows only go by the samples within them.
+bool ccdClassifyBlocks(const ccdKernelParams &params, int top, int bottom, void *buffer, ccdBlockMap *map,
+                       ccdThreadPool *pool = nullptr, int threads = 1);
+
+// A map in buffer, of ccdBlockMapSize bytes, with every block of the frame the same kind, for
+// when the threshold alone already decides it, without reading the frame. kind can't be
+// ccdBlockFlat, which needs the samples.
+void ccdFillBlocks(int width, int height, int kind, void *buffer, ccdBlockMap *map);
+
+// Whether every sample of rect of the planes, count of them with the same stride in samples, is
+// within [0, 1], and so not NaN. A single read of the samples without any arithmetic, which is
+// what a float threshold above CCD_FLOAT_MAX_DISTANCE needs to fill the map instead of
+// classifying it, and a threshold of 0 to hand on the frame as it is.
+bool ccdUnitRange(const float *const *planes, int count, ptrdiff_t stride, const ccdRect &rect);
+bool ccdUnitRange(const uint16_t *const *planes, int count, ptrdiff_t stride, const ccdRect &rect);
+
+// What the kernels make of rect of the three planes when no sample passes, every pixel its own
+// value clamped to [0, 1] the same way. Strides are in samples.
+void ccdClampPlanes(const float *const *src, ptrdiff_t src_stride, float *const *dst, ptrdiff_t dst_stride,
+                    const ccdRect &rect);
+void ccdClampPlanes(const uint16_t *const *src, ptrdiff_t src_stride, uint16_t *const *dst, ptrdiff_t dst_stride,
+                    const ccdRect &rect);
+
+// Marks the blocks the mask leaves out entirely as ccdBlockSkip in map. With classified, map is
+// the one ccdClassifyBlocks made in buffer, otherwise every other block becomes ccdBlockTest.
+void ccdMaskBlocks(const ccdMask &mask, int width, int height, bool classified, void *buffer, ccdBlockMap *map,
+                   ccdThreadPool *pool = nullptr, int threads = 1);
+
+// Adds the mask, if there is one, to the block maps of the passes over a frame and returns the
+// map of the last pass, nullptr for none. first is the map of the first pass, nullptr or the one
+// ccdClassifyBlocks made as map in buffer. With a single pass the mask goes into that one, with
+// more the passes before the last still need the pixels around the ones the mask keeps, so only
+// the last skips any, by a map of its own in last_buffer, which then has to hold ccdBlockMapSize
+// bytes too.
+const ccdBlockMap *ccdMaskPasses(const ccdMask *mask, int width, int height, int passes,
+                                 const ccdBlockMap **first, void *buffer, ccdBlockMap *map, void *last_buffer,
+                                 ccdBlockMap *last_map, ccdThreadPool *pool = nullptr, int threads = 1);
+
+// Copies the pixels of the src planes the mask leaves out over dst, which is what makes up for
+// the skipped blocks, and for the pixels of the others the kernels computed anyway. Strides are
+// in bytes, samples sample_size bytes each.
+void ccdApplyMask(const ccdMask &mask, int planes, const uint8_t *const *src, ptrdiff_t src_stride,
+                  uint8_t *const *dst, ptrdiff_t dst_stride, int width, int height, int sample_size,
+                  ccdThreadPool *pool = nullptr, int threads = 1);
+
+// The window as template arguments, so the loops over the samples are fully unrolled, see
+// CCD_WITH_WINDOW for the ones that get this.
+template <int Radius, int Step>
+struct ccdFixedWindow {
+    const double *reciprocals;
+
+    explicit ccdFixedWindow(const ccdWindow &window) : reciprocals(window.reciprocals.data()) {}
+    int radius() const { return Radius; }
+    int step() const { return Step; }
+    int taps() const { return 2 * Radius / Step + 1; }
+};
+
+// Any other window, with the same interface.
+struct ccdDynamicWindow {
+    const double *reciprocals;
+    int radius_, step_, taps_;
+
+    explicit ccdDynamicWindow(const ccdWindow &window)
+        : reciprocals(window.reciprocals.data()), radius_(window.radius), step_(window.step),
+          taps_(window.taps) {}
+    int radius() const { return radius_; }
+    int step() const { return step_; }
+    int taps() const { return taps_; }
+};
+
+// Declares name as the W for window and runs the rest of the arguments with it. The default
+// 4x4 window, 3x3 and 5x5 with the same radius, 3x3 with radius 8 and the dense 25x25 window are
+// specialised, every other window goes through ccdDynamicWindow.
+#define CCD_WITH_WINDOW(window, name, ...)                                           \
+    do {                                                                             \
+        const ccdWindow &ccd_window_ = (window);                                     \
+        if (ccd_window_.radius == 12 && ccd_window_.step == 8) {                     \
+            ccdFixedWindow<12, 8> name(ccd_window_);                                 \
+            __VA_ARGS__;                                                             \
+        } else if (ccd_window_.radius == 12 && ccd_window_.step == 12) {             \
+            ccdFixedWindow<12, 12> name(ccd_window_);                                \
+            __VA_ARGS__;                                                             \
+        } else if (ccd_window_.radius == 12 && ccd_window_.step == 6) {              \
+            ccdFixedWindow<12, 6> name(ccd_window_);                                 \
+            __VA_ARGS__;                                                             \
+        } else if (ccd_window_.radius == 8 && ccd_window_.step == 8) {               \
+            ccdFixedWindow<8, 8> name(ccd_window_);                                  \
+            __VA_ARGS__;                                                             \
+        } else if (ccd_window_.radius == 12 && ccd_window_.step == 1) {              \
+            ccdFixedWindow<12, 1> name(ccd_window_);                                 \
+            __VA_ARGS__;                                                             \
+        } else {                                                                     \
+            ccdDynamicWindow name(ccd_window_);                                      \
+            __VA_ARGS__;                                                             \
+        }                                                                            \
+    } while (0)
+
+// Mirrors an out of bounds coordinate back into the frame. The radius can be larger than the
+// frame, so an offset can go past the opposite edge after the first reflection, hence the loop.
+static inline int ccdReflect(int c, int size) {
+    for (;;) {
+        if (c < 0)
+            c = -c;
+        else if (c >= size)
+            c = 2 * (size - 1) - c;
+        else
+            return c;
+    }
+}
+
+// Offsets of the sampled rows around y, already reflected and multiplied by the stride.
+// This only costs a lookup per sampled row, so it's done on the fly.
+template <typename W>
+static inline void ccdSampleRows(const W &w, int y, int height, ptrdiff_t stride, ptrdiff_t *rows) {
+    for (int k = 0; k < w.taps(); k++)
+        rows[k] = ccdReflect(y - w.radius() + w.step() * k, height) * stride;
+}
+
+// Reflected sample columns for the radius pixels on either side of the frame, which are the only
+// ones that need mirroring. Columns in [radius, width - radius) are just x - radius + step * l.
+struct ccdBorderColumns {
+    std::vector<int> left;  // radius x taps
+    std::vector<int> right;
+
+    ccdBorderColumns(const ccdWindow &window, int width)
+        : left(window.radius * window.taps), right(window.radius * window.taps),
+          radius(window.radius), taps(window.taps), right_start(width - window.radius) {
+        for (int x = 0; x < radius; x++) {
+            for (int k = 0; k < taps; k++) {
+                left[x * taps + k] = ccdReflect(x - radius + window.step * k, width);
+                right[x * taps + k] = ccdReflect(right_start + x - radius + window.step * k, width);
+            }
+        }
+    }
+
+    // only valid for columns outside of the interior
+    const int *at(int x) const {
+        return x < radius ? &left[x * taps] : &right[(x - right_start) * taps];
+    }
+
+    int radius;
+    int taps;
+    int right_start;
+};
+
+// Half floats are converted in software for the frame borders and by ccdProcessHalfFrame, with
+// the same round to nearest even as F16C and NEON.
+static inline float ccdHalfToFloat(uint16_t h) {
+    // moving the exponent and mantissa into place and scaling by 2^(127 - 15) also gets the
+    // subnormals right, only inf and nan need their exponent fixed up
+    const uint32_t magic_bits = (254u - 15u) << 23;
+    uint32_t o = (h & 0x7fffu) << 13;
+    float f, magic;
+
+    memcpy(&f, &o, sizeof(f));
+    memcpy(&magic, &magic_bits, sizeof(magic));
+    f *= magic;
+    memcpy(&o, &f, sizeof(o));
+    if (o >= (143u << 23))
+        o |= 255u << 23;
+
+    o |= static_cast<uint32_t>(h & 0x8000u) << 16;
+    memcpy(&f, &o, sizeof(f));
+    return f;
+}
+
+static inline uint16_t ccdFloatToHalf(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000u);
+    x &= 0x7fffffffu;
+
+    if (x >= (143u << 23)) // too large, inf or nan
+        return sign | (x > (255u << 23) ? 0x7e00 : 0x7c00);
+
+    if (x < (113u << 23)) {
+        // subnormal or zero, adding 0.5 lets the FPU do the rounding
+        const uint32_t denorm_bits = 126u << 23;
+        float t, denorm;
+        memcpy(&t, &x, sizeof(t));
+        memcpy(&denorm, &denorm_bits, sizeof(denorm));
+        t += denorm;
+        memcpy(&x, &t, sizeof(x));
+        return sign | static_cast<uint16_t>(x - denorm_bits);
+    }
+
+    uint32_t odd = (x >> 13) & 1;
+    x += (static_cast<uint32_t>(15 - 127) << 23) + 0xfff + odd;
+    return sign | static_cast<uint16_t>(x >> 13);
+}
+
+static inline float ccdSampleToFloat(float v) { return v; }
+static inline float ccdSampleToFloat(uint16_t v) { return ccdHalfToFloat(v); }
+static inline void ccdStoreSample(float *p, float v) { *p = v; }
+static inline void ccdStoreSample(uint16_t *p, float v) { *p = ccdFloatToHalf(v); }
+
+// One output pixel of the reference algorithm, sampling the given rows and columns of src and
+// of the ref_count frames in refs (see ccdKernelParams).
+// This is static so the SIMD translation units, which are built with different compiler flags,
+// each get their own copy for the frame borders. T is float, or uint16_t for half floats.
+// Without Test every sample is averaged, for the blocks where they would all pass anyway.
+template <bool Test = true, typename T, typename W>
+static inline void ccdPixelC(const W &w, const T *const *src, const T *const *refs, int ref_count,
+                             T *const *dst, const ptrdiff_t *rows, const int *cols,
+                             ptrdiff_t i, ptrdiff_t o, float threshold) {
+    float r = ccdSampleToFloat(src[0][i]);
+    float g = ccdSampleToFloat(src[1][i]);
+    float b = ccdSampleToFloat(src[2][i]);
+    float total_r = r, total_g = g, total_b = b;
+    int n = 0;
+
+    for (int f = 0; f <= ref_count; f++) {
+        const T *const *frame = f ? refs + 3 * (f - 1) : src;
+
+        for (int k = 0; k < w.taps(); k++) {
+            for (int l = 0; l < w.taps(); l++) {
+                ptrdiff_t j = rows[k] + cols[l];
+
+                float comp_r = ccdSampleToFloat(frame[0][j]);
+                float comp_g = ccdSampleToFloat(frame[1][j]);
+                float comp_b = ccdSampleToFloat(frame[2][j]);
+
+                float diff_r = comp_r - r;
+                float diff_g = comp_g - g;
+                float diff_b = comp_b - b;
+
+#define SQUARE(x) ((x) * (x))
+                if (!Test || threshold > (SQUARE(diff_r) + SQUARE(diff_g) + SQUARE(diff_b))) {
+                    total_r += comp_r;
+                    total_b += comp_b;
+                    total_g += comp_g;
+                    n++;
+                }
+#undef SQUARE
+            }
+        }
+    }
+
+    double multiplier = w.reciprocals[n];
+
+    float calculated_r = total_r * multiplier;
+    float calculated_g = total_g * multiplier;
+    float calculated_b = total_b * multiplier;
+
+    if (calculated_r < 0)
+        calculated_r = 0;
+    else if (calculated_r > 1)
+        calculated_r = 1;
+
+    if (calculated_g < 0)
+        calculated_g = 0;
+    else if (calculated_g > 1)
+        calculated_g = 1;
+
+    if (calculated_b < 0)
+        calculated_b = 0;
+    else if (calculated_b > 1)
+        calculated_b = 1;
+
+    ccdStoreSample(dst[0] + o, calculated_r);
+    ccdStoreSample(dst[1] + o, calculated_g);
+    ccdStoreSample(dst[2] + o, calculated_b);
+}
+
+// ccdPixelC for the pixel (x, y), testing the samples only where the block map says so.
+// P is ccdKernelParams or ccdHalfKernelParams, W a ccdFixedWindow or ccdDynamicWindow.
+template <typename P, typename W>
+static inline void ccdPixelBlockC(const P &params, const W &w, const ptrdiff_t *rows, const int *cols,
+                                  int x, int y) {
+    switch (ccdBlockKindAt(params.blocks, x, y)) {
+    case ccdBlockSkip:
+        break;
+    case ccdBlockTest:
+        ccdPixelC(w, params.src, params.refs, params.ref_count, params.dst, rows, cols,
+                  y * params.src_stride + x, y * params.dst_stride + x, params.threshold);
+        break;
+    default:
+        ccdPixelC<false>(w, params.src, params.refs, params.ref_count, params.dst, rows, cols,
+                         y * params.src_stride + x, y * params.dst_stride + x, params.threshold);
+    }
+}
+
+// Runs ccdPixelC over the columns [x0, x1) of row y, which must not need any reflection.
+template <typename P, typename W>
+static inline void ccdInteriorC(const P &params, const W &w, const ptrdiff_t *rows,
+                                int y, int x0, int x1) {
+    for (int x = x0; x < x1; x++) {
+        int cols[CCD_MAX_TAPS];
+        for (int l = 0; l < w.taps(); l++)
+            cols[l] = x - w.radius() + w.step() * l;
+        ccdPixelBlockC(params, w, rows, cols, x, y);
+    }
+}
+
+// Runs ccdPixelC over the columns [x0, x1) of row y, which have to be border columns.
+template <typename P, typename W>
+static inline void ccdBorderC(const P &params, const W &w, const ptrdiff_t *rows,
+                              const ccdBorderColumns &border, int y, int x0, int x1) {
+    for (int x = x0; x < x1; x++)
+        ccdPixelBlockC(params, w, rows, border.at(x), x, y);
+}
+
+// Where the border and interior parts of the columns [x0, x1) start and end.
+struct ccdRowSplit {
+    int left_end;       // [x0, left_end) is the left border
+    int interior_start; // [interior_start, interior_end) needs no reflection
+    int interior_end;
+    int right_start;    // [right_start, x1) is the right border
+
+    ccdRowSplit(const ccdBorderColumns &border, int x0, int x1) {
+        int radius = border.radius;
+        int frame_right = border.right_start > radius ? border.right_start : radius;
+        left_end = x1 < radius ? x1 : radius;
+        interior_start = x0 > radius ? x0 : radius;
+        interior_end = x1 < frame_right ? x1 : frame_right;
+        if (interior_end < interior_start)
+            interior_end = interior_start;
+        right_start = x0 > frame_right ? x0 : frame_right;
+        if (right_start < interior_end)
+            right_start = interior_end;
+    }
+};
+
+// The columns [x0, x1) of row y with the scalar kernel.
+template <typename P, typename W>
+static inline void ccdRowC(const P &params, const W &w, const ptrdiff_t *rows,
+                           const ccdBorderColumns &border, int y, int x0, int x1) {
+    ccdRowSplit split(border, x0, x1);
+
+    ccdBorderC(params, w, rows, border, y, x0, split.left_end);
+    ccdInteriorC(params, w, rows, y, split.interior_start, split.interior_end);
+    ccdBorderC(params, w, rows, border, y, split.right_start, x1);
+}
+
+// ccdPixelC for every threshold of multi at once, for the pixel (x, y) by the block map. The
+// blocks that don't need the test for the lowest threshold don't for any, so they're averaged
+// once and copied to every output.
+template <typename W>
+static inline void ccdPixelMultiC(const ccdMultiKernelParams &multi, const W &w, const ptrdiff_t *rows,
+                                  const int *cols, int x, int y) {
+    const ccdKernelParams &params = multi.params;
+    ptrdiff_t i = y * params.src_stride + x, o = y * params.dst_stride + x;
+
+    switch (ccdBlockKindAt(params.blocks, x, y)) {
+    case ccdBlockSkip:
+        return;
+    case ccdBlockTest:
+        break;
+    default:
+        ccdPixelC<false>(w, params.src, params.refs, params.ref_count, multi.dst[0], rows, cols, i, o,
+                         params.threshold);
+        for (int t = 1; t < multi.count; t++)
+            for (int plane = 0; plane < 3; plane++)
+                multi.dst[t][plane][o] = multi.dst[0][plane][o];
+        return;
+    }
+
+    float r = params.src[0][i], g = params.src[1][i], b = params.src[2][i];
+    float total_r[CCD_MAX_THRESHOLDS], total_g[CCD_MAX_THRESHOLDS], total_b[CCD_MAX_THRESHOLDS];
+    int n[CCD_MAX_THRESHOLDS];
+    for (int t = 0; t < multi.count; t++) {
+        total_r[t] = r;
+        total_g[t] = g;
+        total_b[t] = b;
+        n[t] = 0;
+    }
+
+    for (int f = 0; f <= params.ref_count; f++) {
+        const float *const *frame = f ? params.refs + 3 * (f - 1) : params.src;
+
+        for (int k = 0; k < w.taps(); k++) {
+            for (int l = 0; l < w.taps(); l++) {
+                ptrdiff_t j = rows[k] + cols[l];
+
+                float comp_r = frame[0][j], comp_g = frame[1][j], comp_b = frame[2][j];
+                float diff_r = comp_r - r, diff_g = comp_g - g, diff_b = comp_b - b;
+                float dist = diff_r * diff_r + diff_g * diff_g + diff_b * diff_b;
+
+                for (int t = 0; t < multi.count; t++) {
+                    if (multi.thresholds[t] > dist) {
+                        total_r[t] += comp_r;
+                        total_g[t] += comp_g;
+                        total_b[t] += comp_b;
+                        n[t]++;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int t = 0; t < multi.count; t++) {
+        double multiplier = w.reciprocals[n[t]];
+        multi.dst[t][0][o] = std::min(std::max(static_cast<float>(total_r[t] * multiplier), 0.0f), 1.0f);
+        multi.dst[t][1][o] = std::min(std::max(static_cast<float>(total_g[t] * multiplier), 0.0f), 1.0f);
+        multi.dst[t][2][o] = std::min(std::max(static_cast<float>(total_b[t] * multiplier), 0.0f), 1.0f);
+    }
+}
+
+// The columns [x0, x1) of row y with ccdPixelMultiC.
+template <typename W>
+static inline void ccdRowMultiC(const ccdMultiKernelParams &multi, const W &w, const ptrdiff_t *rows,
+                                const ccdBorderColumns &border, int y, int x0, int x1) {
+    ccdRowSplit split(border, x0, x1);
+
+    for (int x = x0; x < split.left_end; x++)
+        ccdPixelMultiC(multi, w, rows, border.at(x), x, y);
+    for (int x = split.interior_start; x < split.interior_end; x++) {
+        int cols[CCD_MAX_TAPS];
+        for (int l = 0; l < w.taps(); l++)
+            cols[l] = x - w.radius() + w.step() * l;
+        ccdPixelMultiC(multi, w, rows, cols, x, y);
+    }
+    for (int x = split.right_start; x < x1; x++)
+        ccdPixelMultiC(multi, w, rows, border.at(x), x, y);
+}
+
+// The window of W with its offsets halved, for sampling the half resolution copy of the fast
+// kernels.
+template <typename W>
+struct ccdHalvedWindow {
+    const W &w;
+
+    explicit ccdHalvedWindow(const W &window) : w(window) {}
+    int radius() const { return w.radius() / 2; }
+    int step() const { return w.step() / 2; }
+    int taps() const { return w.taps(); }
+};
+
+// One output pixel of the fast kernels (see ccdKernelFastC), with the rows and columns of the
+// samples at full resolution as in ccdPixelC and half_rows and half_cols the same at half
+// resolution, for the 2x2 pixels (x, y) is in.
+template <typename W>
+static inline void ccdPixelFastC(const ccdKernelParams &params, const W &w, const ptrdiff_t *rows,
+                                 const int *cols, const ptrdiff_t *half_rows, const int *half_cols, int x, int y) {
+    ptrdiff_t i = y * params.src_stride + x, o = y * params.dst_stride + x;
+    ptrdiff_t h = (y / 2) * params.half_stride + x / 2;
+
+    float r = params.half[0][h], g = params.half[1][h], b = params.half[2][h];
+    float total_r = params.src[0][i], total_g = params.src[1][i], total_b = params.src[2][i];
+    int n = 0;
+
+    for (int f = 0; f <= params.ref_count; f++) {
+        const float *const *frame = f ? params.refs + 3 * (f - 1) : params.src;
+        const float *const *half = params.half + 3 * f;
+
+        for (int k = 0; k < w.taps(); k++) {
+            for (int l = 0; l < w.taps(); l++) {
+                ptrdiff_t j = half_rows[k] + half_cols[l];
+
+                float diff_r = half[0][j] - r;
+                float diff_g = half[1][j] - g;
+                float diff_b = half[2][j] - b;
+
+                if (params.threshold > diff_r * diff_r + diff_g * diff_g + diff_b * diff_b) {
+                    ptrdiff_t c = rows[k] + cols[l];
+                    total_r += frame[0][c];
+                    total_g += frame[1][c];
+                    total_b += frame[2][c];
+                    n++;
+                }
+            }
+        }
+    }
+
+    double multiplier = w.reciprocals[n];
+    params.dst[0][o] = std::min(std::max(static_cast<float>(total_r * multiplier), 0.0f), 1.0f);
+    params.dst[1][o] = std::min(std::max(static_cast<float>(total_g * multiplier), 0.0f), 1.0f);
+    params.dst[2][o] = std::min(std::max(static_cast<float>(total_b * multiplier), 0.0f), 1.0f);
+}
+
+// ccdPixelFastC for the pixel (x, y) by the block map, the blocks where every sample passes are
+// averaged as in ccdPixelBlockC, which is exactly what testing them at half resolution would
+// give. half_rows are the rows of the half resolution copy for y.
+template <typename W>
+static inline void ccdPixelFastBlockC(const ccdKernelParams &params, const W &w, const ptrdiff_t *rows,
+                                      const ptrdiff_t *half_rows, int x, int y) {
+    int cols[CCD_MAX_TAPS], half_cols[CCD_MAX_TAPS];
+    for (int l = 0; l < w.taps(); l++)
+        cols[l] = ccdReflect(x - w.radius() + w.step() * l, params.width);
+
+    switch (ccdBlockKindAt(params.blocks, x, y)) {
+    case ccdBlockSkip:
+        break;
+    case ccdBlockTest:
+        for (int l = 0; l < w.taps(); l++)
+            half_cols[l] = ccdReflect(x / 2 - w.radius() / 2 + w.step() / 2 * l, ccdHalfSize(params.width));
+        ccdPixelFastC(params, w, rows, cols, half_rows, half_cols, x, y);
+        break;
+    default:
+        ccdPixelC<false>(w, params.src, params.refs, params.ref_count, params.dst, rows, cols,
+                         y * params.src_stride + x, y * params.dst_stride + x, params.threshold);
+    }
+}
+
+// One output pixel of the integer kernel, the same as ccdPixelC otherwise. The division is
+// done in float and rounded to nearest even, which is exactly what the SIMD kernels do.
+template <bool Test = true, typename T, typename W>
+static inline void ccdPixelInt(const W &w, const T *const *src, const T *const *refs, int ref_count,
+                               T *const *dst, const ptrdiff_t *rows, const int *cols,
+                               ptrdiff_t i, ptrdiff_t o, int threshold, int shift) {
+    int r = src[0][i], g = src[1][i], b = src[2][i];
+    int total_r = r, total_g = g, total_b = b;
+    int n = 0;
+
+    for (int f = 0; f <= ref_count; f++) {
+        const T *const *frame = f ? refs + 3 * (f - 1) : src;
+
+        for (int k = 0; k < w.taps(); k++) {
+            for (int l = 0; l < w.taps(); l++) {
+                ptrdiff_t j = rows[k] + cols[l];
+
+                int comp_r = frame[0][j];
+                int comp_g = frame[1][j];
+                int comp_b = frame[2][j];
+
+                int diff_r = (comp_r > r ? comp_r - r : r - comp_r) >> shift;
+                int diff_g = (comp_g > g ? comp_g - g : g - comp_g) >> shift;
+                int diff_b = (comp_b > b ? comp_b - b : b - comp_b) >> shift;
+
+                if (!Test || threshold > diff_r * diff_r + diff_g * diff_g + diff_b * diff_b) {
+                    total_r += comp_r;
+                    total_g += comp_g;
+                    total_b += comp_b;
+                    n++;
+                }
+            }
+        }
+    }
+
+    float count = static_cast<float>(n + 1);
+
+    dst[0][o] = static_cast<T>(lrintf(static_cast<float>(total_r) / count));
+    dst[1][o] = static_cast<T>(lrintf(static_cast<float>(total_g) / count));
+    dst[2][o] = static_cast<T>(lrintf(static_cast<float>(total_b) / count));
+}
+
+// The planes of params.refs with the sample type, refs has to hold 3 * params.ref_count.
+template <typename T>
+static inline void ccdIntRefs(const ccdIntKernelParams &params, const T **refs) {
+    for (int plane = 0; plane < 3 * params.ref_count; plane++)
+        refs[plane] = static_cast<const T *>(params.refs[plane]);
+}
+
+// ccdPixelInt by the block map. The average of a flat block is exactly its value, even where
+// the float division rounds, so those pixels are just copied.
+template <typename T, typename W>
+static inline void ccdPixelBlockInt(const ccdIntKernelParams &params, const W &w, const T *const *src,
+                                    const T *const *refs, T *const *dst, const ptrdiff_t *rows,
+                                    const int *cols, int x, int y) {
+    ptrdiff_t i = y * params.src_stride + x, o = y * params.dst_stride + x;
+
+    switch (ccdBlockKindAt(params.blocks, x, y)) {
+    case ccdBlockSkip:
+        break;
+    case ccdBlockFlat:
+        for (int plane = 0; plane < 3; plane++)
+            dst[plane][o] = src[plane][i];
+        break;
+    case ccdBlockAverage:
+        ccdPixelInt<false>(w, src, refs, params.ref_count, dst, rows, cols, i, o, params.threshold,
+                           params.shift);
+        break;
+    default:
+        ccdPixelInt(w, src, refs, params.ref_count, dst, rows, cols, i, o, params.threshold, params.shift);
+    }
+}
+
+template <typename T, typename W>
+static inline void ccdInteriorInt(const ccdIntKernelParams &params, const W &w, const ptrdiff_t *rows,
+                                  int y, int x0, int x1) {
+    const T *src[3] = {static_cast<const T *>(params.src[0]), static_cast<const T *>(params.src[1]),
+                       static_cast<const T *>(params.src[2])};
+    T *dst[3] = {static_cast<T *>(params.dst[0]), static_cast<T *>(params.dst[1]),
+                 static_cast<T *>(params.dst[2])};
+    const T *refs[3 * CCD_MAX_REFS];
+    ccdIntRefs(params, refs);
+
+    for (int x = x0; x < x1; x++) {
+        int cols[CCD_MAX_TAPS];
+        for (int l = 0; l < w.taps(); l++)
+            cols[l] = x - w.radius() + w.step() * l;
+        ccdPixelBlockInt(params, w, src, refs, dst, rows, cols, x, y);
+    }
+}
+
+template <typename T, typename W>
+static inline void ccdBorderInt(const ccdIntKernelParams &params, const W &w, const ptrdiff_t *rows,
+                                const ccdBorderColumns &border, int y, int x0, int x1) {
+    const T *src[3] = {static_cast<const T *>(params.src[0]), static_cast<const T *>(params.src[1]),
+                       static_cast<const T *>(params.src[2])};
+    T *dst[3] = {static_cast<T *>(params.dst[0]), static_cast<T *>(params.dst[1]),
+                 static_cast<T *>(params.dst[2])};
+    const T *refs[3 * CCD_MAX_REFS];
+    ccdIntRefs(params, refs);
+
+    for (int x = x0; x < x1; x++)
+        ccdPixelBlockInt(params, w, src, refs, dst, rows, border.at(x), x, y);
+}
+
+template <typename T, typename W>
+static inline void ccdRowInt(const ccdIntKernelParams &params, const W &w, const ptrdiff_t *rows,
+                             const ccdBorderColumns &border, int y, int x0, int x1) {
+    ccdRowSplit split(border, x0, x1);
+
+    ccdBorderInt<T>(params, w, rows, border, y, x0, split.left_end);
+    ccdInteriorInt<T>(params, w, rows, y, split.interior_start, split.interior_end);
+    ccdBorderInt<T>(params, w, rows, border, y, split.right_start, x1);
+}
+
+#endif // CCD_KERNEL_H
@@ -0,0 +1,115 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#include "cpu.h"
+
+#if defined(CCD_X86)
+
+#include <immintrin.h>
+
+#include "kernel_simd.h"
+
+namespace {
+
+struct VecAVX2 {
+    typedef __m256 F;
+    typedef __m256 M;
+    static const int width = 8;
+
+    static F load(const float *p) { return _mm256_load_ps(p); }
+    static void store(float *p, F v) { _mm256_store_ps(p, v); }
+    static F loadu(const float *p) { return _mm256_loadu_ps(p); }
+    static void storeu(float *p, F v) { _mm256_storeu_ps(p, v); }
+    static F set1(float v) { return _mm256_set1_ps(v); }
+    static F zero() { return _mm256_setzero_ps(); }
+    static F add(F a, F b) { return _mm256_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm256_div_ps(a, b); }
+    static F min(F a, F b) { return _mm256_min_ps(a, b); }
+    static F max(F a, F b) { return _mm256_max_ps(a, b); }
+    static M cmpgt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    template <int K> static F lane(F v) { return _mm256_shuffle_ps(v, v, _MM_SHUFFLE(K, K, K, K)); }
+    static F dup_lo(F v) { return _mm256_permutevar8x32_ps(v, _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3)); }
+    static F dup_hi(F v) { return _mm256_permutevar8x32_ps(v, _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7)); }
+    static F loadh(const uint16_t *p) { return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))); }
+    static void storeh(uint16_t *p, F v) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+    static F mask_add(F acc, M m, F v) { return _mm256_add_ps(acc, _mm256_and_ps(m, v)); }
+};
+
+struct IntAVX2 {
+    typedef __m256i X;
+    typedef __m256i M;
+    typedef __m128i S;
+    static const int width = 8;
+
+    static X load(const uint8_t *p) { return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p))); }
+    static X load(const uint16_t *p) { return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))); }
+    static __m128i narrow(X v) {
+        return _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    }
+    static void store(uint8_t *p, X v) {
+        __m128i w = narrow(v);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(p), _mm_packus_epi16(w, w));
+    }
+    static void store(uint16_t *p, X v) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), narrow(v)); }
+    static X set1(int v) { return _mm256_set1_epi32(v); }
+    static X zero() { return _mm256_setzero_si256(); }
+    static X add(X a, X b) { return _mm256_add_epi32(a, b); }
+    static X absdiff(X a, X b) { return _mm256_abs_epi32(_mm256_sub_epi32(a, b)); }
+    static S shift(int n) { return _mm_cvtsi32_si128(n); }
+    static X shr(X v, S s) { return _mm256_srl_epi32(v, s); }
+    // cheaper than vpmulld, see IntSSE2
+    static X sqr(X v) { return _mm256_madd_epi16(v, v); }
+    static M cmpgt(X a, X b) { return _mm256_cmpgt_epi32(a, b); }
+    static X mask_add(X acc, M m, X v) { return _mm256_add_epi32(acc, _mm256_and_si256(m, v)); }
+    static X divround(X a, X b) {
+        return _mm256_cvtps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(a), _mm256_cvtepi32_ps(b)));
+    }
+};
+
+} // namespace
+
+void ccdKernelAVX2(CCD_KERNEL_ARGS) {
+    ccdKernelSimd<VecAVX2>(params, x0, y0, x1, y1);
+    _mm256_zeroupper();
+}
+
+void ccdKernelPackedAVX2(CCD_KERNEL_ARGS) {
+    ccdKernelPackedSimd<VecAVX2>(params, x0, y0, x1, y1);
+    _mm256_zeroupper();
+}
+
+void ccdKernelFastAVX2(CCD_KERNEL_ARGS) {
+    ccdKernelFastSimd<VecAVX2>(params, x0, y0, x1, y1);
+    _mm256_zeroupper();
+}
+
+void ccdKernelHalfAVX2(CCD_HALF_KERNEL_ARGS) {
+    ccdKernelHalfSimd<VecAVX2>(params, x0, y0, x1, y1);
+    _mm256_zeroupper();
+}
+
+void ccdKernel8AVX2(CCD_INT_KERNEL_ARGS) {
+    ccdKernelIntSimd<IntAVX2, uint8_t>(params, x0, y0, x1, y1);
+    _mm256_zeroupper();
+}
+
+void ccdKernel16AVX2(CCD_INT_KERNEL_ARGS) {
+    ccdKernelIntSimd<IntAVX2, uint16_t>(params, x0, y0, x1, y1);
+    _mm256_zeroupper();
+}
+
+void ccdKernelMultiAVX2(CCD_MULTI_KERNEL_ARGS) {
+    ccdKernelMultiSimd<VecAVX2>(multi, x0, y0, x1, y1);
+    _mm256_zeroupper();
+}
+
+#endif
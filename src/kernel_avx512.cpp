@@ -0,0 +1,120 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#include "cpu.h"
+
+#if defined(CCD_X86)
+
+// GCC 12 takes the deliberately uninitialised _mm512_undefined_*() in its own intrinsics for a bug
+// once enough of them are inlined into one function, as one or the other depending on how sure it is
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+
+#include "kernel_simd.h"
+
+namespace {
+
+struct VecAVX512 {
+    typedef __m512 F;
+    typedef __mmask16 M;
+    static const int width = 16;
+
+    static F load(const float *p) { return _mm512_load_ps(p); }
+    static void store(float *p, F v) { _mm512_store_ps(p, v); }
+    static F loadu(const float *p) { return _mm512_loadu_ps(p); }
+    static void storeu(float *p, F v) { _mm512_storeu_ps(p, v); }
+    static F set1(float v) { return _mm512_set1_ps(v); }
+    static F zero() { return _mm512_setzero_ps(); }
+    static F add(F a, F b) { return _mm512_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm512_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm512_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm512_div_ps(a, b); }
+    static F min(F a, F b) { return _mm512_min_ps(a, b); }
+    static F max(F a, F b) { return _mm512_max_ps(a, b); }
+    static M cmpgt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+    template <int K> static F lane(F v) { return _mm512_shuffle_ps(v, v, _MM_SHUFFLE(K, K, K, K)); }
+    static F dup_lo(F v) {
+        return _mm512_permutexvar_ps(_mm512_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7), v);
+    }
+    static F dup_hi(F v) {
+        return _mm512_permutexvar_ps(_mm512_setr_epi32(8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15), v);
+    }
+    static F loadh(const uint16_t *p) { return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))); }
+    static void storeh(uint16_t *p, F v) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), _mm512_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+    }
+    static F mask_add(F acc, M m, F v) { return _mm512_mask_add_ps(acc, m, acc, v); }
+};
+
+struct IntAVX512 {
+    typedef __m512i X;
+    typedef __mmask16 M;
+    typedef __m128i S;
+    static const int width = 16;
+
+    static X load(const uint8_t *p) { return _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))); }
+    static X load(const uint16_t *p) { return _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))); }
+    static void store(uint8_t *p, X v) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm512_cvtusepi32_epi8(v)); }
+    static void store(uint16_t *p, X v) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), _mm512_cvtusepi32_epi16(v)); }
+    static X set1(int v) { return _mm512_set1_epi32(v); }
+    static X zero() { return _mm512_setzero_si512(); }
+    static X add(X a, X b) { return _mm512_add_epi32(a, b); }
+    static X absdiff(X a, X b) { return _mm512_abs_epi32(_mm512_sub_epi32(a, b)); }
+    static S shift(int n) { return _mm_cvtsi32_si128(n); }
+    static X shr(X v, S s) { return _mm512_srl_epi32(v, s); }
+    // vpmaddwd on zmm needs AVX-512BW
+    static X sqr(X v) { return _mm512_mullo_epi32(v, v); }
+    static M cmpgt(X a, X b) { return _mm512_cmpgt_epi32_mask(a, b); }
+    static X mask_add(X acc, M m, X v) { return _mm512_mask_add_epi32(acc, m, acc, v); }
+    static X divround(X a, X b) {
+        return _mm512_cvtps_epi32(_mm512_div_ps(_mm512_cvtepi32_ps(a), _mm512_cvtepi32_ps(b)));
+    }
+};
+
+} // namespace
+
+void ccdKernelAVX512(CCD_KERNEL_ARGS) {
+    ccdKernelSimd<VecAVX512>(params, x0, y0, x1, y1);
+    _mm256_zeroupper();
+}
+
+void ccdKernelPackedAVX512(CCD_KERNEL_ARGS) {
+    ccdKernelPackedSimd<VecAVX512>(params, x0, y0, x1, y1);
+    _mm256_zeroupper();
+}
+
+void ccdKernelFastAVX512(CCD_KERNEL_ARGS) {
+    ccdKernelFastSimd<VecAVX512>(params, x0, y0, x1, y1);
+    _mm256_zeroupper();
+}
+
+void ccdKernelHalfAVX512(CCD_HALF_KERNEL_ARGS) {
+    ccdKernelHalfSimd<VecAVX512>(params, x0, y0, x1, y1);
+    _mm256_zeroupper();
+}
+
+void ccdKernel8AVX512(CCD_INT_KERNEL_ARGS) {
+    ccdKernelIntSimd<IntAVX512, uint8_t>(params, x0, y0, x1, y1);
+    _mm256_zeroupper();
+}
+
+void ccdKernel16AVX512(CCD_INT_KERNEL_ARGS) {
+    ccdKernelIntSimd<IntAVX512, uint16_t>(params, x0, y0, x1, y1);
+    _mm256_zeroupper();
+}
+
+void ccdKernelMultiAVX512(CCD_MULTI_KERNEL_ARGS) {
+    ccdKernelMultiSimd<VecAVX512>(multi, x0, y0, x1, y1);
+    _mm256_zeroupper();
+}
+
+#endif
@@ -0,0 +1,113 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#include "cpu.h"
+
+#if defined(CCD_ARM64)
+
+#include <arm_neon.h>
+
+#include <string.h>
+
+#include "kernel_simd.h"
+
+namespace {
+
+struct VecNEON {
+    typedef float32x4_t F;
+    typedef uint32x4_t M;
+    static const int width = 4;
+
+    // NEON loads and stores don't care about alignment
+    static F load(const float *p) { return vld1q_f32(p); }
+    static void store(float *p, F v) { vst1q_f32(p, v); }
+    static F loadu(const float *p) { return vld1q_f32(p); }
+    static void storeu(float *p, F v) { vst1q_f32(p, v); }
+    static F set1(float v) { return vdupq_n_f32(v); }
+    static F zero() { return vdupq_n_f32(0.0f); }
+    static F add(F a, F b) { return vaddq_f32(a, b); }
+    static F sub(F a, F b) { return vsubq_f32(a, b); }
+    static F mul(F a, F b) { return vmulq_f32(a, b); }
+    static F div(F a, F b) { return vdivq_f32(a, b); }
+    static F min(F a, F b) { return vminq_f32(a, b); }
+    static F max(F a, F b) { return vmaxq_f32(a, b); }
+    static M cmpgt(F a, F b) { return vcgtq_f32(a, b); }
+    template <int K> static F lane(F v) { return vdupq_laneq_f32(v, K); }
+    static F dup_lo(F v) { return vzip1q_f32(v, v); }
+    static F dup_hi(F v) { return vzip2q_f32(v, v); }
+    static F loadh(const uint16_t *p) { return vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(p))); }
+    static void storeh(uint16_t *p, F v) { vst1_u16(p, vreinterpret_u16_f16(vcvt_f16_f32(v))); }
+    static F mask_add(F acc, M m, F v) {
+        return vaddq_f32(acc, vreinterpretq_f32_u32(vandq_u32(m, vreinterpretq_u32_f32(v))));
+    }
+};
+
+struct IntNEON {
+    typedef int32x4_t X;
+    typedef uint32x4_t M;
+    typedef int32x4_t S;
+    static const int width = 4;
+
+    static X load(const uint8_t *p) {
+        // only 4 bytes, an 8 byte load could go past the end of the plane
+        uint32_t t;
+        memcpy(&t, p, sizeof(t));
+        uint16x8_t w = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(t)));
+        return vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(w)));
+    }
+    static X load(const uint16_t *p) { return vreinterpretq_s32_u32(vmovl_u16(vld1_u16(p))); }
+    static void store(uint8_t *p, X v) {
+        uint16x4_t w = vqmovun_s32(v);
+        uint32_t t = vget_lane_u32(vreinterpret_u32_u8(vqmovn_u16(vcombine_u16(w, w))), 0);
+        memcpy(p, &t, sizeof(t));
+    }
+    static void store(uint16_t *p, X v) { vst1_u16(p, vqmovun_s32(v)); }
+    static X set1(int v) { return vdupq_n_s32(v); }
+    static X zero() { return vdupq_n_s32(0); }
+    static X add(X a, X b) { return vaddq_s32(a, b); }
+    static X absdiff(X a, X b) { return vabdq_s32(a, b); }
+    // vshlq with a negative count shifts right
+    static S shift(int n) { return vdupq_n_s32(-n); }
+    static X shr(X v, S s) { return vshlq_s32(v, s); }
+    static X sqr(X v) { return vmulq_s32(v, v); }
+    static M cmpgt(X a, X b) { return vcgtq_s32(a, b); }
+    static X mask_add(X acc, M m, X v) { return vaddq_s32(acc, vandq_s32(vreinterpretq_s32_u32(m), v)); }
+    static X divround(X a, X b) { return vcvtnq_s32_f32(vdivq_f32(vcvtq_f32_s32(a), vcvtq_f32_s32(b))); }
+};
+
+} // namespace
+
+void ccdKernelNEON(CCD_KERNEL_ARGS) {
+    ccdKernelSimd<VecNEON>(params, x0, y0, x1, y1);
+}
+
+void ccdKernelPackedNEON(CCD_KERNEL_ARGS) {
+    ccdKernelPackedSimd<VecNEON>(params, x0, y0, x1, y1);
+}
+
+void ccdKernelFastNEON(CCD_KERNEL_ARGS) {
+    ccdKernelFastSimd<VecNEON>(params, x0, y0, x1, y1);
+}
+
+void ccdKernelHalfNEON(CCD_HALF_KERNEL_ARGS) {
+    ccdKernelHalfSimd<VecNEON>(params, x0, y0, x1, y1);
+}
+
+void ccdKernel8NEON(CCD_INT_KERNEL_ARGS) {
+    ccdKernelIntSimd<IntNEON, uint8_t>(params, x0, y0, x1, y1);
+}
+
+void ccdKernel16NEON(CCD_INT_KERNEL_ARGS) {
+    ccdKernelIntSimd<IntNEON, uint16_t>(params, x0, y0, x1, y1);
+}
+
+void ccdKernelMultiNEON(CCD_MULTI_KERNEL_ARGS) {
+    ccdKernelMultiSimd<VecNEON>(multi, x0, y0, x1, y1);
+}
+
+#endif
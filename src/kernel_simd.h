@@ -0,0 +1,937 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#ifndef CCD_KERNEL_SIMD_H
+#define CCD_KERNEL_SIMD_H
+
+#include <stdint.h>
+
+#include <type_traits>
+#include <vector>
+
+#include "kernel.h"
+
+// The vectorised kernel, written once against a small wrapper around each instruction set.
+// V has to provide:
+//   F, M       - vector of floats and the result of a comparison
+//   width      - number of floats in F
+//   load, store   - aligned to width * sizeof(float)
+//   loadu, storeu, set1, zero, add, sub, mul, div, min, max
+//   cmpgt(a, b) - a > b
+//   mask_add(acc, m, v) - acc + v in the lanes where m is set, acc everywhere else
+//   lane<K>(v)  - element K of every group of four floats, broadcast to the whole group
+//   loadh, storeh - unaligned, converting width half floats from and to single precision, only
+//                 needed by the RGBH kernels
+//   dup_lo(v), dup_hi(v) - the elements of the low or high half of v, each twice in a row, only
+//                 needed by the fast kernels
+//
+// Only this header includes a V, so it has to be included from the translation unit that is
+// built with the matching compiler flags.
+//
+// The mul/add pairs are kept separate and the compiler is told not to contract them (see
+// meson.build), so the squared distance is bit identical to ccdPixelC and the only difference to
+// the reference is the final division, which is done in single precision here. That makes the
+// outputs equal within 1 ulp.
+
+// VapourSynth starts every row on a 32 byte (64 on recent versions) boundary. When that holds for
+// the vector width, the centre pixels and the output go through aligned loads and stores, and so
+// do the neighbours whose horizontal offset is a multiple of the vector width.
+template <typename V, bool Aligned>
+static inline typename V::F ccdLoad(const float *p, int dx) {
+    return (Aligned && dx % V::width == 0) ? V::load(p) : V::loadu(p);
+}
+
+template <typename V, bool Aligned>
+static inline typename V::F ccdLoad(const uint16_t *p, int) {
+    return V::loadh(p);
+}
+
+template <typename V, bool Aligned>
+static inline void ccdStore(float *p, const typename V::F &v) {
+    if (Aligned)
+        V::store(p, v);
+    else
+        V::storeu(p, v);
+}
+
+template <typename V, bool Aligned>
+static inline void ccdStore(uint16_t *p, const typename V::F &v) {
+    V::storeh(p, v);
+}
+
+// T is float, or uint16_t for half floats, W is the window (see CCD_WITH_WINDOW). refs are the
+// other frames of the temporal window and Test is whether the samples are, as in ccdPixelC.
+template <typename V, bool Aligned, bool Test = true, typename T, typename W>
+static inline void ccdVectorRGB(const W &w, const T *const *src, const T *const *refs, int ref_count,
+                                T *const *dst, const ptrdiff_t *rows, ptrdiff_t src_row, ptrdiff_t dst_row,
+                                int x, const typename V::F &threshold) {
+    typedef typename V::F F;
+    typedef typename V::M M;
+
+    F r = ccdLoad<V, Aligned>(src[0] + src_row + x, 0);
+    F g = ccdLoad<V, Aligned>(src[1] + src_row + x, 0);
+    F b = ccdLoad<V, Aligned>(src[2] + src_row + x, 0);
+
+    F total_r = r, total_g = g, total_b = b;
+    F n = V::zero();
+    F one = V::set1(1.0f);
+
+    for (int f = 0; f <= ref_count; f++) {
+        const T *const *frame = f ? refs + 3 * (f - 1) : src;
+
+        for (int k = 0; k < w.taps(); k++) {
+            for (int l = 0; l < w.taps(); l++) {
+                int dx = w.step() * l - w.radius();
+                ptrdiff_t j = rows[k] + x + dx;
+
+                F comp_r = ccdLoad<V, Aligned>(frame[0] + j, dx);
+                F comp_g = ccdLoad<V, Aligned>(frame[1] + j, dx);
+                F comp_b = ccdLoad<V, Aligned>(frame[2] + j, dx);
+
+                if (!Test) {
+                    total_r = V::add(total_r, comp_r);
+                    total_g = V::add(total_g, comp_g);
+                    total_b = V::add(total_b, comp_b);
+                    continue;
+                }
+
+                F diff_r = V::sub(comp_r, r);
+                F diff_g = V::sub(comp_g, g);
+                F diff_b = V::sub(comp_b, b);
+
+                F dist = V::add(V::add(V::mul(diff_r, diff_r), V::mul(diff_g, diff_g)),
+                                V::mul(diff_b, diff_b));
+                M accept = V::cmpgt(threshold, dist);
+
+                total_r = V::mask_add(total_r, accept, comp_r);
+                total_g = V::mask_add(total_g, accept, comp_g);
+                total_b = V::mask_add(total_b, accept, comp_b);
+                n = V::mask_add(n, accept, one);
+            }
+        }
+    }
+
+    F count = Test ? V::add(n, one) : V::set1(static_cast<float>(w.taps() * w.taps() * (ref_count + 1) + 1));
+    F zero = V::zero();
+
+    F out_r = V::min(V::max(V::div(total_r, count), zero), one);
+    F out_g = V::min(V::max(V::div(total_g, count), zero), one);
+    F out_b = V::min(V::max(V::div(total_b, count), zero), one);
+
+    ccdStore<V, Aligned>(dst[0] + dst_row + x, out_r);
+    ccdStore<V, Aligned>(dst[1] + dst_row + x, out_g);
+    ccdStore<V, Aligned>(dst[2] + dst_row + x, out_b);
+}
+
+// ccdVectorRGB for the kind of block at (x, y), see ccdBlockMap.
+template <typename V, bool Aligned, typename T, typename W>
+static inline void ccdVectorBlockRGB(const ccdBlockMap *blocks, int y, const W &w, const T *const *src,
+                                     const T *const *refs, int ref_count, T *const *dst, const ptrdiff_t *rows,
+                                     ptrdiff_t src_row, ptrdiff_t dst_row, int x,
+                                     const typename V::F &threshold) {
+    switch (ccdBlockKindAt(blocks, x, y, V::width)) {
+    case ccdBlockSkip:
+        break;
+    case ccdBlockFlat: {
+        const float *flat = ccdBlockFlatValue(blocks, x, y);
+        ccdStore<V, Aligned>(dst[0] + dst_row + x, V::set1(flat[0]));
+        ccdStore<V, Aligned>(dst[1] + dst_row + x, V::set1(flat[1]));
+        ccdStore<V, Aligned>(dst[2] + dst_row + x, V::set1(flat[2]));
+        break;
+    }
+    case ccdBlockAverage:
+        ccdVectorRGB<V, Aligned, false>(w, src, refs, ref_count, dst, rows, src_row, dst_row, x, threshold);
+        break;
+    default:
+        ccdVectorRGB<V, Aligned>(w, src, refs, ref_count, dst, rows, src_row, dst_row, x, threshold);
+    }
+}
+
+// The columns at the frame edges need reflecting, which the vectors can't do, and with the dense
+// window the scalar code there took as long as the whole interior. So the columns sampled by the
+// pixels [x0, end) are copied into a strip with the reflection already applied, for every row
+// sampled by the rows [y0, y1), and the vectors run on the strip instead. end is the last
+// multiple of the vector width from x0 up to x1, the rest is less than a vector and stays scalar.
+// The frames of the temporal window get a strip each, src() and refs() are the copies of params.src
+// and params.refs.
+template <typename T>
+struct ccdEdgeStrip {
+    std::vector<T> data;
+    std::vector<const T *> planes;
+    ptrdiff_t stride;
+    int first_row;
+    int first_col;
+    int end;
+
+    template <typename W>
+    ccdEdgeStrip(const W &w, const T *const *src, const T *const *refs, int ref_count, ptrdiff_t src_stride,
+                 int width, int height, int x0, int y0, int x1, int y1, int vector_width)
+        : stride(0), first_row(0), first_col(x0 - w.radius()),
+          end(x1 > x0 ? x0 + (x1 - x0) / vector_width * vector_width : x0) {
+        if (end == x0)
+            return;
+
+        // the rows themselves too, the centre pixels also come from the strip
+        int lo = y0, hi = y1 - 1;
+        for (int y = y0; y < y1; y++) {
+            for (int k = 0; k < w.taps(); k++) {
+                int r = ccdReflect(y - w.radius() + w.step() * k, height);
+                lo = r < lo ? r : lo;
+                hi = r > hi ? r : hi;
+            }
+        }
+
+        int cols = end - x0 + 2 * w.radius();
+        std::vector<int> reflected(cols);
+        for (int c = 0; c < cols; c++)
+            reflected[c] = ccdReflect(first_col + c, width);
+
+        first_row = lo;
+        stride = cols;
+        ptrdiff_t plane_size = stride * (hi - lo + 1);
+        int plane_count = 3 * (ref_count + 1);
+        data.resize(plane_size * plane_count);
+        planes.resize(plane_count);
+        for (int plane = 0; plane < plane_count; plane++) {
+            const T *p = plane < 3 ? src[plane] : refs[plane - 3];
+            T *dst = data.data() + plane_size * plane;
+            for (int r = lo; r <= hi; r++)
+                for (int c = 0; c < cols; c++)
+                    dst[(r - lo) * stride + c] = p[r * src_stride + reflected[c]];
+            planes[plane] = dst;
+        }
+    }
+
+    const T *const *src() const { return planes.data(); }
+    const T *const *refs() const { return planes.data() + 3; }
+
+    // ccdSampleRows for the strip, and the offset of row y itself. The first column is folded
+    // in, so the vectors index the strip with frame columns.
+    template <typename W>
+    ptrdiff_t sampleRows(const W &w, int y, int height, ptrdiff_t *rows) const {
+        for (int k = 0; k < w.taps(); k++)
+            rows[k] = (ccdReflect(y - w.radius() + w.step() * k, height) - first_row) * stride - first_col;
+        return (y - first_row) * stride - first_col;
+    }
+};
+
+// P is ccdKernelParams or ccdHalfKernelParams
+template <typename V, bool Aligned, typename P, typename W>
+static void ccdKernelSimdImpl(const P &params, const W &w, int x0, int y0, int x1, int y1) {
+    typedef typename std::remove_pointer<typename std::decay<decltype(params.dst[0])>::type>::type T;
+    typename V::F vthreshold = V::set1(params.threshold);
+    ccdBorderColumns border(*params.window, params.width);
+    ccdRowSplit split(border, x0, x1);
+
+    // the vectors start at the first multiple of the vector width in the interior, so they stay
+    // aligned, and everything on either side of them goes through an edge strip
+    int vec_start = (split.interior_start + V::width - 1) / V::width * V::width;
+    int span = split.interior_end - vec_start;
+    int vec_end = span >= V::width ? vec_start + span / V::width * V::width : vec_start;
+    if (vec_end == vec_start)
+        vec_start = vec_end = split.interior_end;
+
+    // the interior can start past x1 in tiles narrower than the radius
+    int left_stop = vec_start < x1 ? vec_start : x1;
+    int right_start = vec_end > left_stop ? vec_end : left_stop;
+
+    ccdEdgeStrip<T> left(w, params.src, params.refs, params.ref_count, params.src_stride, params.width,
+                         params.height, x0, y0, left_stop, y1, V::width);
+    ccdEdgeStrip<T> right(w, params.src, params.refs, params.ref_count, params.src_stride, params.width,
+                          params.height, right_start, y0, x1, y1, V::width);
+
+    for (int y = y0; y < y1; y++) {
+        ptrdiff_t rows[CCD_MAX_TAPS];
+        ccdSampleRows(w, y, params.height, params.src_stride, rows);
+        ptrdiff_t dst_row = y * params.dst_stride;
+
+        if (left.end > x0) {
+            ptrdiff_t strip_rows[CCD_MAX_TAPS];
+            ptrdiff_t centre = left.sampleRows(w, y, params.height, strip_rows);
+            for (int x = x0; x < left.end; x += V::width)
+                ccdVectorBlockRGB<V, false>(params.blocks, y, w, left.src(), left.refs(), params.ref_count,
+                                            params.dst, strip_rows, centre, dst_row, x, vthreshold);
+        }
+        ccdRowC(params, w, rows, border, y, left.end, left_stop);
+
+        for (int x = vec_start; x < vec_end; x += V::width)
+            ccdVectorBlockRGB<V, Aligned>(params.blocks, y, w, params.src, params.refs, params.ref_count,
+                                          params.dst, rows, y * params.src_stride, dst_row, x, vthreshold);
+
+        if (right.end > right_start) {
+            ptrdiff_t strip_rows[CCD_MAX_TAPS];
+            ptrdiff_t centre = right.sampleRows(w, y, params.height, strip_rows);
+            for (int x = right_start; x < right.end; x += V::width)
+                ccdVectorBlockRGB<V, false>(params.blocks, y, w, right.src(), right.refs(), params.ref_count,
+                                            params.dst, strip_rows, centre, dst_row, x, vthreshold);
+        }
+        ccdRowC(params, w, rows, border, y, right.end, x1);
+    }
+}
+
+// The same for the interleaved layout (see ccdPackRGB), where V::width / 4 pixels fit in a vector.
+// Each sample is a single load, and the squared distance is summed horizontally in the same
+// order as in the planar kernels, so the results are identical.
+template <typename V, bool Test, typename W>
+static inline void ccdVectorPacked(const ccdKernelParams &params, const W &w, const ptrdiff_t *rows,
+                                   ptrdiff_t src_row, ptrdiff_t dst_row, int x,
+                                   const typename V::F &threshold) {
+    typedef typename V::F F;
+    typedef typename V::M M;
+    const int pixels = V::width / 4;
+
+    F centre = V::load(params.packed + src_row + x * 4);
+    F total = centre;
+    F n = V::zero();
+    F one = V::set1(1.0f);
+
+    for (int k = 0; k < w.taps(); k++) {
+        for (int l = 0; l < w.taps(); l++) {
+            int dx = w.step() * l - w.radius();
+            // x is a multiple of pixels, so this is only aligned when dx is as well
+            const float *p = params.packed + rows[k] + (x + dx) * 4;
+            F comp = dx % pixels == 0 ? V::load(p) : V::loadu(p);
+            if (!Test) {
+                total = V::add(total, comp);
+                continue;
+            }
+
+            F diff = V::sub(comp, centre);
+            F square = V::mul(diff, diff);
+            F dist = V::add(V::add(V::template lane<0>(square), V::template lane<1>(square)),
+                            V::template lane<2>(square));
+            M accept = V::cmpgt(threshold, dist);
+
+            total = V::mask_add(total, accept, comp);
+            n = V::mask_add(n, accept, one);
+        }
+    }
+
+    F count = Test ? V::add(n, one) : V::set1(static_cast<float>(w.taps() * w.taps() + 1));
+    F out = V::min(V::max(V::div(total, count), V::zero()), one);
+
+    float result[V::width];
+    V::storeu(result, out);
+    for (int p = 0; p < pixels; p++) {
+        params.dst[0][dst_row + x + p] = result[p * 4 + 0];
+        params.dst[1][dst_row + x + p] = result[p * 4 + 1];
+        params.dst[2][dst_row + x + p] = result[p * 4 + 2];
+    }
+}
+
+// Interleaved counterpart of ccdKernelSimdImpl. The border still reads the planar source, only the
+// interior goes through the packed copy, whose rows are always aligned (see ccdPackRGB).
+template <typename V, typename W>
+static void ccdKernelPackedSimdImpl(const ccdKernelParams &params, const W &w, int x0, int y0, int x1, int y1) {
+    const int pixels = V::width / 4;
+    typename V::F vthreshold = V::set1(params.threshold);
+    ccdBorderColumns border(*params.window, params.width);
+    ccdRowSplit split(border, x0, x1);
+
+    int vec_start = (split.interior_start + pixels - 1) / pixels * pixels;
+    int span = split.interior_end - vec_start;
+    int vec_end = span >= pixels ? vec_start + span / pixels * pixels : vec_start;
+    if (vec_end == vec_start)
+        vec_start = vec_end = split.interior_end;
+
+    for (int y = y0; y < y1; y++) {
+        ptrdiff_t rows[CCD_MAX_TAPS], packed_rows[CCD_MAX_TAPS];
+        ccdSampleRows(w, y, params.height, params.src_stride, rows);
+        ccdSampleRows(w, y, params.height, params.packed_stride, packed_rows);
+
+        ccdBorderC(params, w, rows, border, y, x0, split.left_end);
+        ccdInteriorC(params, w, rows, y, split.interior_start, vec_start);
+
+        for (int x = vec_start; x < vec_end; x += pixels) {
+            ptrdiff_t src_row = y * params.packed_stride, dst_row = y * params.dst_stride;
+
+            switch (ccdBlockKindAt(params.blocks, x, y, pixels)) {
+            case ccdBlockSkip:
+                break;
+            case ccdBlockFlat: {
+                const float *flat = ccdBlockFlatValue(params.blocks, x, y);
+                for (int p = 0; p < pixels; p++) {
+                    params.dst[0][dst_row + x + p] = flat[0];
+                    params.dst[1][dst_row + x + p] = flat[1];
+                    params.dst[2][dst_row + x + p] = flat[2];
+                }
+                break;
+            }
+            case ccdBlockAverage:
+                ccdVectorPacked<V, false>(params, w, packed_rows, src_row, dst_row, x, vthreshold);
+                break;
+            default:
+                ccdVectorPacked<V, true>(params, w, packed_rows, src_row, dst_row, x, vthreshold);
+            }
+        }
+
+        ccdInteriorC(params, w, rows, y, vec_end, split.interior_end);
+        ccdBorderC(params, w, rows, border, y, split.right_start, x1);
+    }
+}
+
+template <typename V>
+static void ccdKernelPackedSimd(CCD_KERNEL_ARGS) {
+    CCD_WITH_WINDOW(*params.window, w, ccdKernelPackedSimdImpl<V>(params, w, x0, y0, x1, y1));
+}
+
+template <typename V>
+static void ccdKernelSimd(CCD_KERNEL_ARGS) {
+    const uintptr_t mask = V::width * sizeof(float) - 1;
+    bool aligned = params.src_stride % V::width == 0 && params.dst_stride % V::width == 0;
+    for (int plane = 0; plane < 3; plane++)
+        aligned = aligned && !(reinterpret_cast<uintptr_t>(params.src[plane]) & mask) &&
+                  !(reinterpret_cast<uintptr_t>(params.dst[plane]) & mask);
+
+    if (aligned)
+        CCD_WITH_WINDOW(*params.window, w, ccdKernelSimdImpl<V, true>(params, w, x0, y0, x1, y1));
+    else
+        CCD_WITH_WINDOW(*params.window, w, ccdKernelSimdImpl<V, false>(params, w, x0, y0, x1, y1));
+}
+
+// ccdVectorRGB for every threshold of multi, each sample is loaded and its distance computed
+// once and then compared against each threshold, with sums of its own.
+template <typename V, bool Aligned, typename W>
+static inline void ccdVectorMulti(const ccdMultiKernelParams &multi, const W &w, const float *const *src,
+                                  const float *const *refs, const ptrdiff_t *rows, ptrdiff_t src_row,
+                                  ptrdiff_t dst_row, int x, const typename V::F *thresholds) {
+    typedef typename V::F F;
+    typedef typename V::M M;
+    const int count = multi.count;
+
+    F r = ccdLoad<V, Aligned>(src[0] + src_row + x, 0);
+    F g = ccdLoad<V, Aligned>(src[1] + src_row + x, 0);
+    F b = ccdLoad<V, Aligned>(src[2] + src_row + x, 0);
+
+    F total_r[CCD_MAX_THRESHOLDS], total_g[CCD_MAX_THRESHOLDS], total_b[CCD_MAX_THRESHOLDS], n[CCD_MAX_THRESHOLDS];
+    F one = V::set1(1.0f);
+    for (int t = 0; t < count; t++) {
+        total_r[t] = r;
+        total_g[t] = g;
+        total_b[t] = b;
+        n[t] = V::zero();
+    }
+
+    for (int f = 0; f <= multi.params.ref_count; f++) {
+        const float *const *frame = f ? refs + 3 * (f - 1) : src;
+
+        for (int k = 0; k < w.taps(); k++) {
+            for (int l = 0; l < w.taps(); l++) {
+                int dx = w.step() * l - w.radius();
+                ptrdiff_t j = rows[k] + x + dx;
+
+                F comp_r = ccdLoad<V, Aligned>(frame[0] + j, dx);
+                F comp_g = ccdLoad<V, Aligned>(frame[1] + j, dx);
+                F comp_b = ccdLoad<V, Aligned>(frame[2] + j, dx);
+
+                F diff_r = V::sub(comp_r, r);
+                F diff_g = V::sub(comp_g, g);
+                F diff_b = V::sub(comp_b, b);
+
+                F dist = V::add(V::add(V::mul(diff_r, diff_r), V::mul(diff_g, diff_g)),
+                                V::mul(diff_b, diff_b));
+
+                for (int t = 0; t < count; t++) {
+                    M accept = V::cmpgt(thresholds[t], dist);
+                    total_r[t] = V::mask_add(total_r[t], accept, comp_r);
+                    total_g[t] = V::mask_add(total_g[t], accept, comp_g);
+                    total_b[t] = V::mask_add(total_b[t], accept, comp_b);
+                    n[t] = V::mask_add(n[t], accept, one);
+                }
+            }
+        }
+    }
+
+    F zero = V::zero();
+    for (int t = 0; t < count; t++) {
+        F samples = V::add(n[t], one);
+        ccdStore<V, Aligned>(multi.dst[t][0] + dst_row + x, V::min(V::max(V::div(total_r[t], samples), zero), one));
+        ccdStore<V, Aligned>(multi.dst[t][1] + dst_row + x, V::min(V::max(V::div(total_g[t], samples), zero), one));
+        ccdStore<V, Aligned>(multi.dst[t][2] + dst_row + x, V::min(V::max(V::div(total_b[t], samples), zero), one));
+    }
+}
+
+// ccdVectorBlockRGB for the multi kernels. Only the blocks that need the test for the lowest
+// threshold go through ccdVectorMulti, the rest come out the same for every threshold, so they're
+// done once into the first output and copied into the others.
+template <typename V, bool Aligned, typename W>
+static inline void ccdVectorBlockMulti(const ccdMultiKernelParams &multi, int y, const W &w,
+                                       const float *const *src, const float *const *refs, const ptrdiff_t *rows,
+                                       ptrdiff_t src_row, ptrdiff_t dst_row, int x, const typename V::F *thresholds) {
+    switch (ccdBlockKindAt(multi.params.blocks, x, y, V::width)) {
+    case ccdBlockSkip:
+        return;
+    case ccdBlockTest:
+        ccdVectorMulti<V, Aligned>(multi, w, src, refs, rows, src_row, dst_row, x, thresholds);
+        return;
+    default:
+        ccdVectorBlockRGB<V, Aligned>(multi.params.blocks, y, w, src, refs, multi.params.ref_count, multi.dst[0],
+                                      rows, src_row, dst_row, x, thresholds[0]);
+        for (int plane = 0; plane < 3; plane++) {
+            typename V::F v = ccdLoad<V, Aligned>(multi.dst[0][plane] + dst_row + x, 0);
+            for (int t = 1; t < multi.count; t++)
+                ccdStore<V, Aligned>(multi.dst[t][plane] + dst_row + x, v);
+        }
+    }
+}
+
+// ccdKernelSimdImpl for the multi kernels, with the same edge strips.
+template <typename V, bool Aligned, typename W>
+static void ccdKernelMultiSimdImpl(const ccdMultiKernelParams &multi, const W &w, int x0, int y0, int x1, int y1) {
+    const ccdKernelParams &params = multi.params;
+    typename V::F thresholds[CCD_MAX_THRESHOLDS];
+    for (int t = 0; t < multi.count; t++)
+        thresholds[t] = V::set1(multi.thresholds[t]);
+    ccdBorderColumns border(*params.window, params.width);
+    ccdRowSplit split(border, x0, x1);
+
+    int vec_start = (split.interior_start + V::width - 1) / V::width * V::width;
+    int span = split.interior_end - vec_start;
+    int vec_end = span >= V::width ? vec_start + span / V::width * V::width : vec_start;
+    if (vec_end == vec_start)
+        vec_start = vec_end = split.interior_end;
+
+    int left_stop = vec_start < x1 ? vec_start : x1;
+    int right_start = vec_end > left_stop ? vec_end : left_stop;
+
+    ccdEdgeStrip<float> left(w, params.src, params.refs, params.ref_count, params.src_stride, params.width,
+                             params.height, x0, y0, left_stop, y1, V::width);
+    ccdEdgeStrip<float> right(w, params.src, params.refs, params.ref_count, params.src_stride, params.width,
+                              params.height, right_start, y0, x1, y1, V::width);
+
+    for (int y = y0; y < y1; y++) {
+        ptrdiff_t rows[CCD_MAX_TAPS];
+        ccdSampleRows(w, y, params.height, params.src_stride, rows);
+        ptrdiff_t dst_row = y * params.dst_stride;
+
+        if (left.end > x0) {
+            ptrdiff_t strip_rows[CCD_MAX_TAPS];
+            ptrdiff_t centre = left.sampleRows(w, y, params.height, strip_rows);
+            for (int x = x0; x < left.end; x += V::width)
+                ccdVectorBlockMulti<V, false>(multi, y, w, left.src(), left.refs(), strip_rows, centre, dst_row, x,
+                                              thresholds);
+        }
+        ccdRowMultiC(multi, w, rows, border, y, left.end, left_stop);
+
+        for (int x = vec_start; x < vec_end; x += V::width)
+            ccdVectorBlockMulti<V, Aligned>(multi, y, w, params.src, params.refs, rows, y * params.src_stride,
+                                            dst_row, x, thresholds);
+
+        if (right.end > right_start) {
+            ptrdiff_t strip_rows[CCD_MAX_TAPS];
+            ptrdiff_t centre = right.sampleRows(w, y, params.height, strip_rows);
+            for (int x = right_start; x < right.end; x += V::width)
+                ccdVectorBlockMulti<V, false>(multi, y, w, right.src(), right.refs(), strip_rows, centre, dst_row,
+                                              x, thresholds);
+        }
+        ccdRowMultiC(multi, w, rows, border, y, right.end, x1);
+    }
+}
+
+template <typename V>
+static void ccdKernelMultiSimd(CCD_MULTI_KERNEL_ARGS) {
+    const ccdKernelParams &params = multi.params;
+    const uintptr_t mask = V::width * sizeof(float) - 1;
+    bool aligned = params.src_stride % V::width == 0 && params.dst_stride % V::width == 0;
+    for (int plane = 0; plane < 3; plane++) {
+        aligned = aligned && !(reinterpret_cast<uintptr_t>(params.src[plane]) & mask);
+        for (int t = 0; t < multi.count; t++)
+            aligned = aligned && !(reinterpret_cast<uintptr_t>(multi.dst[t][plane]) & mask);
+    }
+
+    if (aligned)
+        CCD_WITH_WINDOW(*params.window, w, ccdKernelMultiSimdImpl<V, true>(multi, w, x0, y0, x1, y1));
+    else
+        CCD_WITH_WINDOW(*params.window, w, ccdKernelMultiSimdImpl<V, false>(multi, w, x0, y0, x1, y1));
+}
+
+// The R, G and B sums of the low and then the high V::width pixels of a row of ccdVectorFast,
+// spelled out so they stay in registers.
+template <typename V>
+struct ccdFastTotals {
+    typename V::F r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+
+    ccdFastTotals(const float *const *src, ptrdiff_t i)
+        : r_lo(V::loadu(src[0] + i)), g_lo(V::loadu(src[1] + i)), b_lo(V::loadu(src[2] + i)),
+          r_hi(V::loadu(src[0] + i + V::width)), g_hi(V::loadu(src[1] + i + V::width)),
+          b_hi(V::loadu(src[2] + i + V::width)) {}
+
+    void add(const float *const *frame, ptrdiff_t j, const typename V::F &lo, const typename V::F &hi) {
+        r_lo = V::add(r_lo, V::mul(V::loadu(frame[0] + j), lo));
+        g_lo = V::add(g_lo, V::mul(V::loadu(frame[1] + j), lo));
+        b_lo = V::add(b_lo, V::mul(V::loadu(frame[2] + j), lo));
+        r_hi = V::add(r_hi, V::mul(V::loadu(frame[0] + j + V::width), hi));
+        g_hi = V::add(g_hi, V::mul(V::loadu(frame[1] + j + V::width), hi));
+        b_hi = V::add(b_hi, V::mul(V::loadu(frame[2] + j + V::width), hi));
+    }
+
+    void store(float *const *dst, ptrdiff_t o, const typename V::F &count_lo, const typename V::F &count_hi) const {
+        typename V::F zero = V::zero(), one = V::set1(1.0f);
+        V::storeu(dst[0] + o, V::min(V::max(V::div(r_lo, count_lo), zero), one));
+        V::storeu(dst[1] + o, V::min(V::max(V::div(g_lo, count_lo), zero), one));
+        V::storeu(dst[2] + o, V::min(V::max(V::div(b_lo, count_lo), zero), one));
+        V::storeu(dst[0] + o + V::width, V::min(V::max(V::div(r_hi, count_hi), zero), one));
+        V::storeu(dst[1] + o + V::width, V::min(V::max(V::div(g_hi, count_hi), zero), one));
+        V::storeu(dst[2] + o + V::width, V::min(V::max(V::div(b_hi, count_hi), zero), one));
+    }
+};
+
+// Where ccdVectorFast reads and writes, either the frame or the edge strips around it. rows
+// has the sampled rows of both rows and src_row their own, half_rows and half_row are the same in
+// the half resolution copy (or its strip), which has the planes of src and then of every ref.
+struct ccdFastPlanes {
+    const float *const *src;
+    const float *const *refs;
+    const float *const *half;
+    const ptrdiff_t (*rows)[CCD_MAX_TAPS];
+    ptrdiff_t src_row[2];
+    const ptrdiff_t *half_rows;
+    ptrdiff_t half_row;
+};
+
+// The fast kernels (see ccdKernelFastC) on the 2 * V::width pixels from x on, which is even, of
+// the Rows rows from y on that share a row of the half resolution copy. The samples are tested
+// for the V::width pixels of the half resolution copy they're in, each of which has a 0 or 1
+// weight for every sample that's spread over both pixels of each row. Nothing here needs
+// reflecting.
+template <typename V, int Rows, typename W>
+static inline void ccdVectorFast(const ccdKernelParams &params, const W &w, const ccdFastPlanes &planes, int x,
+                                 int y, const typename V::F &threshold) {
+    typedef typename V::F F;
+
+    int hx = x / 2;
+    F r = V::loadu(planes.half[0] + planes.half_row + hx);
+    F g = V::loadu(planes.half[1] + planes.half_row + hx);
+    F b = V::loadu(planes.half[2] + planes.half_row + hx);
+
+    // the second row is only touched for Rows == 2
+    ccdFastTotals<V> first(planes.src, planes.src_row[0] + x);
+    ccdFastTotals<V> second(planes.src, planes.src_row[Rows - 1] + x);
+    F n = V::zero();
+    F zero = V::zero();
+    F one = V::set1(1.0f);
+
+    for (int f = 0; f <= params.ref_count; f++) {
+        const float *const *frame = f ? planes.refs + 3 * (f - 1) : planes.src;
+        const float *const *half = planes.half + 3 * f;
+
+        for (int k = 0; k < w.taps(); k++) {
+            for (int l = 0; l < w.taps(); l++) {
+                int dx = w.step() * l - w.radius();
+                ptrdiff_t j = planes.half_rows[k] + hx + dx / 2;
+
+                F diff_r = V::sub(V::loadu(half[0] + j), r);
+                F diff_g = V::sub(V::loadu(half[1] + j), g);
+                F diff_b = V::sub(V::loadu(half[2] + j), b);
+
+                F dist = V::add(V::add(V::mul(diff_r, diff_r), V::mul(diff_g, diff_g)),
+                                V::mul(diff_b, diff_b));
+                F weight = V::mask_add(zero, V::cmpgt(threshold, dist), one);
+                n = V::add(n, weight);
+
+                F lo = V::dup_lo(weight), hi = V::dup_hi(weight);
+                first.add(frame, planes.rows[0][k] + x + dx, lo, hi);
+                if (Rows == 2)
+                    second.add(frame, planes.rows[1][k] + x + dx, lo, hi);
+            }
+        }
+    }
+
+    F count_lo = V::add(V::dup_lo(n), one), count_hi = V::add(V::dup_hi(n), one);
+    first.store(params.dst, y * params.dst_stride + x, count_lo, count_hi);
+    if (Rows == 2)
+        second.store(params.dst, (y + 1) * params.dst_stride + x, count_lo, count_hi);
+}
+
+// ccdVectorFast for the kinds of block at (x, y), see ccdBlockMap. Both rows are always in the
+// same row of blocks, as the blocks are an even number of rows high and the pairs start on even
+// rows.
+template <typename V, typename W>
+static inline void ccdVectorFastBlock(const ccdKernelParams &params, const W &w, const ccdFastPlanes &planes,
+                                      int row_count, int x, int y, const typename V::F &threshold) {
+    switch (ccdBlockKindAt(params.blocks, x, y, 2 * V::width)) {
+    case ccdBlockSkip:
+        break;
+    case ccdBlockTest:
+        if (row_count == 2)
+            ccdVectorFast<V, 2>(params, w, planes, x, y, threshold);
+        else
+            ccdVectorFast<V, 1>(params, w, planes, x, y, threshold);
+        break;
+    default:
+        // the same as in the exact kernels, V::width pixels at a time
+        for (int row = 0; row < row_count; row++)
+            for (int part = 0; part < 2; part++)
+                ccdVectorBlockRGB<V, false>(params.blocks, y + row, w, planes.src, planes.refs, params.ref_count,
+                                            params.dst, planes.rows[row], planes.src_row[row],
+                                            (y + row) * params.dst_stride, x + part * V::width, threshold);
+    }
+}
+
+// The rows are done two at a time wherever they share a row of the half resolution copy, and
+// like in ccdKernelSimdImpl the columns around the vectors in the interior go through edge
+// strips, of the frames and of their half resolution copies. Whatever is left is less than
+// 2 * V::width pixels a row and goes through ccdPixelFastBlockC.
+template <typename V, typename W>
+static void ccdKernelFastSimdImpl(const ccdKernelParams &params, const W &w, int x0, int y0, int x1, int y1) {
+    const int pixels = 2 * V::width;
+    typename V::F vthreshold = V::set1(params.threshold);
+    ccdBorderColumns border(*params.window, params.width);
+    ccdRowSplit split(border, x0, x1);
+    ccdHalvedWindow<W> half(w);
+    int half_width = ccdHalfSize(params.width), half_height = ccdHalfSize(params.height);
+
+    int vec_start = (split.interior_start + pixels - 1) / pixels * pixels;
+    int span = split.interior_end - vec_start;
+    int vec_end = span >= pixels ? vec_start + span / pixels * pixels : vec_start;
+    if (vec_end == vec_start)
+        vec_start = vec_end = split.interior_end;
+
+    // the strips have to start on an even column too, so both pixels of a pair are in them
+    int left_x0 = x0 + (x0 & 1);
+    int left_stop = vec_start < x1 ? vec_start : x1;
+    left_stop = left_stop > left_x0 ? left_stop : left_x0;
+    int right_start = vec_end > left_stop ? vec_end : left_stop;
+    right_start += right_start & 1;
+    right_start = right_start < x1 ? right_start : x1;
+
+    ccdEdgeStrip<float> left(w, params.src, params.refs, params.ref_count, params.src_stride, params.width,
+                             params.height, left_x0, y0, left_stop, y1, pixels);
+    ccdEdgeStrip<float> right(w, params.src, params.refs, params.ref_count, params.src_stride, params.width,
+                              params.height, right_start, y0, x1, y1, pixels);
+    ccdEdgeStrip<float> left_half(half, params.half, params.half + 3, params.ref_count, params.half_stride,
+                                  half_width, half_height, left_x0 / 2, y0 / 2, left_stop / 2, (y1 + 1) / 2,
+                                  V::width);
+    ccdEdgeStrip<float> right_half(half, params.half, params.half + 3, params.ref_count, params.half_stride,
+                                   half_width, half_height, right_start / 2, y0 / 2, x1 / 2, (y1 + 1) / 2,
+                                   V::width);
+
+    for (int y = y0; y < y1;) {
+        int row_count = y % 2 == 0 && y + 1 < y1 ? 2 : 1;
+        ptrdiff_t rows[2][CCD_MAX_TAPS], half_rows[CCD_MAX_TAPS];
+        for (int row = 0; row < row_count; row++)
+            ccdSampleRows(w, y + row, params.height, params.src_stride, rows[row]);
+        ccdSampleRows(half, y / 2, half_height, params.half_stride, half_rows);
+
+        ccdFastPlanes frame = {params.src, params.refs, params.half, rows,
+                               {y * params.src_stride, (y + 1) * params.src_stride}, half_rows,
+                               (y / 2) * params.half_stride};
+
+        for (int row = 0; row < row_count; row++)
+            for (int x = x0; x < left_x0; x++)
+                ccdPixelFastBlockC(params, w, rows[row], half_rows, x, y + row);
+
+        if (left.end > left_x0) {
+            ptrdiff_t strip_rows[2][CCD_MAX_TAPS], half_strip_rows[CCD_MAX_TAPS];
+            ccdFastPlanes strip = {left.src(), left.refs(), left_half.src(), strip_rows, {0, 0}, half_strip_rows, 0};
+            for (int row = 0; row < row_count; row++)
+                strip.src_row[row] = left.sampleRows(w, y + row, params.height, strip_rows[row]);
+            strip.half_row = left_half.sampleRows(half, y / 2, half_height, half_strip_rows);
+            for (int x = left_x0; x < left.end; x += pixels)
+                ccdVectorFastBlock<V>(params, w, strip, row_count, x, y, vthreshold);
+        }
+
+        for (int row = 0; row < row_count; row++)
+            for (int x = left.end; x < left_stop; x++)
+                ccdPixelFastBlockC(params, w, rows[row], half_rows, x, y + row);
+
+        for (int x = vec_start; x < vec_end; x += pixels)
+            ccdVectorFastBlock<V>(params, w, frame, row_count, x, y, vthreshold);
+
+        for (int row = 0; row < row_count; row++)
+            for (int x = vec_end; x < right_start; x++)
+                ccdPixelFastBlockC(params, w, rows[row], half_rows, x, y + row);
+
+        if (right.end > right_start) {
+            ptrdiff_t strip_rows[2][CCD_MAX_TAPS], half_strip_rows[CCD_MAX_TAPS];
+            ccdFastPlanes strip = {right.src(), right.refs(), right_half.src(), strip_rows, {0, 0}, half_strip_rows,
+                                   0};
+            for (int row = 0; row < row_count; row++)
+                strip.src_row[row] = right.sampleRows(w, y + row, params.height, strip_rows[row]);
+            strip.half_row = right_half.sampleRows(half, y / 2, half_height, half_strip_rows);
+            for (int x = right_start; x < right.end; x += pixels)
+                ccdVectorFastBlock<V>(params, w, strip, row_count, x, y, vthreshold);
+        }
+
+        for (int row = 0; row < row_count; row++)
+            for (int x = right.end; x < x1; x++)
+                ccdPixelFastBlockC(params, w, rows[row], half_rows, x, y + row);
+
+        y += row_count;
+    }
+}
+
+template <typename V>
+static void ccdKernelFastSimd(CCD_KERNEL_ARGS) {
+    CCD_WITH_WINDOW(*params.window, w, ccdKernelFastSimdImpl<V>(params, w, x0, y0, x1, y1));
+}
+
+// Half floats are converted as they are loaded, which always goes through unaligned loads.
+template <typename V>
+static void ccdKernelHalfSimd(CCD_HALF_KERNEL_ARGS) {
+    CCD_WITH_WINDOW(*params.window, w, ccdKernelSimdImpl<V, false>(params, w, x0, y0, x1, y1));
+}
+
+// The integer kernel uses a second wrapper I, with the samples widened to int32 lanes:
+//   X, M, S    - vector of int32, the result of a comparison and a shift count
+//   width      - number of int32 in X
+//   load, store   - unaligned, widening from and narrowing to uint8_t and uint16_t samples
+//   set1, zero, add
+//   absdiff(a, b) - |a - b|
+//   shift(n)   - the S for a right shift by n, shr(v, s) shifts by it
+//   sqr(v)     - v * v, only for 0 <= v < 2^15
+//   cmpgt(a, b), mask_add(acc, m, v) - as in V
+//   divround(a, b) - a / b in single precision, rounded to nearest even like lrintf
+template <typename I, typename T, bool Shift, bool Test = true, typename W>
+static inline void ccdVectorInt(const W &w, const T *const *src, const T *const *refs, int ref_count,
+                                T *const *dst, const ptrdiff_t *rows, ptrdiff_t src_row, ptrdiff_t dst_row,
+                                int x, const typename I::X &threshold, const typename I::S &shift) {
+    typedef typename I::X X;
+    typedef typename I::M M;
+
+    X r = I::load(src[0] + src_row + x);
+    X g = I::load(src[1] + src_row + x);
+    X b = I::load(src[2] + src_row + x);
+
+    X total_r = r, total_g = g, total_b = b;
+    X n = I::set1(1);
+    X one = I::set1(1);
+
+    for (int f = 0; f <= ref_count; f++) {
+        const T *const *frame = f ? refs + 3 * (f - 1) : src;
+
+        for (int k = 0; k < w.taps(); k++) {
+            for (int l = 0; l < w.taps(); l++) {
+                ptrdiff_t j = rows[k] + x + w.step() * l - w.radius();
+
+                X comp_r = I::load(frame[0] + j);
+                X comp_g = I::load(frame[1] + j);
+                X comp_b = I::load(frame[2] + j);
+
+                if (!Test) {
+                    total_r = I::add(total_r, comp_r);
+                    total_g = I::add(total_g, comp_g);
+                    total_b = I::add(total_b, comp_b);
+                    continue;
+                }
+
+                X diff_r = I::absdiff(comp_r, r);
+                if (Shift)
+                    diff_r = I::shr(diff_r, shift);
+                X diff_g = I::absdiff(comp_g, g);
+                if (Shift)
+                    diff_g = I::shr(diff_g, shift);
+                X diff_b = I::absdiff(comp_b, b);
+                if (Shift)
+                    diff_b = I::shr(diff_b, shift);
+
+                X dist = I::add(I::add(I::sqr(diff_r), I::sqr(diff_g)), I::sqr(diff_b));
+                M accept = I::cmpgt(threshold, dist);
+
+                total_r = I::mask_add(total_r, accept, comp_r);
+                total_g = I::mask_add(total_g, accept, comp_g);
+                total_b = I::mask_add(total_b, accept, comp_b);
+                n = I::mask_add(n, accept, one);
+            }
+        }
+    }
+
+    if (!Test)
+        n = I::set1(w.taps() * w.taps() * (ref_count + 1) + 1);
+
+    I::store(dst[0] + dst_row + x, I::divround(total_r, n));
+    I::store(dst[1] + dst_row + x, I::divround(total_g, n));
+    I::store(dst[2] + dst_row + x, I::divround(total_b, n));
+}
+
+// ccdVectorInt by the block map, flat blocks are copied as in ccdPixelBlockInt.
+template <typename I, typename T, bool Shift, typename W>
+static inline void ccdVectorBlockInt(const ccdBlockMap *blocks, int y, const W &w, const T *const *src,
+                                     const T *const *refs, int ref_count, T *const *dst, const ptrdiff_t *rows,
+                                     ptrdiff_t src_row, ptrdiff_t dst_row, int x, const typename I::X &threshold,
+                                     const typename I::S &shift) {
+    switch (ccdBlockKindAt(blocks, x, y, I::width)) {
+    case ccdBlockSkip:
+        break;
+    case ccdBlockFlat:
+        for (int plane = 0; plane < 3; plane++)
+            I::store(dst[plane] + dst_row + x, I::load(src[plane] + src_row + x));
+        break;
+    case ccdBlockAverage:
+        ccdVectorInt<I, T, Shift, false>(w, src, refs, ref_count, dst, rows, src_row, dst_row, x, threshold,
+                                         shift);
+        break;
+    default:
+        ccdVectorInt<I, T, Shift>(w, src, refs, ref_count, dst, rows, src_row, dst_row, x, threshold, shift);
+    }
+}
+
+template <typename I, typename T, bool Shift, typename W>
+static void ccdKernelIntSimdImpl(const ccdIntKernelParams &params, const W &w, int x0, int y0, int x1, int y1) {
+    const T *src[3] = {static_cast<const T *>(params.src[0]), static_cast<const T *>(params.src[1]),
+                       static_cast<const T *>(params.src[2])};
+    T *dst[3] = {static_cast<T *>(params.dst[0]), static_cast<T *>(params.dst[1]),
+                 static_cast<T *>(params.dst[2])};
+    const T *refs[3 * CCD_MAX_REFS];
+    ccdIntRefs(params, refs);
+    typename I::X threshold = I::set1(params.threshold);
+    typename I::S shift = I::shift(params.shift);
+    ccdBorderColumns border(*params.window, params.width);
+    ccdRowSplit split(border, x0, x1);
+
+    int span = split.interior_end - split.interior_start;
+    int vec_end = split.interior_start + (span > 0 ? span / I::width * I::width : 0);
+
+    // the frame edges go through strips as in ccdKernelSimdImpl
+    int left_stop = split.interior_start < x1 ? split.interior_start : x1;
+    int right_start = vec_end > left_stop ? vec_end : left_stop;
+
+    ccdEdgeStrip<T> left(w, src, refs, params.ref_count, params.src_stride, params.width, params.height,
+                         x0, y0, left_stop, y1, I::width);
+    ccdEdgeStrip<T> right(w, src, refs, params.ref_count, params.src_stride, params.width, params.height,
+                          right_start, y0, x1, y1, I::width);
+
+    for (int y = y0; y < y1; y++) {
+        ptrdiff_t rows[CCD_MAX_TAPS];
+        ccdSampleRows(w, y, params.height, params.src_stride, rows);
+        ptrdiff_t dst_row = y * params.dst_stride;
+
+        if (left.end > x0) {
+            ptrdiff_t strip_rows[CCD_MAX_TAPS];
+            ptrdiff_t centre = left.sampleRows(w, y, params.height, strip_rows);
+            for (int x = x0; x < left.end; x += I::width)
+                ccdVectorBlockInt<I, T, Shift>(params.blocks, y, w, left.src(), left.refs(), params.ref_count, dst,
+                                               strip_rows, centre, dst_row, x, threshold, shift);
+        }
+        ccdRowInt<T>(params, w, rows, border, y, left.end, left_stop);
+
+        for (int x = split.interior_start; x < vec_end; x += I::width)
+            ccdVectorBlockInt<I, T, Shift>(params.blocks, y, w, src, refs, params.ref_count, dst, rows,
+                                           y * params.src_stride, dst_row, x, threshold, shift);
+
+        if (right.end > right_start) {
+            ptrdiff_t strip_rows[CCD_MAX_TAPS];
+            ptrdiff_t centre = right.sampleRows(w, y, params.height, strip_rows);
+            for (int x = right_start; x < right.end; x += I::width)
+                ccdVectorBlockInt<I, T, Shift>(params.blocks, y, w, right.src(), right.refs(), params.ref_count, dst,
+                                               strip_rows, centre, dst_row, x, threshold, shift);
+        }
+        ccdRowInt<T>(params, w, rows, border, y, right.end, x1);
+    }
+}
+
+// Only 15 and 16 bit clips need the shift.
+template <typename I, typename T>
+static void ccdKernelIntSimd(CCD_INT_KERNEL_ARGS) {
+    if (params.shift)
+        CCD_WITH_WINDOW(*params.window, w, ccdKernelIntSimdImpl<I, T, true>(params, w, x0, y0, x1, y1));
+    else
+        CCD_WITH_WINDOW(*params.window, w, ccdKernelIntSimdImpl<I, T, false>(params, w, x0, y0, x1, y1));
+}
+
+#endif // CCD_KERNEL_SIMD_H
@@ -0,0 +1,115 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#include "cpu.h"
+
+#if defined(CCD_X86)
+
+#include <emmintrin.h>
+
+#include <string.h>
+
+#include "kernel_simd.h"
+
+namespace {
+
+struct VecSSE2 {
+    typedef __m128 F;
+    typedef __m128 M;
+    static const int width = 4;
+
+    static F load(const float *p) { return _mm_load_ps(p); }
+    static void store(float *p, F v) { _mm_store_ps(p, v); }
+    static F loadu(const float *p) { return _mm_loadu_ps(p); }
+    static void storeu(float *p, F v) { _mm_storeu_ps(p, v); }
+    static F set1(float v) { return _mm_set1_ps(v); }
+    static F zero() { return _mm_setzero_ps(); }
+    static F add(F a, F b) { return _mm_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm_div_ps(a, b); }
+    static F min(F a, F b) { return _mm_min_ps(a, b); }
+    static F max(F a, F b) { return _mm_max_ps(a, b); }
+    static M cmpgt(F a, F b) { return _mm_cmpgt_ps(a, b); }
+    template <int K> static F lane(F v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(K, K, K, K)); }
+    static F dup_lo(F v) { return _mm_unpacklo_ps(v, v); }
+    static F dup_hi(F v) { return _mm_unpackhi_ps(v, v); }
+    static F mask_add(F acc, M m, F v) { return _mm_add_ps(acc, _mm_and_ps(m, v)); }
+};
+
+// SSE2 has no 32 bit multiply, but the differences fit in 15 bits, so the upper halves of the
+// lanes are zero and pmaddwd gives the square.
+struct IntSSE2 {
+    typedef __m128i X;
+    typedef __m128i M;
+    typedef __m128i S;
+    static const int width = 4;
+
+    static X load(const uint8_t *p) {
+        int v;
+        memcpy(&v, p, sizeof(v));
+        __m128i z = _mm_setzero_si128();
+        return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v), z), z);
+    }
+    static X load(const uint16_t *p) {
+        return _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)), _mm_setzero_si128());
+    }
+    static void store(uint8_t *p, X v) {
+        __m128i w = _mm_packs_epi32(v, v);
+        int t = _mm_cvtsi128_si32(_mm_packus_epi16(w, w));
+        memcpy(p, &t, sizeof(t));
+    }
+    static void store(uint16_t *p, X v) {
+        // no unsigned saturating pack before SSE4.1, go through the signed one
+        __m128i bias = _mm_set1_epi32(0x8000);
+        __m128i w = _mm_packs_epi32(_mm_sub_epi32(v, bias), _mm_setzero_si128());
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(p), _mm_xor_si128(w, _mm_set1_epi16(-0x8000)));
+    }
+    static X set1(int v) { return _mm_set1_epi32(v); }
+    static X zero() { return _mm_setzero_si128(); }
+    static X add(X a, X b) { return _mm_add_epi32(a, b); }
+    static X absdiff(X a, X b) {
+        X d = _mm_sub_epi32(a, b);
+        X sign = _mm_srai_epi32(d, 31);
+        return _mm_sub_epi32(_mm_xor_si128(d, sign), sign);
+    }
+    static S shift(int n) { return _mm_cvtsi32_si128(n); }
+    static X shr(X v, S s) { return _mm_srl_epi32(v, s); }
+    static X sqr(X v) { return _mm_madd_epi16(v, v); }
+    static M cmpgt(X a, X b) { return _mm_cmpgt_epi32(a, b); }
+    static X mask_add(X acc, M m, X v) { return _mm_add_epi32(acc, _mm_and_si128(m, v)); }
+    static X divround(X a, X b) { return _mm_cvtps_epi32(_mm_div_ps(_mm_cvtepi32_ps(a), _mm_cvtepi32_ps(b))); }
+};
+
+} // namespace
+
+void ccdKernelSSE2(CCD_KERNEL_ARGS) {
+    ccdKernelSimd<VecSSE2>(params, x0, y0, x1, y1);
+}
+
+void ccdKernelPackedSSE2(CCD_KERNEL_ARGS) {
+    ccdKernelPackedSimd<VecSSE2>(params, x0, y0, x1, y1);
+}
+
+void ccdKernelFastSSE2(CCD_KERNEL_ARGS) {
+    ccdKernelFastSimd<VecSSE2>(params, x0, y0, x1, y1);
+}
+
+void ccdKernel8SSE2(CCD_INT_KERNEL_ARGS) {
+    ccdKernelIntSimd<IntSSE2, uint8_t>(params, x0, y0, x1, y1);
+}
+
+void ccdKernel16SSE2(CCD_INT_KERNEL_ARGS) {
+    ccdKernelIntSimd<IntSSE2, uint16_t>(params, x0, y0, x1, y1);
+}
+
+void ccdKernelMultiSSE2(CCD_MULTI_KERNEL_ARGS) {
+    ccdKernelMultiSimd<VecSSE2>(multi, x0, y0, x1, y1);
+}
+
+#endif
@@ -0,0 +1,99 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#include "cpu.h"
+
+#if defined(CCD_ARM64) && defined(CCD_SVE)
+
+#include <arm_sve.h>
+
+#include "kernel.h"
+
+// SVE vectors don't have a size known at compile time, so they can't go through the
+// ccdKernelSimd wrapper. Instead the interior of every row is covered by predicated loads,
+// which also takes care of the tail that the fixed width kernels leave to ccdPixelC.
+// The arithmetic is the same as in kernel_simd.h, so is the 1 ulp tolerance against ccdKernelC.
+// Only the borders go by the block map, a vector of any length could cover several blocks, so
+// the interior always tests every sample.
+template <typename W>
+static void ccdKernelSVEImpl(const ccdKernelParams &params, const W &w, int x0, int y0, int x1, int y1) {
+    const float *const *src = params.src;
+    float *const *dst = params.dst;
+
+    const svfloat32_t vthreshold = svdup_n_f32(params.threshold);
+    const svfloat32_t one = svdup_n_f32(1.0f);
+    const svfloat32_t zero = svdup_n_f32(0.0f);
+    const int step = static_cast<int>(svcntw());
+
+    ccdBorderColumns border(*params.window, params.width);
+    ccdRowSplit split(border, x0, x1);
+    const int vec_end = split.interior_end;
+
+    for (int y = y0; y < y1; y++) {
+        ptrdiff_t rows[CCD_MAX_TAPS];
+        ccdSampleRows(w, y, params.height, params.src_stride, rows);
+
+        ccdBorderC(params, w, rows, border, y, x0, split.left_end);
+
+        for (int x = split.interior_start; x < vec_end; x += step) {
+            svbool_t pg = svwhilelt_b32(x, vec_end);
+            ptrdiff_t i = y * params.src_stride + x;
+            ptrdiff_t o = y * params.dst_stride + x;
+
+            svfloat32_t r = svld1(pg, src[0] + i);
+            svfloat32_t g = svld1(pg, src[1] + i);
+            svfloat32_t b = svld1(pg, src[2] + i);
+
+            svfloat32_t total_r = r, total_g = g, total_b = b;
+            svfloat32_t n = zero;
+
+            for (int f = 0; f <= params.ref_count; f++) {
+                const float *const *frame = f ? params.refs + 3 * (f - 1) : src;
+
+                for (int k = 0; k < w.taps(); k++) {
+                    for (int l = 0; l < w.taps(); l++) {
+                        ptrdiff_t j = rows[k] + x + w.step() * l - w.radius();
+
+                        svfloat32_t comp_r = svld1(pg, frame[0] + j);
+                        svfloat32_t comp_g = svld1(pg, frame[1] + j);
+                        svfloat32_t comp_b = svld1(pg, frame[2] + j);
+
+                        svfloat32_t diff_r = svsub_x(pg, comp_r, r);
+                        svfloat32_t diff_g = svsub_x(pg, comp_g, g);
+                        svfloat32_t diff_b = svsub_x(pg, comp_b, b);
+
+                        svfloat32_t dist = svadd_x(pg, svadd_x(pg, svmul_x(pg, diff_r, diff_r),
+                                                                    svmul_x(pg, diff_g, diff_g)),
+                                                   svmul_x(pg, diff_b, diff_b));
+                        svbool_t accept = svcmpgt(pg, vthreshold, dist);
+
+                        // the _m forms leave the lanes that failed the test untouched
+                        total_r = svadd_m(accept, total_r, comp_r);
+                        total_g = svadd_m(accept, total_g, comp_g);
+                        total_b = svadd_m(accept, total_b, comp_b);
+                        n = svadd_m(accept, n, one);
+                    }
+                }
+            }
+
+            svfloat32_t count = svadd_x(pg, n, one);
+
+            svst1(pg, dst[0] + o, svmin_x(pg, svmax_x(pg, svdiv_x(pg, total_r, count), zero), one));
+            svst1(pg, dst[1] + o, svmin_x(pg, svmax_x(pg, svdiv_x(pg, total_g, count), zero), one));
+            svst1(pg, dst[2] + o, svmin_x(pg, svmax_x(pg, svdiv_x(pg, total_b, count), zero), one));
+        }
+
+        ccdBorderC(params, w, rows, border, y, split.right_start, x1);
+    }
+}
+
+void ccdKernelSVE(CCD_KERNEL_ARGS) {
+    CCD_WITH_WINDOW(*params.window, w, ccdKernelSVEImpl(params, w, x0, y0, x1, y1));
+}
+
+#endif
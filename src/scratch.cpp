@@ -0,0 +1,93 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "scratch.h"
+
+// 64 byte aligned like vsh_aligned_malloc, which would pull in VapourSynth's headers
+static void *ccdAlignedMalloc(size_t size) {
+#ifdef _WIN32
+    return _aligned_malloc(size, 64);
+#else
+    void *data;
+    return posix_memalign(&data, 64, size) ? nullptr : data;
+#endif
+}
+
+static void ccdAlignedFree(void *data) {
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+ccdScratchPool::~ccdScratchPool() {
+    for (auto &buffer : buffers)
+        ccdAlignedFree(buffer.data);
+}
+
+void *ccdScratchPool::acquire(size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Buffer *best = nullptr;
+    Buffer *idle = nullptr;
+    for (auto &buffer : buffers) {
+        if (buffer.in_use)
+            continue;
+        if (buffer.size >= size && (!best || buffer.size < best->size))
+            best = &buffer;
+        idle = &buffer;
+    }
+
+    if (!best && idle) {
+        // too small, nobody else can use it either while the frames keep the same size
+        held -= idle->size;
+        ccdAlignedFree(idle->data);
+        idle->data = ccdAlignedMalloc(size);
+        if (!idle->data) {
+            buffers.erase(buffers.begin() + (idle - buffers.data()));
+            return nullptr;
+        }
+        idle->size = size;
+        held += size;
+        best = idle;
+    } else if (!best) {
+        void *data = ccdAlignedMalloc(size);
+        if (!data)
+            return nullptr;
+        buffers.push_back({data, size, false});
+        held += size;
+        best = &buffers.back();
+    }
+
+    if (held > peak)
+        peak = held;
+    best->in_use = true;
+    return best->data;
+}
+
+void ccdScratchPool::release(void *data) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto &buffer : buffers) {
+        if (buffer.data == data) {
+            buffer.in_use = false;
+            return;
+        }
+    }
+}
+
+size_t ccdScratchPool::highWater() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return peak;
+}
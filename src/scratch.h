@@ -0,0 +1,73 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#ifndef CCD_SCRATCH_H
+#define CCD_SCRATCH_H
+
+#include <mutex>
+#include <vector>
+
+#include <stddef.h>
+
+// Scratch memory of one filter instance, kept between frames so getframe doesn't go through
+// malloc and free for every frame. Frames run in parallel, so every buffer belongs to a single
+// frame until it's handed back, and the pool ends up with as many of them as there were frames
+// needing one at the same time. Buffers are 64 byte aligned.
+class ccdScratchPool {
+public:
+    ccdScratchPool() : held(0), peak(0) {}
+    ~ccdScratchPool();
+
+    // A buffer of at least size bytes, which has to be handed back with release(). Takes the
+    // smallest idle buffer that's big enough, or grows an idle one, and only allocates a new one
+    // when all of them are in use. nullptr if that allocation fails, nothing to hand back then.
+    void *acquire(size_t size);
+    void release(void *data);
+
+    // The most memory the pool ever held at once, in bytes.
+    size_t highWater() const;
+
+private:
+    struct Buffer {
+        void *data;
+        size_t size;
+        bool in_use;
+    };
+
+    mutable std::mutex mutex;
+    std::vector<Buffer> buffers;
+    size_t held;
+    size_t peak;
+};
+
+// A buffer of the pool for as long as this is in scope, nullptr if size is 0 or it couldn't be
+// allocated, which failed() tells apart.
+class ccdScratch {
+public:
+    ccdScratch(ccdScratchPool &scratch_pool, size_t size)
+        : pool(scratch_pool), data(size ? scratch_pool.acquire(size) : nullptr), wanted(size > 0) {}
+    ~ccdScratch() {
+        if (data)
+            pool.release(data);
+    }
+
+    template <typename T>
+    T *get() const { return static_cast<T *>(data); }
+
+    bool failed() const { return wanted && !data; }
+
+private:
+    ccdScratch(const ccdScratch &) = delete;
+    ccdScratch &operator=(const ccdScratch &) = delete;
+
+    ccdScratchPool &pool;
+    void *data;
+    bool wanted;
+};
+
+#endif // CCD_SCRATCH_H
@@ -0,0 +1,266 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+
+#include "stats.h"
+
+// The grid pixel in the middle of the first CCD_STATS_STEP of size.
+static inline int ccdGridStart(int size) {
+    return (size < CCD_STATS_STEP ? size : CCD_STATS_STEP) / 2;
+}
+
+// Counts the grid pixels of rect into the histogram of stats by the kind of their block, with
+// count(x, y) testing the samples of the ones that need it. all is n when every sample passes.
+template <typename Count>
+static void ccdCountGrid(const ccdBlockMap *blocks, const ccdRect &rect, int all, ccdStats *stats, Count count) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t *histogram = stats->histogram.data();
+
+    for (int y = rect.top + ccdGridStart(rect.bottom - rect.top); y < rect.bottom; y += CCD_STATS_STEP) {
+        for (int x = rect.left + ccdGridStart(rect.right - rect.left); x < rect.right; x += CCD_STATS_STEP) {
+            switch (ccdBlockKindAt(blocks, x, y)) {
+            case ccdBlockSkip:
+                break;
+            case ccdBlockTest:
+                histogram[count(x, y)]++;
+                break;
+            default:
+                histogram[all]++;
+            }
+        }
+    }
+
+    stats->counting += std::chrono::steady_clock::now() - start;
+}
+
+// The reflected offsets of the rows and columns a pixel samples.
+struct ccdStatsTaps {
+    ptrdiff_t rows[CCD_MAX_TAPS];
+    int cols[CCD_MAX_TAPS];
+
+    ccdStatsTaps(int x, int y, int width, int height, ptrdiff_t stride, int radius, int step, int taps) {
+        for (int k = 0; k < taps; k++) {
+            rows[k] = ccdReflect(y - radius + step * k, height) * stride;
+            cols[k] = ccdReflect(x - radius + step * k, width);
+        }
+    }
+};
+
+// The samples of the pixel (x, y) within threshold of it, the same test as ccdPixelC. planes has the
+// three planes of every frame, all with the same stride.
+template <typename T>
+static int ccdCountPixel(const T *const *planes, int frames, ptrdiff_t stride, int width, int height, int radius,
+                         int step, int taps, int x, int y, float threshold) {
+    ccdStatsTaps t(x, y, width, height, stride, radius, step, taps);
+    ptrdiff_t i = y * stride + x;
+    float r = ccdSampleToFloat(planes[0][i]);
+    float g = ccdSampleToFloat(planes[1][i]);
+    float b = ccdSampleToFloat(planes[2][i]);
+    int n = 0;
+
+    for (int f = 0; f < frames; f++) {
+        const T *const *frame = planes + 3 * f;
+
+        for (int k = 0; k < taps; k++) {
+            for (int l = 0; l < taps; l++) {
+                ptrdiff_t j = t.rows[k] + t.cols[l];
+
+                float diff_r = ccdSampleToFloat(frame[0][j]) - r;
+                float diff_g = ccdSampleToFloat(frame[1][j]) - g;
+                float diff_b = ccdSampleToFloat(frame[2][j]) - b;
+
+                n += threshold > diff_r * diff_r + diff_g * diff_g + diff_b * diff_b;
+            }
+        }
+    }
+
+    return n;
+}
+
+// The same with the shifted integer distance of ccdPixelInt.
+template <typename T>
+static int ccdCountPixelInt(const T *const *planes, int frames, ptrdiff_t stride, int width, int height,
+                            const ccdWindow &w, int x, int y, int threshold, int shift) {
+    ccdStatsTaps t(x, y, width, height, stride, w.radius, w.step, w.taps);
+    ptrdiff_t i = y * stride + x;
+    int r = planes[0][i], g = planes[1][i], b = planes[2][i];
+    int n = 0;
+
+    for (int f = 0; f < frames; f++) {
+        const T *const *frame = planes + 3 * f;
+
+        for (int k = 0; k < w.taps; k++) {
+            for (int l = 0; l < w.taps; l++) {
+                ptrdiff_t j = t.rows[k] + t.cols[l];
+
+                int comp_r = frame[0][j];
+                int comp_g = frame[1][j];
+                int comp_b = frame[2][j];
+
+                int diff_r = (comp_r > r ? comp_r - r : r - comp_r) >> shift;
+                int diff_g = (comp_g > g ? comp_g - g : g - comp_g) >> shift;
+                int diff_b = (comp_b > b ? comp_b - b : b - comp_b) >> shift;
+
+                n += threshold > diff_r * diff_r + diff_g * diff_g + diff_b * diff_b;
+            }
+        }
+    }
+
+    return n;
+}
+
+void ccdCountAccepted(const ccdKernelParams &params, const ccdRect &rect, ccdStats *stats) {
+    const ccdWindow &w = *params.window;
+    int frames = params.ref_count + 1;
+    int all = w.taps * w.taps * frames;
+
+    if (params.half) {
+        int width = ccdHalfSize(params.width), height = ccdHalfSize(params.height);
+        ccdCountGrid(params.blocks, rect, all, stats, [&](int x, int y) {
+            return ccdCountPixel(params.half, frames, params.half_stride, width, height, w.radius / 2, w.step / 2,
+                                 w.taps, x / 2, y / 2, params.threshold);
+        });
+        return;
+    }
+
+    const float *planes[3 * (CCD_MAX_REFS + 1)];
+    for (int plane = 0; plane < 3 * frames; plane++)
+        planes[plane] = plane < 3 ? params.src[plane] : params.refs[plane - 3];
+
+    ccdCountGrid(params.blocks, rect, all, stats, [&](int x, int y) {
+        return ccdCountPixel(planes, frames, params.src_stride, params.width, params.height, w.radius, w.step,
+                             w.taps, x, y, params.threshold);
+    });
+}
+
+void ccdCountAccepted(const ccdHalfKernelParams &params, const ccdRect &rect, ccdStats *stats) {
+    const ccdWindow &w = *params.window;
+    int frames = params.ref_count + 1;
+
+    const uint16_t *planes[3 * (CCD_MAX_REFS + 1)];
+    for (int plane = 0; plane < 3 * frames; plane++)
+        planes[plane] = plane < 3 ? params.src[plane] : params.refs[plane - 3];
+
+    ccdCountGrid(params.blocks, rect, w.taps * w.taps * frames, stats, [&](int x, int y) {
+        return ccdCountPixel(planes, frames, params.src_stride, params.width, params.height, w.radius, w.step,
+                             w.taps, x, y, params.threshold);
+    });
+}
+
+template <typename T>
+static void ccdCountAcceptedInt(const ccdIntKernelParams &params, const ccdRect &rect, ccdStats *stats) {
+    const ccdWindow &w = *params.window;
+    int frames = params.ref_count + 1;
+
+    const T *planes[3 * (CCD_MAX_REFS + 1)];
+    for (int plane = 0; plane < 3 * frames; plane++)
+        planes[plane] = static_cast<const T *>(plane < 3 ? params.src[plane] : params.refs[plane - 3]);
+
+    ccdCountGrid(params.blocks, rect, w.taps * w.taps * frames, stats, [&](int x, int y) {
+        return ccdCountPixelInt(planes, frames, params.src_stride, params.width, params.height, w, x, y,
+                                params.threshold, params.shift);
+    });
+}
+
+void ccdCountAccepted(const ccdIntKernelParams &params, int sample_size, const ccdRect &rect, ccdStats *stats) {
+    if (sample_size == 1)
+        ccdCountAcceptedInt<uint8_t>(params, rect, stats);
+    else
+        ccdCountAcceptedInt<uint16_t>(params, rect, stats);
+}
+
+void ccdCountNone(const ccdBlockMap *blocks, const ccdRect &rect, ccdStats *stats) {
+    // the map of a threshold of 0 has nothing but tested and skipped blocks
+    ccdCountGrid(blocks, rect, 0, stats, [](int, int) { return 0; });
+}
+
+template <typename F>
+struct ccdNamedKernel {
+    F kernel;
+    const char *name;
+};
+
+template <typename F, size_t N>
+static const char *ccdFindName(const ccdNamedKernel<F> (&kernels)[N], F kernel) {
+    for (size_t i = 0; i < N; i++)
+        if (kernels[i].kernel == kernel)
+            return kernels[i].name;
+    return "unknown";
+}
+
+const char *ccdKernelName(ccdKernelFunc kernel) {
+    static const ccdNamedKernel<ccdKernelFunc> kernels[] = {
+        {ccdKernelC, "c"},
+        {ccdKernelFastC, "c-fast"},
+#if defined(CCD_X86)
+        {ccdKernelSSE2, "sse2"},
+        {ccdKernelAVX2, "avx2"},
+        {ccdKernelAVX512, "avx512"},
+        {ccdKernelPackedSSE2, "sse2-packed"},
+        {ccdKernelPackedAVX2, "avx2-packed"},
+        {ccdKernelPackedAVX512, "avx512-packed"},
+        {ccdKernelFastSSE2, "sse2-fast"},
+        {ccdKernelFastAVX2, "avx2-fast"},
+        {ccdKernelFastAVX512, "avx512-fast"},
+#elif defined(CCD_ARM64)
+        {ccdKernelNEON, "neon"},
+        {ccdKernelPackedNEON, "neon-packed"},
+        {ccdKernelFastNEON, "neon-fast"},
+#if defined(CCD_SVE)
+        {ccdKernelSVE, "sve"},
+#endif
+#endif
+    };
+    return ccdFindName(kernels, kernel);
+}
+
+const char *ccdKernelName(ccdHalfKernelFunc kernel) {
+    static const ccdNamedKernel<ccdHalfKernelFunc> kernels[] = {
+#if defined(CCD_X86)
+        {ccdKernelHalfAVX2, "avx2-half"},
+        {ccdKernelHalfAVX512, "avx512-half"},
+#elif defined(CCD_ARM64)
+        {ccdKernelHalfNEON, "neon-half"},
+#endif
+        {nullptr, "unknown"},
+    };
+    return ccdFindName(kernels, kernel);
+}
+
+const char *ccdKernelName(ccdIntKernelFunc kernel) {
+    static const ccdNamedKernel<ccdIntKernelFunc> kernels[] = {
+        {ccdKernel8C, "c-8bit"},
+        {ccdKernel16C, "c-16bit"},
+#if defined(CCD_X86)
+        {ccdKernel8SSE2, "sse2-8bit"},
+        {ccdKernel16SSE2, "sse2-16bit"},
+        {ccdKernel8AVX2, "avx2-8bit"},
+        {ccdKernel16AVX2, "avx2-16bit"},
+        {ccdKernel8AVX512, "avx512-8bit"},
+        {ccdKernel16AVX512, "avx512-16bit"},
+#elif defined(CCD_ARM64)
+        {ccdKernel8NEON, "neon-8bit"},
+        {ccdKernel16NEON, "neon-16bit"},
+#endif
+    };
+    return ccdFindName(kernels, kernel);
+}
+
+const char *ccdKernelName(ccdMultiKernelFunc kernel) {
+    static const ccdNamedKernel<ccdMultiKernelFunc> kernels[] = {
+        {ccdKernelMultiC, "c-multi"},
+#if defined(CCD_X86)
+        {ccdKernelMultiSSE2, "sse2-multi"},
+        {ccdKernelMultiAVX2, "avx2-multi"},
+        {ccdKernelMultiAVX512, "avx512-multi"},
+#elif defined(CCD_ARM64)
+        {ccdKernelMultiNEON, "neon-multi"},
+#endif
+    };
+    return ccdFindName(kernels, kernel);
+}
@@ -0,0 +1,54 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#ifndef CCD_STATS_H
+#define CCD_STATS_H
+
+#include "kernel.h"
+
+#include <chrono>
+#include <vector>
+
+#include <stdint.h>
+
+// stats=True counts how many samples n the kernel accepts for a pixel, on one pixel of every
+// CCD_STATS_STEP x CCD_STATS_STEP, in the middle of each. That's 1/256 of a scalar pass, about 2%
+// of the AVX2 kernel and still over 8000 pixels of a 1080p frame, and with stats off none of it runs at
+// all. The kernels themselves stay as they are, counting in every one of their flavours would slow
+// all of them down, so the histogram is an estimate from the grid, not the kernels' own count.
+static const int CCD_STATS_STEP = 16;
+
+// What the ccdCount functions add up for a frame: histogram has window.reciprocals.size()
+// entries, one for every n from 0 to all the samples of every frame, and counting is the time
+// they took, which the kernel time leaves out.
+struct ccdStats {
+    std::vector<uint64_t> histogram;
+    std::chrono::steady_clock::duration counting;
+
+    explicit ccdStats(size_t entries) : histogram(entries), counting(0) {}
+};
+
+// Adds the n of the grid pixels in rect to the histogram of stats. It's the n the kernel in
+// params computes: the fast test on the half resolution copy when params.half is set, every
+// sample for the blocks the map averages without testing, and nothing for the ones it skips.
+void ccdCountAccepted(const ccdKernelParams &params, const ccdRect &rect, ccdStats *stats);
+void ccdCountAccepted(const ccdHalfKernelParams &params, const ccdRect &rect, ccdStats *stats);
+void ccdCountAccepted(const ccdIntKernelParams &params, int sample_size, const ccdRect &rect, ccdStats *stats);
+
+// The same for a threshold no sample passes, without reading the frame: every grid pixel of rect
+// at n = 0 but the ones blocks, nullptr for none, skips.
+void ccdCountNone(const ccdBlockMap *blocks, const ccdRect &rect, ccdStats *stats);
+
+// The name of the kernel for the CCDKernel property, as in "avx2", "avx2-packed", "avx2-fast",
+// "avx2-half", "avx2-16bit" or "avx2-multi".
+const char *ccdKernelName(ccdKernelFunc kernel);
+const char *ccdKernelName(ccdHalfKernelFunc kernel);
+const char *ccdKernelName(ccdIntKernelFunc kernel);
+const char *ccdKernelName(ccdMultiKernelFunc kernel);
+
+#endif // CCD_STATS_H
@@ -0,0 +1,148 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#include <algorithm>
+
+#include "threadpool.h"
+
+static std::mutex pool_mutex;
+static ccdThreadPool *pool = nullptr;
+static int pool_users = 0;
+
+std::atomic<int> ccdThreadPool::frames(0);
+
+ccdThreadPool *ccdThreadPool::acquire(int workers, int budget) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (!pool)
+        pool = new ccdThreadPool();
+    pool->grow(workers, budget);
+    pool_users++;
+    return pool;
+}
+
+ccdThreadPool::Frame::Frame() {
+    frames.fetch_add(1);
+}
+
+ccdThreadPool::Frame::~Frame() {
+    frames.fetch_sub(1);
+
+    // a thread of the host is free again, the workers waiting for room can have it
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (pool) {
+        std::lock_guard<std::mutex> work_lock(pool->mutex);
+        pool->work_cv.notify_all();
+    }
+}
+
+void ccdThreadPool::release() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (--pool_users == 0) {
+        delete pool;
+        pool = nullptr;
+    }
+}
+
+ccdThreadPool::~ccdThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    work_cv.notify_all();
+    for (auto &t : threads)
+        t.join();
+}
+
+void ccdThreadPool::grow(int workers, int host_threads) {
+    // never more workers than there are other cores
+    int hardware = static_cast<int>(std::thread::hardware_concurrency());
+    if (hardware > 1)
+        workers = std::min(workers, hardware - 1);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = std::max(budget, host_threads);
+    while (static_cast<int>(threads.size()) < workers)
+        threads.emplace_back(&ccdThreadPool::worker, this);
+}
+
+// Whether joining more workers would stay within the budget. Without any Frame alive, when the
+// host doesn't count its frames, that's just the workers.
+bool ccdThreadPool::room(int joining) const {
+    return frames.load() + busy.load() + joining <= budget;
+}
+
+void ccdThreadPool::work(Job *job, bool helper) {
+    int i;
+    // a helper leaves between tiles once new frames have used up its room
+    while ((!helper || room(0)) && (i = job->next.fetch_add(1)) < job->count) {
+        (*job->task)(i);
+        job->done.fetch_add(1);
+    }
+}
+
+void ccdThreadPool::worker() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;) {
+        Job *job = nullptr;
+        work_cv.wait(lock, [&] {
+            if (stop)
+                return true;
+            if (!room(1))
+                return false;
+            for (Job *j : jobs) {
+                if (j->helpers < j->max_helpers && j->next.load() < j->count) {
+                    job = j;
+                    return true;
+                }
+            }
+            return false;
+        });
+
+        if (stop)
+            return;
+
+        job->helpers++;
+        busy.fetch_add(1);
+        lock.unlock();
+        work(job, true);
+        lock.lock();
+        busy.fetch_sub(1);
+        job->helpers--;
+        done_cv.notify_all();
+        // and its room goes to the next one
+        work_cv.notify_all();
+    }
+}
+
+void ccdThreadPool::run(int count, int max_helpers, const std::function<void(int)> &task) {
+    Job job;
+    job.task = &task;
+    job.count = count;
+    job.max_helpers = max_helpers;
+    job.helpers = 0;
+    job.next = 0;
+    job.done = 0;
+
+    if (max_helpers > 0 && count > 1) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(&job);
+        }
+        work_cv.notify_all();
+    }
+
+    work(&job, false);
+
+    if (max_helpers > 0 && count > 1) {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobs.erase(std::find(jobs.begin(), jobs.end(), &job));
+        // the helpers still hold a pointer to the job until they're out of work()
+        done_cv.wait(lock, [&] { return job.helpers == 0 && job.done.load() == count; });
+    }
+}
@@ -0,0 +1,82 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#ifndef CCD_THREADPOOL_H
+#define CCD_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small pool shared by every CCD instance, used to split single frames into tiles.
+//
+// The thread asking for the work always takes part in it, so a frame never waits for a busy
+// pool, it just gets fewer helpers. Idle workers pick up tiles from whichever queued frame
+// still has some left, so a frame that finishes early hands its helpers over to the others.
+//
+// The workers are threads on top of the host's own, so they only help while the host has some
+// of its threads to spare: the frames in flight (see Frame) and the busy workers together never
+// go past the budget given to acquire(), and with every thread of the host in a frame of its own
+// the frames run on their own threads alone.
+class ccdThreadPool {
+public:
+    // Returns the shared pool, making sure it has at least the given number of workers and a
+    // budget of at least budget threads, the host's included. Every call has to be matched by a
+    // release().
+    static ccdThreadPool *acquire(int workers, int budget);
+    static void release();
+
+    // Counts a frame the host is working on in the budget for as long as it lives, whether its
+    // filter has a pool or not.
+    class Frame {
+    public:
+        Frame();
+        ~Frame();
+        Frame(const Frame &) = delete;
+        Frame &operator=(const Frame &) = delete;
+    };
+
+    // Calls task(0) ... task(count - 1) and returns once all of them are done, using the calling
+    // thread and up to max_helpers workers.
+    void run(int count, int max_helpers, const std::function<void(int)> &task);
+
+private:
+    struct Job {
+        const std::function<void(int)> *task;
+        int count;
+        int max_helpers;
+        int helpers;
+        std::atomic<int> next;
+        std::atomic<int> done;
+    };
+
+    ccdThreadPool() : budget(1), busy(0), stop(false) {}
+    ~ccdThreadPool();
+
+    void grow(int workers, int host_threads);
+    bool room(int joining) const;
+    void worker();
+    void work(Job *job, bool helper);
+
+    static std::atomic<int> frames; // alive Frames
+
+    int budget;
+    std::atomic<int> busy; // workers in work()
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+    std::deque<Job *> jobs;
+    std::vector<std::thread> threads;
+    bool stop;
+};
+
+#endif // CCD_THREADPOOL_H
@@ -0,0 +1,363 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "stats.h"
+#include "yuv.h"
+
+bool ccdMatrixCoefficients(int matrix, float *kr, float *kb, bool *constant_luminance) {
+    *constant_luminance = matrix == 10;
+
+    switch (matrix) {
+    case 1: // 709
+        *kr = 0.2126f;
+        *kb = 0.0722f;
+        return true;
+    case 5: // 470bg
+    case 6: // 170m
+        *kr = 0.299f;
+        *kb = 0.114f;
+        return true;
+    case 7: // 240m
+        *kr = 0.212f;
+        *kb = 0.087f;
+        return true;
+    case 9:  // 2020ncl
+    case 10: // 2020cl
+        *kr = 0.2627f;
+        *kb = 0.0593f;
+        return true;
+    default:
+        return false;
+    }
+}
+
+namespace {
+
+// Maps the stored samples to Y' in [0, 1] and Cb, Cr in [-0.5, 0.5] and back.
+struct ccdRange {
+    float luma_offset, luma_scale;
+    float chroma_offset, chroma_scale;
+    float peak;
+
+    explicit ccdRange(const ccdYUVParams &params) {
+        if (params.kind == ccdSampleHalf || params.kind == ccdSampleFloat) {
+            luma_offset = chroma_offset = 0;
+            luma_scale = chroma_scale = 1;
+            peak = 0;
+        } else {
+            float unit = static_cast<float>(1 << (params.bits - 8));
+            peak = static_cast<float>((1 << params.bits) - 1);
+            chroma_offset = 128 * unit;
+            if (params.full_range) {
+                luma_offset = 0;
+                luma_scale = chroma_scale = peak;
+            } else {
+                luma_offset = 16 * unit;
+                luma_scale = 219 * unit;
+                chroma_scale = 224 * unit;
+            }
+        }
+    }
+};
+
+// The BT.2020 transfer function and its inverse, which 2020cl needs for the luma. Negative values
+// mirror the positive ones, so whatever the kernels output goes back and forth unchanged.
+static const double ccd_bt2020_alpha = 1.09929682680944;
+static const double ccd_bt2020_beta = 0.018053968510807;
+
+static inline float ccdEncodeBT2020(float linear) {
+    float l = std::fabs(linear);
+    float v = l < ccd_bt2020_beta ? 4.5f * l
+                                  : static_cast<float>(ccd_bt2020_alpha * std::pow(l, 0.45) - (ccd_bt2020_alpha - 1));
+    return linear < 0 ? -v : v;
+}
+
+static inline float ccdDecodeBT2020(float encoded) {
+    float e = std::fabs(encoded);
+    float v = e < 4.5 * ccd_bt2020_beta
+                  ? e / 4.5f
+                  : static_cast<float>(std::pow((e + (ccd_bt2020_alpha - 1)) / ccd_bt2020_alpha, 1 / 0.45));
+    return encoded < 0 ? -v : v;
+}
+
+// B' - Y' and R' - Y' over Cb and Cr of 2020cl, which differ on either side of 0.
+static inline float ccdCbScaleCL(float diff) {
+    return diff <= 0 ? 1.9404f : 1.5816f;
+}
+
+static inline float ccdCrScaleCL(float diff) {
+    return diff <= 0 ? 1.7184f : 0.9936f;
+}
+
+// Half floats share uint16_t with the 16 bit integers, so they are told apart by Half.
+template <typename T, bool Half>
+static inline float ccdLoadSample(T v) {
+    return Half ? ccdHalfToFloat(static_cast<uint16_t>(v)) : static_cast<float>(v);
+}
+
+template <typename T, bool Half>
+static inline T ccdStoreSample(float v, float peak) {
+    if (Half)
+        return static_cast<T>(ccdFloatToHalf(v));
+    if (peak == 0)
+        return static_cast<T>(v);
+    // clamped first, so truncating v + 0.5 rounds to nearest
+    v = v < 0 ? 0 : (v > peak ? peak : v);
+    return static_cast<T>(static_cast<int>(v + 0.5f));
+}
+
+// The luma for row y of the chroma grid, as stored but in float. With subsampled chroma it's
+// either the average of the luma samples covered by each chroma sample, or the top left one of
+// them, which is the one co-sited with the chroma for the usual left / top left chroma location.
+template <typename T, bool Half>
+static void ccdLumaRow(const ccdYUVParams &params, int y, float *luma) {
+    const T *src = static_cast<const T *>(params.src[0]) + (static_cast<ptrdiff_t>(y) << params.ssh) * params.luma_stride;
+    int width = params.width;
+
+    if ((!params.ssw && !params.ssh) || params.cosited) {
+        for (int x = 0; x < width; x++)
+            luma[x] = ccdLoadSample<T, Half>(src[x << params.ssw]);
+        return;
+    }
+
+    int block_w = 1 << params.ssw, block_h = 1 << params.ssh;
+    float mul = 1.0f / static_cast<float>(block_w * block_h);
+
+    for (int x = 0; x < width; x++) {
+        float sum = 0;
+        for (int j = 0; j < block_h; j++)
+            for (int i = 0; i < block_w; i++)
+                sum += ccdLoadSample<T, Half>(src[j * params.luma_stride + (x << params.ssw) + i]);
+        luma[x] = sum * mul;
+    }
+}
+
+template <typename T, bool Half, bool Constant>
+static void ccdYUVToRGBImpl(const ccdYUVParams &params, float *const *rgb, ptrdiff_t stride,
+                            int y0, int y1) {
+    ccdRange range(params);
+    float kr = params.kr, kb = params.kb, kg = 1 - kr - kb;
+    float cr_r = 2 * (1 - kr), cb_b = 2 * (1 - kb);
+    float g_r = -kr / kg, g_b = -kb / kg, g_y = 1 / kg;
+    float luma_mul = 1 / range.luma_scale, chroma_mul = 1 / range.chroma_scale;
+
+    int width = params.width;
+    std::vector<float> luma_row(width);
+    const float *src_y = luma_row.data();
+
+    // everything the loop needs is in locals, so the compiler doesn't have to assume the stores
+    // to rgb change params
+    for (int y = y0; y < y1; y++) {
+        ccdLumaRow<T, Half>(params, y, luma_row.data());
+        const T *src_u = static_cast<const T *>(params.src[1]) + y * params.src_stride;
+        const T *src_v = static_cast<const T *>(params.src[2]) + y * params.src_stride;
+        float *r = rgb[0] + y * stride, *g = rgb[1] + y * stride, *b = rgb[2] + y * stride;
+
+        for (int x = 0; x < width; x++) {
+            float luma = (src_y[x] - range.luma_offset) * luma_mul;
+            float cb = (ccdLoadSample<T, Half>(src_u[x]) - range.chroma_offset) * chroma_mul;
+            float cr = (ccdLoadSample<T, Half>(src_v[x]) - range.chroma_offset) * chroma_mul;
+
+            if (Constant) {
+                // G' only follows from the linear values
+                float red = luma + ccdCrScaleCL(cr) * cr;
+                float blue = luma + ccdCbScaleCL(cb) * cb;
+                float green = g_y * ccdDecodeBT2020(luma) + g_r * ccdDecodeBT2020(red) + g_b * ccdDecodeBT2020(blue);
+                r[x] = red;
+                g[x] = ccdEncodeBT2020(green);
+                b[x] = blue;
+                continue;
+            }
+
+            float red = luma + cr_r * cr;
+            float blue = luma + cb_b * cb;
+            r[x] = red;
+            g[x] = g_y * luma + g_r * red + g_b * blue;
+            b[x] = blue;
+        }
+    }
+}
+
+template <typename T, bool Half, bool Constant>
+static void ccdRGBToUVImpl(const ccdYUVParams &params, const float *const *rgb, ptrdiff_t stride,
+                           int x0, int y0, int x1, int y1) {
+    ccdRange range(params);
+    float kr = params.kr, kb = params.kb, kg = 1 - kr - kb;
+    float cb_mul = range.chroma_scale / (2 * (1 - kb)), cr_mul = range.chroma_scale / (2 * (1 - kr));
+
+    float offset = range.chroma_offset, peak = range.peak;
+
+    for (int y = y0; y < y1; y++) {
+        T *dst_u = static_cast<T *>(params.dst[1]) + y * params.dst_stride;
+        T *dst_v = static_cast<T *>(params.dst[2]) + y * params.dst_stride;
+        const float *r = rgb[0] + y * stride, *g = rgb[1] + y * stride, *b = rgb[2] + y * stride;
+
+        for (int x = x0; x < x1; x++) {
+            if (Constant) {
+                float luma = ccdEncodeBT2020(kr * ccdDecodeBT2020(r[x]) + kg * ccdDecodeBT2020(g[x]) +
+                                             kb * ccdDecodeBT2020(b[x]));
+                float diff_b = b[x] - luma, diff_r = r[x] - luma;
+                dst_u[x] = ccdStoreSample<T, Half>(diff_b / ccdCbScaleCL(diff_b) * range.chroma_scale + offset, peak);
+                dst_v[x] = ccdStoreSample<T, Half>(diff_r / ccdCrScaleCL(diff_r) * range.chroma_scale + offset, peak);
+                continue;
+            }
+
+            float luma = kr * r[x] + kg * g[x] + kb * b[x];
+            dst_u[x] = ccdStoreSample<T, Half>((b[x] - luma) * cb_mul + offset, peak);
+            dst_v[x] = ccdStoreSample<T, Half>((r[x] - luma) * cr_mul + offset, peak);
+        }
+    }
+}
+
+} // namespace
+
+template <typename T, bool Half>
+static void ccdYUVToRGBSized(const ccdYUVParams &params, float *const *rgb, ptrdiff_t stride, int y0, int y1) {
+    if (params.constant_luminance)
+        ccdYUVToRGBImpl<T, Half, true>(params, rgb, stride, y0, y1);
+    else
+        ccdYUVToRGBImpl<T, Half, false>(params, rgb, stride, y0, y1);
+}
+
+template <typename T, bool Half>
+static void ccdRGBToUVSized(const ccdYUVParams &params, const float *const *rgb, ptrdiff_t stride,
+                            int x0, int y0, int x1, int y1) {
+    if (params.constant_luminance)
+        ccdRGBToUVImpl<T, Half, true>(params, rgb, stride, x0, y0, x1, y1);
+    else
+        ccdRGBToUVImpl<T, Half, false>(params, rgb, stride, x0, y0, x1, y1);
+}
+
+void ccdYUVToRGB(const ccdYUVParams &params, float *const *rgb, ptrdiff_t stride, int y0, int y1) {
+    switch (params.kind) {
+    case ccdSampleByte:
+        ccdYUVToRGBSized<uint8_t, false>(params, rgb, stride, y0, y1);
+        break;
+    case ccdSampleWord:
+        ccdYUVToRGBSized<uint16_t, false>(params, rgb, stride, y0, y1);
+        break;
+    case ccdSampleHalf:
+        ccdYUVToRGBSized<uint16_t, true>(params, rgb, stride, y0, y1);
+        break;
+    case ccdSampleFloat:
+        ccdYUVToRGBSized<float, false>(params, rgb, stride, y0, y1);
+        break;
+    }
+}
+
+void ccdRGBToUV(const ccdYUVParams &params, const float *const *rgb, ptrdiff_t stride,
+                int x0, int y0, int x1, int y1) {
+    switch (params.kind) {
+    case ccdSampleByte:
+        ccdRGBToUVSized<uint8_t, false>(params, rgb, stride, x0, y0, x1, y1);
+        break;
+    case ccdSampleWord:
+        ccdRGBToUVSized<uint16_t, false>(params, rgb, stride, x0, y0, x1, y1);
+        break;
+    case ccdSampleHalf:
+        ccdRGBToUVSized<uint16_t, true>(params, rgb, stride, x0, y0, x1, y1);
+        break;
+    case ccdSampleFloat:
+        ccdRGBToUVSized<float, false>(params, rgb, stride, x0, y0, x1, y1);
+        break;
+    }
+}
+
+void ccdProcessYUVFrame(ccdKernelFunc kernel, const ccdYUVParams &params, const ccdYUVParams *refs,
+                        int ref_count, float threshold, const ccdWindow &window, int iterations,
+                        const ccdRect &roi, float *const *rgb_in, float *const *rgb_out, ptrdiff_t stride, void *blocks,
+                        const ccdMask *mask, void *last_blocks, float *const *half, ccdStats *stats,
+                        ccdThreadPool *pool, int threads) {
+    ccdKernelParams kp;
+
+    for (int plane = 0; plane < 3; plane++) {
+        kp.src[plane] = rgb_in[plane];
+        kp.dst[plane] = rgb_out[plane];
+    }
+    kp.refs = rgb_in + 3;
+    kp.ref_count = ref_count;
+    kp.src_stride = stride;
+    kp.dst_stride = stride;
+    kp.width = params.width;
+    kp.height = params.height;
+    kp.threshold = threshold;
+    kp.window = &window;
+    kp.packed = nullptr;
+    kp.packed_stride = 0;
+    kp.half = nullptr;
+    kp.half_stride = 0;
+    kp.blocks = nullptr;
+
+    // rgb_in is free for the second pass to write as soon as the first is done with its rows
+    std::vector<ccdKernelParams> passes(iterations, kp);
+    for (int pass = 1; pass < iterations; pass++) {
+        for (int plane = 0; plane < 3; plane++) {
+            passes[pass].src[plane] = pass % 2 ? rgb_out[plane] : rgb_in[plane];
+            passes[pass].dst[plane] = pass % 2 ? rgb_in[plane] : rgb_out[plane];
+        }
+        passes[pass].refs = nullptr;
+        passes[pass].ref_count = 0;
+    }
+
+    // only the rows the first pass samples, and the whole blocks ccdClassifyBlocks goes by for
+    // them, the ones past the edges of the frame are reflected back into these
+    ccdRect first = ccdPassRect(roi, 0, iterations, window.radius, params.width, params.height);
+    int reach = (window.radius + CCD_BLOCK_SIZE - 1) / CCD_BLOCK_SIZE;
+    int top = std::max((first.top / CCD_BLOCK_SIZE - reach) * CCD_BLOCK_SIZE, 0);
+    int bottom = std::min(((first.bottom + CCD_BLOCK_SIZE - 1) / CCD_BLOCK_SIZE + reach) * CCD_BLOCK_SIZE,
+                          params.height);
+    ccdProcessBands(bottom - top, pool, threads, [&](int y0, int y1) {
+        ccdYUVToRGB(params, rgb_in, stride, top + y0, top + y1);
+        for (int f = 0; f < ref_count; f++)
+            ccdYUVToRGB(refs[f], rgb_in + 3 * (f + 1), stride, top + y0, top + y1);
+    });
+
+    if (half) {
+        passes[0].half = half;
+        passes[0].half_stride = ccdHalfStride(params.width);
+        ccdHalveFrame(passes[0], half, first, pool, threads);
+    }
+
+    // past the largest distance the converted samples only have to be in [0, 1] for every pass to
+    // average without testing, as in ccdCore::run, and those rows are all the first one reads
+    ccdBlockMap map, last_map;
+    bool all = blocks && threshold > CCD_FLOAT_MAX_DISTANCE &&
+               ccdUnitRange(rgb_in, 3 * (ref_count + 1), stride, ccdRect{0, top, params.width, bottom});
+    if (all) {
+        ccdFillBlocks(params.width, params.height, ccdBlockAverage, blocks, &map);
+        for (ccdKernelParams &pass : passes)
+            pass.blocks = &map;
+    } else if (blocks && ccdClassifyBlocks(kp, top, bottom, blocks, &map, pool, threads)) {
+        passes[0].blocks = &map;
+    }
+    const ccdBlockMap *last = ccdMaskPasses(mask, params.width, params.height, iterations, &passes[0].blocks, blocks,
+                                            &map, last_blocks, &last_map, pool, threads);
+    passes.back().blocks = last ? last : all ? &map : nullptr;
+
+    // at 0 no sample passes, so the kernel would only clamp what it's given
+    bool none = !(threshold > 0);
+
+    // before the passes, which can write over rgb_in
+    if (stats)
+        ccdCountAccepted(passes[0], roi, stats);
+
+    ccdProcessPasses(roi, params.width, params.height, window.radius, sizeof(float), ref_count + 1, iterations,
+                     pool, threads, [&](int pass, int x0, int y0, int x1, int y1) {
+                         if (none)
+                             ccdClampPlanes(passes[pass].src, stride, passes[pass].dst, stride,
+                                            ccdRect{x0, y0, x1, y1});
+                         else
+                             kernel(passes[pass], x0, y0, x1, y1);
+                         if (pass == iterations - 1)
+                             ccdRGBToUV(params, passes[pass].dst, stride, x0, y0, x1, y1);
+                     });
+}
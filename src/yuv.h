@@ -0,0 +1,75 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+#ifndef CCD_YUV_H
+#define CCD_YUV_H
+
+#include "kernel.h"
+
+struct ccdStats; // see stats.h
+
+// How the samples of a YUV clip are stored.
+enum ccdSampleKind {
+    ccdSampleByte,  // 8 bit integer
+    ccdSampleWord,  // 9 to 16 bit integer
+    ccdSampleHalf,
+    ccdSampleFloat,
+};
+
+// A YUV frame for CCDYUV, which works at the resolution of the chroma planes. The luma plane of
+// dst is never written. Strides are in samples, src_stride and dst_stride are the chroma ones.
+struct ccdYUVParams {
+    const void *src[3];
+    ptrdiff_t src_stride;
+    ptrdiff_t luma_stride;
+    void *dst[3];
+    ptrdiff_t dst_stride;
+    int width;  // of the chroma planes
+    int height;
+    int ssw;    // log2 of the chroma subsampling
+    int ssh;
+    bool cosited; // the luma sample co-sited with each chroma sample rather than the average
+    ccdSampleKind kind;
+    int bits;
+    bool full_range; // ignored for float samples, which are always full range
+    float kr;
+    float kb;
+    bool constant_luminance; // 2020cl, see ccdMatrixCoefficients
+};
+
+// Kr, Kb and whether it's the constant luminance 2020cl for a _Matrix value, false if the matrix
+// isn't supported. That's 709, 470bg, 170m, 240m, 2020ncl and 2020cl. For 2020cl the luma is
+// made of the linear R, G and B and the chroma scaled differently either side of 0, as in
+// BT.2020, with the BT.2020 transfer function to get at the linear values.
+bool ccdMatrixCoefficients(int matrix, float *kr, float *kb, bool *constant_luminance);
+
+// Converts the rows [y0, y1) of the frame to normalised R'G'B', and the rectangle [x0, x1) x
+// [y0, y1) of the denoised R'G'B' back to the chroma planes of dst.
+void ccdYUVToRGB(const ccdYUVParams &params, float *const *rgb, ptrdiff_t stride, int y0, int y1);
+void ccdRGBToUV(const ccdYUVParams &params, const float *const *rgb, ptrdiff_t stride,
+                int x0, int y0, int x1, int y1);
+
+// Converts the frame to R'G'B' in rgb_in, then runs the kernel into rgb_out one tile at a time,
+// writing the chroma of each tile right after it's computed while it's still in cache. Every
+// buffer is a float plane with the given stride. The ref_count frames of the temporal window in
+// refs are converted into the planes of rgb_in after the first three, only their src is read.
+// With more than one iteration the passes go back and forth between rgb_out and rgb_in, see
+// ccdProcessPasses, and the chroma is written by the last one, only in roi. blocks holds ccdBlockMapSize bytes
+// for the block map of the first pass, or is nullptr to test every sample. mask, nullptr for
+// none, is at chroma resolution and makes the passes skip blocks as in ccdMaskPasses, which also
+// needs blocks and last_blocks. The chroma of the pixels it leaves out is left for ccdApplyMask.
+// half, nullptr unless kernel is a fast kernel, gets the half resolution copy of the converted
+// frames, see ccdHalfPlanes. stats, nullptr unless stats=True, gets ccdCountAccepted of the
+// first pass.
+void ccdProcessYUVFrame(ccdKernelFunc kernel, const ccdYUVParams &params, const ccdYUVParams *refs,
+                        int ref_count, float threshold, const ccdWindow &window, int iterations,
+                        const ccdRect &roi, float *const *rgb_in, float *const *rgb_out, ptrdiff_t stride, void *blocks,
+                        const ccdMask *mask, void *last_blocks, float *const *half, ccdStats *stats,
+                        ccdThreadPool *pool = nullptr, int threads = 1);
+
+#endif // CCD_YUV_H
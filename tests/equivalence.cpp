@@ -0,0 +1,643 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+
+// Runs every optimised kernel this CPU has against the scalar one it has to match, on random
+// frames and on the edge cases: the 12x12 minimum, odd widths, threshold 0 and thresholds every
+// sample passes, and samples outside [0, 1] that hit the clamp. The references are
+//   ccdKernelC      - for the SIMD, tiled, block map, masked and packed kernels
+//   ccdKernelFastC  - for the SIMD fast kernels, which only approximate ccdKernelC by design
+//   ccdKernelC      - on the samples rounded to half floats, for the RGBH kernels
+//   ccdKernel8C/16C - for the integer kernels, which round the same way to the last bit
+//   ccdKernelC      - at each of the thresholds, for every output of the multi kernels
+//   ccdKernelC      - for the fast and integer kernels (the latter on the same samples over the
+//                     peak), which it only bounds, see ccdTestIntTolerance and
+//                     ccd_test_fast_tolerance
+// and every kernel has its own tolerance, see ccdTestRunner. For each one the largest absolute
+// difference and the number of output samples further off than the tolerance are printed, and
+// the test fails if any kernel has more than the share it's allowed, none but for the float
+// reference of the fast and 16 bit kernels, or ccdBlockKindAt gets a vector wrong.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "kernel.h"
+
+namespace {
+
+// The first 64 byte boundary in buffer, which has to have 64 bytes to spare.
+template <typename T>
+T *ccdTestAligned(std::vector<uint8_t> &buffer) {
+    uintptr_t p = reinterpret_cast<uintptr_t>(buffer.data());
+    return reinterpret_cast<T *>((p + 63) & ~static_cast<uintptr_t>(63));
+}
+
+// Planes of T, every row starting on a 64 byte boundary like in VapourSynth's frames.
+template <typename T>
+struct ccdTestFrame {
+    std::vector<uint8_t> storage;
+    T *planes[3];
+    ptrdiff_t stride;
+
+    ccdTestFrame(int width, int height) : stride((width + 63) & ~static_cast<ptrdiff_t>(63)) {
+        storage.resize(stride * height * 3 * sizeof(T) + 64);
+        T *base = ccdTestAligned<T>(storage);
+        for (int plane = 0; plane < 3; plane++)
+            planes[plane] = base + stride * height * plane;
+    }
+};
+
+enum ccdTestContent {
+    ccdTestNoise,      // every sample random in [0, 1]
+    ccdTestBlocks,     // flat and nearly flat patches, so the block map has every kind
+    ccdTestOutOfRange, // random in [-0.5, 1.5], the output has to be clamped
+};
+
+const char *ccd_test_content_names[] = {"noise", "blocks", "out of range"};
+
+struct ccdTestCase {
+    int width;
+    int height;
+    int radius;
+    int step;
+    int ref_count;
+    double threshold;
+    ccdTestContent content;
+};
+
+struct ccdTestRandom {
+    uint32_t state;
+
+    float next() {
+        state = state * 1664525 + 1013904223;
+        return static_cast<float>(state >> 8) / (1 << 24);
+    }
+};
+
+void ccdTestFill(ccdTestFrame<float> &frame, int width, int height, ccdTestContent content, ccdTestRandom &random) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            for (int plane = 0; plane < 3; plane++) {
+                float v;
+                if (content == ccdTestNoise) {
+                    v = random.next();
+                } else if (content == ccdTestBlocks) {
+                    // a third of the 24x24 patches flat, a third within 1/255 and the rest noise
+                    int patch = (x / 24 * 7 + y / 24 * 3) % 3;
+                    float base = 0.2f + 0.3f * ((x / 24 + y / 24 + plane) % 3);
+                    v = patch == 0 ? base : patch == 1 ? base + random.next() / 255 : random.next();
+                } else {
+                    v = random.next() * 2 - 0.5f;
+                }
+                frame.planes[plane][y * frame.stride + x] = v;
+            }
+        }
+    }
+}
+
+// The largest difference and the number of samples further off than the tolerance, over every
+// case a kernel ran in. allowed is the share of the samples that may be, for the kernels that
+// only approximate their reference and so go the other way on the odd sample.
+struct ccdTestResult {
+    std::string name;
+    std::string reference;
+    double tolerance;
+    double allowed;
+    int cases;
+    long long samples;
+    double max_error;
+    long long mismatches;
+    std::string first_failure;
+
+    bool passed() const { return mismatches <= allowed * samples; }
+};
+
+std::string ccdTestDescribe(const ccdTestCase &c) {
+    char text[160];
+    snprintf(text, sizeof(text), "%dx%d, radius %d, step %d, %d refs, threshold %g, %s", c.width, c.height,
+             c.radius, c.step, c.ref_count, c.threshold, ccd_test_content_names[c.content]);
+    return text;
+}
+
+template <typename T>
+void ccdTestCompare(ccdTestResult &result, const ccdTestCase &c, const ccdTestFrame<T> &expected,
+                    const ccdTestFrame<T> &actual, double scale = 1) {
+    long long mismatches = 0;
+    for (int plane = 0; plane < 3; plane++) {
+        for (int y = 0; y < c.height; y++) {
+            for (int x = 0; x < c.width; x++) {
+                double e = expected.planes[plane][y * expected.stride + x];
+                double a = actual.planes[plane][y * actual.stride + x];
+                double error = std::isnan(a) ? INFINITY : std::fabs(a - e) * scale;
+                result.max_error = std::max(result.max_error, error);
+                mismatches += error > result.tolerance;
+            }
+        }
+    }
+    result.cases++;
+    result.samples += 3LL * c.width * c.height;
+    result.mismatches += mismatches;
+    if (mismatches && result.first_failure.empty())
+        result.first_failure = ccdTestDescribe(c);
+}
+
+// A mask that keeps every third column of blocks, so the widest vectors, the 32 pixels of the
+// AVX-512 fast kernels, cover a kept block between two skipped ones.
+struct ccdTestMask {
+    std::vector<uint8_t> plane;
+    std::vector<uint8_t> buffer;
+    ccdBlockMap map;
+    int width;
+
+    ccdTestMask(int w, int height) : plane(static_cast<size_t>(w) * height), buffer(ccdBlockMapSize(w, height) + 64),
+                                     width(w) {
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                plane[y * width + x] = x / CCD_BLOCK_SIZE % 3 == 1;
+        ccdMask mask = {plane.data(), width, 1, false};
+        ccdMaskBlocks(mask, width, height, false, ccdTestAligned<void>(buffer), &map);
+    }
+
+    // Runs kernel over the frame in params into actual, starting from NaN so a kept block left
+    // unwritten shows, with the pixels the mask leaves out then taken from expected.
+    void run(ccdKernelFunc kernel, ccdKernelParams params, const ccdTestCase &c, const ccdTestFrame<float> &expected,
+             ccdTestFrame<float> &actual) const {
+        std::copy(actual.planes, actual.planes + 3, params.dst);
+        params.blocks = &map;
+        for (int plane_index = 0; plane_index < 3; plane_index++)
+            std::fill(actual.planes[plane_index], actual.planes[plane_index] + actual.stride * c.height, NAN);
+        ccdProcessFrame(kernel, params, ccdFrameRect(c.width, c.height));
+
+        for (int p = 0; p < 3; p++)
+            for (int y = 0; y < c.height; y++)
+                for (int x = 0; x < c.width; x++)
+                    if (!plane[y * width + x])
+                        actual.planes[p][y * actual.stride + x] = expected.planes[p][y * expected.stride + x];
+    }
+};
+
+// The samples of an integer frame over peak, as the float kernels take them.
+template <typename T>
+void ccdTestToFloat(const ccdTestFrame<T> &frame, ccdTestFrame<float> &out, const ccdTestCase &c, int peak) {
+    for (int plane = 0; plane < 3; plane++)
+        for (int y = 0; y < c.height; y++)
+            for (int x = 0; x < c.width; x++)
+                out.planes[plane][y * out.stride + x] = frame.planes[plane][y * frame.stride + x] / float(peak);
+}
+
+// How far the kernels that approximate ccdKernelC may be off it. The integer kernels round the
+// average to the nearest step, so they're up to half a step off, plus a few 1e-6 the float
+// kernel rounds on its own. They compare the distance exactly, where the float kernel rounds
+// it, which on these frames never changes the outcome up to 14 bits. Above that the lowest bits
+// of the differences are dropped (see ccdIntShift), and a sample right at the threshold goes the
+// other way now and then; at 16 bits about 2e-5 of the output samples are then further off,
+// 1e-4 are allowed.
+double ccdTestIntTolerance(int bits) {
+    return 0.5 / ((1 << bits) - 1) + 4e-6;
+}
+
+double ccdTestIntAllowed(int bits) {
+    return ccdIntShift(bits) ? 1e-4 : 0;
+}
+
+// The fast kernels test the averages of 2x2 pixels rather than the samples themselves, so near
+// edges and the threshold whole groups of samples pass or fail together, which is the point of
+// them. About 6% of the output samples are more than a step of 8 bits off ccdKernelC, the most
+// on noise and samples outside [0, 1], 10% are allowed.
+const double ccd_test_fast_tolerance = 1.0 / 255;
+const double ccd_test_fast_allowed = 0.1;
+
+// Every distinct kernel of a kind this CPU can run, the names go by the opt that picks them.
+template <typename F, typename Select>
+std::vector<std::pair<std::string, F>> ccdTestSelect(Select select) {
+    static const char *names[] = {nullptr, "c", "sse2", "avx2", "avx512", "neon", "sve"};
+    std::vector<std::pair<std::string, F>> kernels;
+    for (int opt = ccdOptC; opt <= ccdOptMax; opt++) {
+        F kernel = select(opt);
+        bool seen = false;
+        for (const auto &k : kernels)
+            seen = seen || k.second == kernel;
+        if (kernel && !seen)
+            kernels.push_back({names[opt], kernel});
+    }
+    return kernels;
+}
+
+class ccdTestRunner {
+public:
+    std::vector<ccdTestResult> results;
+
+    void run(const ccdTestCase &c, uint32_t seed) {
+        ccdTestRandom random = {seed};
+        ccdWindow window(c.radius, c.step, c.ref_count + 1);
+        int frames = c.ref_count + 1;
+
+        std::vector<ccdTestFrame<float>> src;
+        for (int frame = 0; frame < frames; frame++) {
+            src.emplace_back(c.width, c.height);
+            ccdTestFill(src.back(), c.width, c.height, c.content, random);
+        }
+        std::vector<const float *> refs;
+        for (int frame = 1; frame < frames; frame++)
+            refs.insert(refs.end(), src[frame].planes, src[frame].planes + 3);
+
+        ccdTestFrame<float> expected(c.width, c.height), actual(c.width, c.height);
+        ccdKernelParams params;
+        for (int plane = 0; plane < 3; plane++)
+            params.src[plane] = src[0].planes[plane];
+        params.src_stride = src[0].stride;
+        params.refs = refs.data();
+        params.ref_count = c.ref_count;
+        params.dst_stride = expected.stride;
+        params.width = c.width;
+        params.height = c.height;
+        params.threshold = static_cast<float>(c.threshold * c.threshold / 195075.0);
+        params.window = &window;
+        params.packed = nullptr;
+        params.packed_stride = 0;
+        params.half = nullptr;
+        params.half_stride = 0;
+        params.blocks = nullptr;
+
+        std::vector<uint8_t> block_buffer(ccdBlockMapSize(c.width, c.height) + 64);
+        ccdBlockMap map;
+        const ccdBlockMap *blocks = ccdClassifyBlocks(params, ccdTestAligned<void>(block_buffer), &map) ? &map : nullptr;
+
+        ccdRect rect = ccdFrameRect(c.width, c.height);
+        std::copy(expected.planes, expected.planes + 3, params.dst);
+        ccdKernelC(params, 0, 0, c.width, c.height);
+
+        // the plain kernels, called once over the frame and the way the filter calls them
+        for (const auto &k : ccdTestSelect<ccdKernelFunc>(ccdSelectKernel)) {
+            for (int tiled = 0; tiled < 2; tiled++) {
+                if (k.second == ccdKernelC && !tiled)
+                    continue;
+                ccdKernelParams p = params;
+                std::copy(actual.planes, actual.planes + 3, p.dst);
+                if (tiled) {
+                    p.blocks = blocks;
+                    ccdProcessFrame(k.second, p, rect);
+                } else {
+                    k.second(p, 0, 0, c.width, c.height);
+                }
+                ccdTestCompare(result(k.first + (tiled ? "-tiled" : ""), "c", 2e-6), c, expected, actual);
+            }
+        }
+
+        ccdTestMask mask(c.width, c.height);
+        for (const auto &k : ccdTestSelect<ccdKernelFunc>(ccdSelectKernel)) {
+            mask.run(k.second, params, c, expected, actual);
+            ccdTestCompare(result(k.first + "-masked", "c", 2e-6), c, expected, actual);
+        }
+
+        // the packed ones, which only hold the current frame, like the filter only uses them without refs
+        std::vector<uint8_t> packed_buffer(ccdPackedStride(c.width) * c.height * sizeof(float) + 64);
+        for (const auto &k : ccdTestSelect<ccdKernelFunc>(ccdSelectPackedKernel)) {
+            if (c.ref_count)
+                break;
+            ccdKernelParams p = params;
+            std::copy(actual.planes, actual.planes + 3, p.dst);
+            p.blocks = blocks;
+            p.packed_stride = ccdPackedStride(c.width);
+            ccdPackFrame(p, ccdTestAligned<float>(packed_buffer));
+            p.packed = ccdTestAligned<float>(packed_buffer);
+            ccdProcessFrame(k.second, p, rect);
+            ccdTestCompare(result(k.first + "-packed", "c", 2e-6), c, expected, actual);
+        }
+
+        runMulti(c, params, blocks);
+
+        const char *error;
+        if (ccdCheckFastWindow(c.radius, c.step, &error))
+            runFast(c, params, blocks, expected);
+        runHalf(c, params, src);
+        runInt(c, params, src, 8);
+        runInt(c, params, src, 10);
+        runInt(c, params, src, 14);
+        runInt(c, params, src, 16);
+    }
+
+private:
+    ccdTestResult &result(const std::string &name, const std::string &reference, double tolerance,
+                          double allowed = 0) {
+        for (ccdTestResult &r : results)
+            if (r.name == name && r.reference == reference)
+                return r;
+        results.push_back({name, reference, tolerance, allowed, 0, 0, 0, 0, std::string()});
+        return results.back();
+    }
+
+    // The lowest threshold is the one of the case, which the block map was classified with, the
+    // others above it and out of order.
+    void runMulti(const ccdTestCase &c, ccdKernelParams params, const ccdBlockMap *blocks) {
+        const double thresholds[] = {c.threshold * 2 + 10, c.threshold, c.threshold + 5};
+        const int count = 3;
+
+        ccdMultiKernelParams multi;
+        multi.params = params;
+        multi.params.blocks = blocks;
+        multi.count = count;
+        std::vector<ccdTestFrame<float>> expected, actual;
+        for (int t = 0; t < count; t++) {
+            expected.emplace_back(c.width, c.height);
+            actual.emplace_back(c.width, c.height);
+        }
+        for (int t = 0; t < count; t++) {
+            multi.thresholds[t] = static_cast<float>(thresholds[t] * thresholds[t] / 195075.0);
+            std::copy(actual[t].planes, actual[t].planes + 3, multi.dst[t]);
+            params.threshold = multi.thresholds[t];
+            std::copy(expected[t].planes, expected[t].planes + 3, params.dst);
+            ccdKernelC(params, 0, 0, c.width, c.height);
+        }
+
+        for (const auto &k : ccdTestSelect<ccdMultiKernelFunc>(ccdSelectMultiKernel)) {
+            ccdTestResult &r = result(k.first + "-multi", "c", 2e-6);
+            ccdProcessTiles(ccdFrameRect(c.width, c.height), c.radius, sizeof(float), c.ref_count + 1, nullptr, 1,
+                            [&](int x0, int y0, int x1, int y1) { k.second(multi, x0, y0, x1, y1); });
+            for (int t = 0; t < count; t++) {
+                ccdTestCase at = c;
+                at.threshold = thresholds[t];
+                ccdTestCompare(r, at, expected[t], actual[t]);
+            }
+        }
+    }
+
+    // Against ccdKernelFastC to the last bit, and against ccdKernelC, exact, which the fast test only
+    // approximates, see ccd_test_fast_tolerance.
+    void runFast(const ccdTestCase &c, ccdKernelParams params, const ccdBlockMap *blocks,
+                 const ccdTestFrame<float> &exact) {
+        std::vector<uint8_t> half_buffer(ccdHalfBufferSize(c.width, c.height, c.ref_count) + 64);
+        std::vector<float *> half(3 * (c.ref_count + 1));
+        ccdHalfPlanes(ccdTestAligned<float>(half_buffer), c.width, c.height, c.ref_count, half.data());
+        params.half = half.data();
+        params.half_stride = ccdHalfStride(c.width);
+        ccdRect rect = ccdFrameRect(c.width, c.height);
+        ccdHalveFrame(params, half.data(), rect);
+
+        ccdTestFrame<float> expected(c.width, c.height), actual(c.width, c.height);
+        std::copy(expected.planes, expected.planes + 3, params.dst);
+        ccdKernelFastC(params, 0, 0, c.width, c.height);
+
+        for (const auto &k : ccdTestSelect<ccdKernelFunc>(ccdSelectFastKernel)) {
+            ccdKernelParams p = params;
+            std::copy(actual.planes, actual.planes + 3, p.dst);
+            p.blocks = blocks;
+            ccdProcessFrame(k.second, p, rect);
+            ccdTestCompare(result(k.first + "-fast", "fast-c", 2e-6), c, expected, actual);
+            ccdTestCompare(result(k.first + "-fast", "c", ccd_test_fast_tolerance, ccd_test_fast_allowed), c, exact,
+                           actual);
+        }
+
+        ccdTestMask mask(c.width, c.height);
+        for (const auto &k : ccdTestSelect<ccdKernelFunc>(ccdSelectFastKernel)) {
+            mask.run(k.second, params, c, expected, actual);
+            ccdTestCompare(result(k.first + "-fast-masked", "fast-c", 2e-6), c, expected, actual);
+        }
+    }
+
+    // The reference runs on the samples rounded to half floats, and its output is rounded the same
+    // way, so only a last bit rounded the other way is allowed, about 5e-4 just below 1.
+    void runHalf(const ccdTestCase &c, ccdKernelParams params, std::vector<ccdTestFrame<float>> &src) {
+        std::vector<ccdHalfKernelFunc> kernels;
+        std::vector<std::string> names;
+        for (const auto &k : ccdTestSelect<ccdHalfKernelFunc>(ccdSelectHalfKernel)) {
+            names.push_back(k.first);
+            kernels.push_back(k.second);
+        }
+        if (kernels.empty())
+            return;
+
+        std::vector<ccdTestFrame<uint16_t>> halves;
+        std::vector<ccdTestFrame<float>> rounded;
+        std::vector<const uint16_t *> half_refs;
+        std::vector<const float *> rounded_refs;
+        for (size_t frame = 0; frame < src.size(); frame++) {
+            halves.emplace_back(c.width, c.height);
+            rounded.emplace_back(c.width, c.height);
+        }
+        for (size_t frame = 0; frame < src.size(); frame++) {
+            ccdFloatPlanesToHalf(src[frame].planes, src[frame].stride, halves[frame].planes, halves[frame].stride,
+                                 c.width, 0, c.height);
+            ccdHalfPlanesToFloat(halves[frame].planes, halves[frame].stride, rounded[frame].planes,
+                                 rounded[frame].stride, c.width, 0, c.height);
+            if (frame) {
+                half_refs.insert(half_refs.end(), halves[frame].planes, halves[frame].planes + 3);
+                rounded_refs.insert(rounded_refs.end(), rounded[frame].planes, rounded[frame].planes + 3);
+            }
+        }
+
+        ccdTestFrame<float> expected(c.width, c.height), actual(c.width, c.height);
+        ccdTestFrame<uint16_t> expected_half(c.width, c.height), actual_half(c.width, c.height);
+        std::copy(rounded[0].planes, rounded[0].planes + 3, params.src);
+        params.src_stride = rounded[0].stride;
+        params.refs = rounded_refs.data();
+        std::copy(expected.planes, expected.planes + 3, params.dst);
+        ccdKernelC(params, 0, 0, c.width, c.height);
+        ccdFloatPlanesToHalf(expected.planes, expected.stride, expected_half.planes, expected_half.stride, c.width,
+                             0, c.height);
+        ccdHalfPlanesToFloat(expected_half.planes, expected_half.stride, expected.planes, expected.stride, c.width,
+                             0, c.height);
+
+        ccdHalfKernelParams hp;
+        std::copy(halves[0].planes, halves[0].planes + 3, hp.src);
+        hp.src_stride = halves[0].stride;
+        hp.refs = half_refs.data();
+        hp.ref_count = c.ref_count;
+        std::copy(actual_half.planes, actual_half.planes + 3, hp.dst);
+        hp.dst_stride = actual_half.stride;
+        hp.width = c.width;
+        hp.height = c.height;
+        hp.threshold = params.threshold;
+        hp.window = params.window;
+        hp.blocks = nullptr;
+
+        std::vector<uint8_t> block_buffer(ccdBlockMapSize(c.width, c.height) + 64);
+        ccdBlockMap map;
+        if (ccdClassifyBlocks(hp, ccdTestAligned<void>(block_buffer), &map))
+            hp.blocks = &map;
+
+        for (size_t i = 0; i < kernels.size(); i++) {
+            ccdProcessFrame(kernels[i], hp, ccdFrameRect(c.width, c.height));
+            ccdHalfPlanesToFloat(actual_half.planes, actual_half.stride, actual.planes, actual.stride, c.width, 0,
+                                 c.height);
+            ccdTestCompare(result(names[i] + "-half", "c", 1.0 / 1024), c, expected, actual);
+        }
+    }
+
+    // Out of range samples don't exist in integer formats, they're clamped to what the bit depth
+    // holds here.
+    void runInt(const ccdTestCase &c, const ccdKernelParams &params, std::vector<ccdTestFrame<float>> &src,
+                int bits) {
+        if (bits == 8)
+            runInt<uint8_t>(c, params, src, bits, ccdKernel8C);
+        else
+            runInt<uint16_t>(c, params, src, bits, ccdKernel16C);
+    }
+
+    template <typename T>
+    void runInt(const ccdTestCase &c, const ccdKernelParams &params, std::vector<ccdTestFrame<float>> &src,
+                int bits, ccdIntKernelFunc reference) {
+        int peak = (1 << bits) - 1;
+        std::vector<ccdTestFrame<T>> frames;
+        std::vector<const void *> refs;
+        for (size_t frame = 0; frame < src.size(); frame++)
+            frames.emplace_back(c.width, c.height);
+        for (size_t frame = 0; frame < src.size(); frame++) {
+            for (int plane = 0; plane < 3; plane++)
+                for (int y = 0; y < c.height; y++)
+                    for (int x = 0; x < c.width; x++) {
+                        float v = src[frame].planes[plane][y * src[frame].stride + x];
+                        frames[frame].planes[plane][y * frames[frame].stride + x] =
+                            static_cast<T>(std::min(std::max(std::lround(v * peak), 0L), static_cast<long>(peak)));
+                    }
+            if (frame)
+                refs.insert(refs.end(), frames[frame].planes, frames[frame].planes + 3);
+        }
+
+        // ccdKernelC on the same samples, which the integer kernels only match to within
+        // ccdTestIntTolerance
+        std::vector<ccdTestFrame<float>> scaled;
+        std::vector<const float *> scaled_refs;
+        for (size_t frame = 0; frame < src.size(); frame++)
+            scaled.emplace_back(c.width, c.height);
+        for (size_t frame = 0; frame < src.size(); frame++) {
+            ccdTestToFloat(frames[frame], scaled[frame], c, peak);
+            if (frame)
+                scaled_refs.insert(scaled_refs.end(), scaled[frame].planes, scaled[frame].planes + 3);
+        }
+        ccdTestFrame<float> exact(c.width, c.height), converted(c.width, c.height);
+        ccdKernelParams fp = params;
+        std::copy(scaled[0].planes, scaled[0].planes + 3, fp.src);
+        fp.src_stride = scaled[0].stride;
+        fp.refs = scaled_refs.data();
+        std::copy(exact.planes, exact.planes + 3, fp.dst);
+        fp.dst_stride = exact.stride;
+        fp.blocks = nullptr;
+        ccdKernelC(fp, 0, 0, c.width, c.height);
+
+        ccdTestFrame<T> expected(c.width, c.height), actual(c.width, c.height);
+        ccdIntKernelParams ip;
+        std::copy(frames[0].planes, frames[0].planes + 3, ip.src);
+        ip.src_stride = frames[0].stride;
+        ip.refs = refs.data();
+        ip.ref_count = c.ref_count;
+        std::copy(expected.planes, expected.planes + 3, ip.dst);
+        ip.dst_stride = expected.stride;
+        ip.width = c.width;
+        ip.height = c.height;
+        ip.threshold = ccdIntThreshold(c.threshold * c.threshold / 195075.0, bits);
+        ip.shift = ccdIntShift(bits);
+        ip.window = params.window;
+        ip.blocks = nullptr;
+        reference(ip, 0, 0, c.width, c.height);
+
+        // past the largest distance the map is filled the way ccdCore does, without classifying
+        std::vector<uint8_t> block_buffer(ccdBlockMapSize(c.width, c.height) + 64);
+        ccdBlockMap map;
+        if (ip.threshold > ccdIntMaxDistance(bits)) {
+            ccdFillBlocks(c.width, c.height, ccdBlockAverage, ccdTestAligned<void>(block_buffer), &map);
+            ip.blocks = &map;
+        } else if (ccdClassifyBlocks(ip, sizeof(T), ccdTestAligned<void>(block_buffer), &map)) {
+            ip.blocks = &map;
+        }
+        std::copy(actual.planes, actual.planes + 3, ip.dst);
+
+        std::string suffix = "-" + std::to_string(bits) + "bit";
+        for (const auto &k : ccdTestSelect<ccdIntKernelFunc>([](int opt) { return ccdSelectIntKernel(opt, sizeof(T)); })) {
+            ccdProcessFrame(k.second, ip, sizeof(T), ccdFrameRect(c.width, c.height));
+            ccdTestCompare(result(k.first + suffix, "c" + suffix, 0), c, expected, actual);
+            ccdTestToFloat(actual, converted, c, peak);
+            ccdTestCompare(result(k.first + suffix, "c", ccdTestIntTolerance(bits), ccdTestIntAllowed(bits)), c, exact,
+                           converted);
+        }
+    }
+};
+
+} // namespace
+
+// ccdBlockKindAt on vectors across the blocks of a single row, against what each has to be.
+bool ccdTestBlockKinds() {
+    struct Span {
+        uint8_t kinds[4];
+        int x;
+        int width;
+        int expected;
+    };
+    static const Span spans[] = {
+        {{ccdBlockSkip, ccdBlockTest, ccdBlockSkip, ccdBlockSkip}, 8, 32, ccdBlockTest},
+        {{ccdBlockSkip, ccdBlockSkip, ccdBlockSkip, ccdBlockSkip}, 8, 32, ccdBlockSkip},
+        {{ccdBlockFlat, ccdBlockFlat, ccdBlockFlat, ccdBlockFlat}, 8, 32, ccdBlockAverage},
+        {{ccdBlockFlat, ccdBlockFlat, ccdBlockFlat, ccdBlockFlat}, 16, 16, ccdBlockFlat},
+        {{ccdBlockSkip, ccdBlockAverage, ccdBlockFlat, ccdBlockSkip}, 8, 32, ccdBlockAverage},
+        // past the last column, as the vectors of the edge strips go
+        {{ccdBlockSkip, ccdBlockSkip, ccdBlockSkip, ccdBlockTest}, 40, 32, ccdBlockSkip},
+    };
+
+    bool passed = true;
+    for (const Span &span : spans) {
+        ccdBlockMap map = {span.kinds, nullptr, 3};
+        int kind = ccdBlockKindAt(&map, span.x, 0, span.width);
+        if (kind != span.expected) {
+            printf("block kind of %d pixels from %d: %d instead of %d\n", span.width, span.x, kind, span.expected);
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+int main() {
+    static const int sizes[][2] = {{12, 12}, {13, 12}, {12, 17}, {37, 29}, {131, 77}, {333, 201}};
+    static const int windows[][2] = {{12, 8}, {4, 2}, {3, 1}, {16, 4}};
+    static const double thresholds[] = {0, 4, 30, 1e4};
+
+    ccdTestRunner runner;
+    uint32_t seed = 1;
+    int cases = 0;
+
+    for (const auto &size : sizes) {
+        for (const auto &window : windows) {
+            const char *error;
+            if (!ccdCheckWindow(window[0], window[1], &error))
+                continue;
+            for (double threshold : thresholds) {
+                for (int content = ccdTestNoise; content <= ccdTestOutOfRange; content++) {
+                    for (int ref_count = 0; ref_count <= 2; ref_count += 2) {
+                        // the dense window on the largest frames takes a while and adds nothing
+                        if (window[1] == 1 && size[0] > 131)
+                            continue;
+                        ccdTestCase c = {size[0], size[1], window[0], window[1], ref_count, threshold,
+                                         static_cast<ccdTestContent>(content)};
+                        runner.run(c, seed++);
+                        cases++;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("%d cases\n", cases);
+    printf("%-18s %-10s %10s %8s %6s %12s %10s\n", "kernel", "reference", "tolerance", "allowed", "cases",
+           "max error", "mismatches");
+    bool passed = true;
+    for (const ccdTestResult &r : runner.results) {
+        printf("%-18s %-10s %10.2g %8.2g %6d %12.3g %10lld\n", r.name.c_str(), r.reference.c_str(), r.tolerance,
+               r.allowed, r.cases, r.max_error, r.mismatches);
+        passed = passed && r.passed();
+    }
+    for (const ccdTestResult &r : runner.results)
+        if (!r.passed())
+            printf("%s: first mismatch in %s\n", r.name.c_str(), r.first_failure.c_str());
+    passed = ccdTestBlockKinds() && passed;
+
+    printf(passed ? "all kernels match\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
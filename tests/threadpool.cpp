@@ -0,0 +1,107 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+
+// Runs ccdThreadPool::run from several threads at once, the way the frames of several getframe
+// calls share the pool, and checks that every task of every call runs exactly once. Then checks
+// the budget: helpers join a frame while the host has threads to spare, and none do once
+// ccdThreadPool::Frame says every thread of the host is busy with a frame.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "threadpool.h"
+
+namespace {
+
+const int ccd_test_callers = 8;
+const int ccd_test_rounds = 200;
+const int ccd_test_budget = 4;
+
+// Every caller runs rounds of a different number of tasks and counts how often each one ran.
+bool ccdTestConcurrentRuns(ccdThreadPool *pool) {
+    std::atomic<int> failures(0);
+    std::vector<std::thread> callers;
+
+    for (int caller = 0; caller < ccd_test_callers; caller++) {
+        callers.emplace_back([&, caller] {
+            for (int round = 0; round < ccd_test_rounds; round++) {
+                int count = 1 + (caller * 37 + round * 11) % 97;
+                std::vector<std::atomic<int>> runs(count);
+                for (auto &r : runs)
+                    r = 0;
+
+                pool->run(count, 1 + round % ccd_test_budget, [&](int i) { runs[i].fetch_add(1); });
+
+                for (int i = 0; i < count; i++)
+                    if (runs[i].load() != 1)
+                        failures.fetch_add(1);
+            }
+        });
+    }
+    for (auto &t : callers)
+        t.join();
+
+    printf("%d callers x %d rounds: %d tasks not run exactly once\n", ccd_test_callers, ccd_test_rounds,
+           failures.load());
+    return failures.load() == 0;
+}
+
+// The threads that ran count tasks which take a while each, so idle helpers have time to join.
+std::set<std::thread::id> ccdTestThreadsUsed(ccdThreadPool *pool, int count) {
+    std::mutex mutex;
+    std::set<std::thread::id> used;
+    pool->run(count, ccd_test_budget - 1, [&](int) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::lock_guard<std::mutex> lock(mutex);
+        used.insert(std::this_thread::get_id());
+    });
+    return used;
+}
+
+bool ccdTestBudget(ccdThreadPool *pool) {
+    bool passed = true;
+
+    // one frame in flight leaves the others to the helpers
+    {
+        ccdThreadPool::Frame frame;
+        size_t used = ccdTestThreadsUsed(pool, 100).size();
+        printf("1 of %d threads in frames: %zu threads ran the tasks\n", ccd_test_budget, used);
+        passed = used > 1 && passed;
+    }
+
+    // with all of them in frames the calling thread is on its own
+    {
+        std::vector<ccdThreadPool::Frame> frames(ccd_test_budget);
+        std::set<std::thread::id> used = ccdTestThreadsUsed(pool, 100);
+        printf("%d of %d threads in frames: %zu threads ran the tasks\n", ccd_test_budget, ccd_test_budget,
+               used.size());
+        passed = used.size() == 1 && *used.begin() == std::this_thread::get_id() && passed;
+    }
+
+    return passed;
+}
+
+} // namespace
+
+int main() {
+    ccdThreadPool *pool = ccdThreadPool::acquire(ccd_test_budget - 1, ccd_test_budget);
+
+    bool passed = ccdTestConcurrentRuns(pool);
+    passed = ccdTestBudget(pool) && passed;
+
+    ccdThreadPool::release();
+
+    printf(passed ? "the pool runs every task once and stays within its budget\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,378 @@
+/**
+ *  CCD - Camcorder Color Denoise v0.1
+ *
+ *  Copyright (c) 2021 Arjun Raj (End of Eternity)
+ *  Copyright (c) 2021 Atharva (Scrad)
+ *
+ *  This project is licensed under the GPL v3 License.
+ **/
+
+// Checks CCDYUV's conversions and its frame loop against doing the same by hand, for one matrix
+// of every set of coefficients (709, 470bg, 240m, 2020ncl and 2020cl), limited and full range
+// 8 bit and float samples, 4:4:4 and 4:2:0, on random frames with flat, smooth and noisy
+// patches so the block map has every kind:
+//   reference  - ccdYUVToRGB against the matrix and range as the standards write them down, in
+//                double, within ccd_test_reference for 4:4:4, where the luma is the source's
+//   round trip - ccdYUVToRGB and then ccdRGBToUV give back the source chroma, to the sample for
+//                8 bit and within ccd_test_float_round_trip for float
+//   frame      - ccdProcessYUVFrame matches ccdYUVToRGB, ccdCore::process on the R'G'B' it
+//                gives and ccdRGBToUV of the result, all of the frame and a rectangle in the
+//                middle of it, with one and two iterations, exactly: it's the same kernel on the
+//                same samples
+// The luma plane of dst is nullptr as in the plugin, which shares the source's, so writing it
+// would crash. Fails on any difference past those.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "core.h"
+#include "yuv.h"
+
+namespace {
+
+// float chroma comes back within a few rounding errors of the matrix and the 2020 transfer
+// function, past those the conversions don't agree
+const double ccd_test_float_round_trip = 1e-5;
+
+// the single precision of the conversion, the 2020 transfer function loses the most
+const double ccd_test_reference = 1e-5;
+
+struct ccdTestMatrix {
+    int matrix;
+    const char *name;
+    double kr;
+    double kb;
+};
+
+const ccdTestMatrix ccd_test_matrices[] = {
+    {1, "709", 0.2126, 0.0722},
+    {5, "470bg", 0.299, 0.114},
+    {7, "240m", 0.212, 0.087},
+    {9, "2020ncl", 0.2627, 0.0593},
+    {10, "2020cl", 0.2627, 0.0593},
+};
+
+struct ccdTestFormat {
+    ccdSampleKind kind;
+    int bits;
+    bool full_range;
+    const char *name;
+};
+
+const ccdTestFormat ccd_test_formats[] = {
+    {ccdSampleByte, 8, false, "8 bit limited"},
+    {ccdSampleByte, 8, true, "8 bit full"},
+    {ccdSampleFloat, 32, true, "float"},
+};
+
+struct ccdTestRandom {
+    uint32_t state;
+
+    float next() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) / 16777216.0f;
+    }
+};
+
+// The three planes of a YUV frame of T, the chroma ones subsampled by ssw and ssh.
+template <typename T>
+struct ccdTestYUV {
+    std::vector<T> planes[3];
+    int width[3];
+    int height[3];
+
+    ccdTestYUV(int luma_width, int luma_height, int ssw, int ssh) {
+        for (int plane = 0; plane < 3; plane++) {
+            width[plane] = plane ? luma_width >> ssw : luma_width;
+            height[plane] = plane ? luma_height >> ssh : luma_height;
+            planes[plane].resize(static_cast<size_t>(width[plane]) * height[plane]);
+        }
+    }
+};
+
+// A sample of the format from v in [0, 1] of the luma or chroma range.
+template <typename T>
+T ccdTestSample(const ccdTestFormat &f, float v, bool chroma) {
+    if (f.kind == ccdSampleFloat)
+        return static_cast<T>(chroma ? v - 0.5f : v);
+    float lo = f.full_range ? 0 : 16, hi = f.full_range ? 255 : chroma ? 240 : 235;
+    return static_cast<T>(std::lround(lo + v * (hi - lo)));
+}
+
+// Patches of 12x12 chroma pixels, each flat, smooth or noisy, so there's a bit of everything.
+template <typename T>
+void ccdTestFill(ccdTestYUV<T> &yuv, const ccdTestFormat &f, int ssw, int ssh, uint32_t seed) {
+    ccdTestRandom random = {seed};
+    int patches_x = (yuv.width[1] + 11) / 12, patches_y = (yuv.height[1] + 11) / 12;
+    std::vector<float> base(3 * patches_x * patches_y), noise(patches_x * patches_y);
+    for (float &b : base)
+        b = 0.1f + 0.8f * random.next();
+    for (float &n : noise) {
+        float r = random.next();
+        n = r < 0.4f ? 0 : r < 0.7f ? 0.005f : 0.3f;
+    }
+
+    for (int plane = 0; plane < 3; plane++) {
+        for (int y = 0; y < yuv.height[plane]; y++) {
+            for (int x = 0; x < yuv.width[plane]; x++) {
+                int px = (plane ? x : x >> ssw) / 12, py = (plane ? y : y >> ssh) / 12;
+                int patch = py * patches_x + px;
+                float v = base[3 * patch + plane] + noise[patch] * (random.next() - 0.5f);
+                v = std::min(std::max(v, 0.0f), 1.0f);
+                yuv.planes[plane][static_cast<size_t>(y) * yuv.width[plane] + x] = ccdTestSample<T>(f, v, plane > 0);
+            }
+        }
+    }
+}
+
+// BT.2020's transfer function and its inverse, for positive values.
+double ccdTestEncode2020(double l) {
+    const double alpha = 1.09929682680944, beta = 0.018053968510807;
+    return l < beta ? 4.5 * l : alpha * std::pow(l, 0.45) - (alpha - 1);
+}
+
+double ccdTestDecode2020(double e) {
+    const double alpha = 1.09929682680944, beta = 0.018053968510807;
+    return e < 4.5 * beta ? e / 4.5 : std::pow((e + alpha - 1) / alpha, 1 / 0.45);
+}
+
+// R'G'B' of the stored samples y, u and v, as BT.601/709/2020 define them: limited range with Y'
+// from 16 to 235 and the chroma from 16 to 240 around 128 (times 2^(bits - 8)), and for 2020cl
+// the luma made of the linear R, G and B and the chroma scaled by 1.9404 or 1.5816 (Cb) and 1.7184
+// or 0.9936 (Cr) for negative and positive differences. Returns false for the samples of 2020cl
+// with a negative R', G' or B', where the transfer function isn't defined and ccdYUVToRGB mirrors
+// it, there's nothing to check those against.
+bool ccdTestReferenceRGB(const ccdTestMatrix &m, const ccdTestFormat &f, double y, double u, double v,
+                         double *rgb) {
+    if (f.kind != ccdSampleFloat) {
+        double unit = 1 << (f.bits - 8), peak = (1 << f.bits) - 1;
+        y = f.full_range ? y / peak : (y - 16 * unit) / (219 * unit);
+        u = (u - 128 * unit) / (f.full_range ? peak : 224 * unit);
+        v = (v - 128 * unit) / (f.full_range ? peak : 224 * unit);
+    }
+
+    double kg = 1 - m.kr - m.kb;
+    if (m.matrix != 10) {
+        rgb[0] = y + 2 * (1 - m.kr) * v;
+        rgb[2] = y + 2 * (1 - m.kb) * u;
+        rgb[1] = (y - m.kr * rgb[0] - m.kb * rgb[2]) / kg;
+        return true;
+    }
+
+    rgb[0] = y + v * (v <= 0 ? 1.7184 : 0.9936);
+    rgb[2] = y + u * (u <= 0 ? 1.9404 : 1.5816);
+    if (y < 0 || rgb[0] < 0 || rgb[2] < 0)
+        return false;
+    double green = (ccdTestDecode2020(y) - m.kr * ccdTestDecode2020(rgb[0]) - m.kb * ccdTestDecode2020(rgb[2])) / kg;
+    rgb[1] = ccdTestEncode2020(green);
+    return green >= 0;
+}
+
+struct ccdTestResult {
+    std::string name;
+    double tolerance;
+    int cases;
+    double max_error;
+    long long mismatches;
+};
+
+class ccdTestRunner {
+public:
+    std::vector<ccdTestResult> results;
+
+    template <typename T>
+    void run(const ccdTestMatrix &m, const ccdTestFormat &f, int ssw, int ssh, uint32_t seed) {
+        const int luma_width = 2 * 101, luma_height = 2 * 67;
+        ccdTestYUV<T> src(luma_width, luma_height, ssw, ssh);
+        ccdTestFill(src, f, ssw, ssh, seed);
+
+        ccdYUVParams params = {};
+        for (int plane = 0; plane < 3; plane++)
+            params.src[plane] = src.planes[plane].data();
+        params.src_stride = src.width[1];
+        params.luma_stride = src.width[0];
+        params.width = src.width[1];
+        params.height = src.height[1];
+        params.ssw = ssw;
+        params.ssh = ssh;
+        params.kind = f.kind;
+        params.bits = f.bits;
+        params.full_range = f.full_range;
+        ccdMatrixCoefficients(m.matrix, &params.kr, &params.kb, &params.constant_luminance);
+
+        std::string name = std::string(m.name) + ", " + f.name + (ssw ? ", 4:2:0" : ", 4:4:4");
+        if (!ssw)
+            reference(params, m, f, src, result(name + ", reference", ccd_test_reference));
+        double tolerance = f.kind == ccdSampleFloat ? ccd_test_float_round_trip : 0;
+        roundTrip(params, src, result(name + ", round trip", tolerance));
+
+        int w = params.width, h = params.height;
+        ccdRect rects[] = {{0, 0, 0, 0}, {w / 4, h / 3 + 1, w / 2 + 5, h / 2 + 7}};
+        for (const ccdRect &roi : rects) {
+            for (int iterations = 1; iterations <= 2; iterations++) {
+                std::string variant = std::string(roi.right ? ", rect" : ", frame") +
+                                      (iterations > 1 ? ", 2 passes" : "");
+                frame(params, src, roi, iterations, result(name + variant, 0));
+            }
+        }
+    }
+
+private:
+    ccdTestResult &result(const std::string &name, double tolerance) {
+        for (auto &r : results)
+            if (r.name == name)
+                return r;
+        results.push_back({name, tolerance, 0, 0, 0});
+        return results.back();
+    }
+
+    // R'G'B' planes at chroma resolution, with the alignment CCDYUV gives them.
+    struct Planes {
+        std::vector<float> storage;
+        float *planes[3];
+        ptrdiff_t stride;
+
+        Planes(int width, int height) : stride((width + 15) & ~static_cast<ptrdiff_t>(15)) {
+            storage.resize(stride * height * 3);
+            for (int plane = 0; plane < 3; plane++)
+                planes[plane] = storage.data() + stride * height * plane;
+        }
+    };
+
+    template <typename T>
+    static void compare(ccdTestResult &r, const std::vector<T> *expected, const std::vector<T> *actual,
+                        int width, const ccdRect &rect) {
+        r.cases++;
+        for (int plane = 1; plane < 3; plane++) {
+            for (int y = rect.top; y < rect.bottom; y++) {
+                for (int x = rect.left; x < rect.right; x++) {
+                    size_t i = static_cast<size_t>(y) * width + x;
+                    double error = std::fabs(static_cast<double>(expected[plane][i]) - actual[plane][i]);
+                    r.max_error = std::max(r.max_error, error);
+                    r.mismatches += !(error <= r.tolerance);
+                }
+            }
+        }
+    }
+
+    template <typename T>
+    static void reference(const ccdYUVParams &params, const ccdTestMatrix &m, const ccdTestFormat &f,
+                          const ccdTestYUV<T> &src, ccdTestResult &r) {
+        Planes rgb(params.width, params.height);
+        ccdYUVToRGB(params, rgb.planes, rgb.stride, 0, params.height);
+
+        r.cases++;
+        for (int y = 0; y < params.height; y++) {
+            for (int x = 0; x < params.width; x++) {
+                size_t i = static_cast<size_t>(y) * params.width + x;
+                double expected[3];
+                if (!ccdTestReferenceRGB(m, f, src.planes[0][i], src.planes[1][i], src.planes[2][i], expected))
+                    continue;
+                for (int plane = 0; plane < 3; plane++) {
+                    double error = std::fabs(expected[plane] - rgb.planes[plane][y * rgb.stride + x]);
+                    r.max_error = std::max(r.max_error, error);
+                    r.mismatches += !(error <= r.tolerance);
+                }
+            }
+        }
+    }
+
+    template <typename T>
+    static void roundTrip(ccdYUVParams params, const ccdTestYUV<T> &src, ccdTestResult &r) {
+        Planes rgb(params.width, params.height);
+        ccdTestYUV<T> dst(src.width[0], src.height[0], params.ssw, params.ssh);
+        params.dst[0] = nullptr;
+        params.dst[1] = dst.planes[1].data();
+        params.dst[2] = dst.planes[2].data();
+        params.dst_stride = dst.width[1];
+
+        ccdYUVToRGB(params, rgb.planes, rgb.stride, 0, params.height);
+        ccdRGBToUV(params, rgb.planes, rgb.stride, 0, 0, params.width, params.height);
+        compare(r, src.planes, dst.planes, params.width, ccdFrameRect(params.width, params.height));
+    }
+
+    template <typename T>
+    static void frame(ccdYUVParams params, const ccdTestYUV<T> &src, const ccdRect &roi, int iterations,
+                      ccdTestResult &r) {
+        ccdCoreOptions options;
+        options.iterations = iterations;
+        options.roi = roi;
+        ccdCore core;
+        std::string error;
+        if (!core.init(options, params.width, params.height, true, 32, &error)) {
+            printf("%s: %s\n", r.name.c_str(), error.c_str());
+            r.mismatches++;
+            return;
+        }
+
+        // by hand: the whole frame to R'G'B', the core, and the rectangle back
+        ccdTestYUV<T> expected(src.width[0], src.height[0], params.ssw, params.ssh);
+        ccdYUVParams by_hand = params;
+        by_hand.dst[0] = nullptr;
+        by_hand.dst[1] = expected.planes[1].data();
+        by_hand.dst[2] = expected.planes[2].data();
+        by_hand.dst_stride = expected.width[1];
+
+        Planes rgb(params.width, params.height), denoised(params.width, params.height);
+        ccdYUVToRGB(by_hand, rgb.planes, rgb.stride, 0, params.height);
+        ccdCoreFrame in = {{rgb.planes[0], rgb.planes[1], rgb.planes[2]},
+                           static_cast<ptrdiff_t>(rgb.stride * sizeof(float))};
+        ccdCoreOutput out = {{denoised.planes[0], denoised.planes[1], denoised.planes[2]},
+                             static_cast<ptrdiff_t>(denoised.stride * sizeof(float))};
+        core.process(in, nullptr, 0, nullptr, out);
+        ccdRGBToUV(by_hand, denoised.planes, denoised.stride, core.roi.left, core.roi.top, core.roi.right,
+                   core.roi.bottom);
+
+        // and as CCDYUV does it, with the pooled buffers it'd get starting out as garbage
+        ccdTestYUV<T> actual(src.width[0], src.height[0], params.ssw, params.ssh);
+        params.dst[0] = nullptr;
+        params.dst[1] = actual.planes[1].data();
+        params.dst[2] = actual.planes[2].data();
+        params.dst_stride = actual.width[1];
+
+        Planes rgb_in(params.width, params.height), rgb_out(params.width, params.height);
+        std::fill(rgb_in.storage.begin(), rgb_in.storage.end(), NAN);
+        std::fill(rgb_out.storage.begin(), rgb_out.storage.end(), NAN);
+        std::vector<uint8_t> blocks(ccdBlockMapSize(params.width, params.height) + 64, 0xcd);
+        void *aligned = reinterpret_cast<void *>((reinterpret_cast<uintptr_t>(blocks.data()) + 63) &
+                                                 ~static_cast<uintptr_t>(63));
+
+        ccdProcessYUVFrame(core.kernel, params, nullptr, 0, core.threshold, core.window, core.iterations, core.roi,
+                           rgb_in.planes, rgb_out.planes, rgb_in.stride, aligned, nullptr, nullptr, nullptr,
+                           nullptr);
+        compare(r, expected.planes, actual.planes, params.width, core.roi);
+    }
+};
+
+} // namespace
+
+int main() {
+    ccdTestRunner runner;
+    uint32_t seed = 1;
+
+    for (const ccdTestMatrix &m : ccd_test_matrices) {
+        for (const ccdTestFormat &f : ccd_test_formats) {
+            for (int ss = 0; ss <= 1; ss++) {
+                if (f.kind == ccdSampleFloat)
+                    runner.run<float>(m, f, ss, ss, seed++);
+                else
+                    runner.run<uint8_t>(m, f, ss, ss, seed++);
+            }
+        }
+    }
+
+    bool passed = true;
+    printf("%-46s %10s %6s %12s %10s\n", "conversion", "tolerance", "cases", "max error", "mismatches");
+    for (const auto &r : runner.results) {
+        printf("%-46s %10.3g %6d %12.3g %10lld%s\n", r.name.c_str(), r.tolerance, r.cases, r.max_error,
+               r.mismatches, r.mismatches ? "  FAILED" : "");
+        passed = passed && !r.mismatches;
+    }
+
+    printf(passed ? "CCDYUV matches converting by hand\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}